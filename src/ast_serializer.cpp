@@ -0,0 +1,794 @@
+#include "ast_serializer.h"
+
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace nasal {
+
+const char ast_magic[] = "NAST";
+const u32 ast_version = 1;
+const u8 ast_null_pointer = 0xff;
+// deeper input is rejected and parsed again from source,
+// no tree of test/ or std/ is close to it
+const u32 ast_max_depth = 4096;
+
+void ast_serializer::put_u8(u8 n) {
+    body.push_back((char)n);
+}
+
+void ast_serializer::put_u32(u32 n) {
+    for(u32 i = 0; i<4; ++i) {
+        body.push_back((char)((n>>(i*8))&0xff));
+    }
+}
+
+void ast_serializer::put_f64(f64 n) {
+    u64 bits = 0;
+    std::memcpy(&bits, &n, sizeof(bits));
+    for(u32 i = 0; i<8; ++i) {
+        body.push_back((char)((bits>>(i*8))&0xff));
+    }
+}
+
+void ast_serializer::put_string(const std::string& str) {
+    if (!string_index.count(str)) {
+        string_index[str] = strings.size();
+        strings.push_back(str);
+    }
+    put_u32(string_index.at(str));
+}
+
+void ast_serializer::put_node(expr* node) {
+    if (!node) {
+        put_u8(ast_null_pointer);
+        return;
+    }
+    node->accept(this);
+}
+
+void ast_serializer::put_header(expr* node) {
+    const auto& loc = node->get_location();
+    put_u8((u8)node->get_type());
+    put_string(loc.file);
+    put_u32(loc.begin_line);
+    put_u32(loc.begin_column);
+    put_u32(loc.end_line);
+    put_u32(loc.end_column);
+}
+
+bool ast_serializer::visit_null_expr(null_expr* node) {
+    put_header(node);
+    return true;
+}
+
+bool ast_serializer::visit_nil_expr(nil_expr* node) {
+    put_header(node);
+    return true;
+}
+
+bool ast_serializer::visit_number_literal(number_literal* node) {
+    put_header(node);
+    put_f64(node->get_number());
+    return true;
+}
+
+bool ast_serializer::visit_string_literal(string_literal* node) {
+    put_header(node);
+    put_string(node->get_content());
+    return true;
+}
+
+bool ast_serializer::visit_identifier(identifier* node) {
+    put_header(node);
+    put_string(node->get_name());
+    return true;
+}
+
+bool ast_serializer::visit_bool_literal(bool_literal* node) {
+    put_header(node);
+    put_u8(node->get_flag());
+    return true;
+}
+
+bool ast_serializer::visit_vector_expr(vector_expr* node) {
+    put_header(node);
+    put_u32(node->get_elements().size());
+    for(auto i : node->get_elements()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_hash_expr(hash_expr* node) {
+    put_header(node);
+    put_u32(node->get_members().size());
+    for(auto i : node->get_members()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_hash_pair(hash_pair* node) {
+    put_header(node);
+    put_string(node->get_name());
+    put_node(node->get_value());
+    return true;
+}
+
+bool ast_serializer::visit_function(function* node) {
+    put_header(node);
+    put_u32(node->get_parameter_list().size());
+    for(auto i : node->get_parameter_list()) {
+        put_node(i);
+    }
+    put_node(node->get_code_block());
+    return true;
+}
+
+bool ast_serializer::visit_code_block(code_block* node) {
+    put_header(node);
+    put_u32(node->get_expressions().size());
+    for(auto i : node->get_expressions()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_parameter(parameter* node) {
+    put_header(node);
+    put_u8((u8)node->get_parameter_type());
+    put_string(node->get_parameter_name());
+    put_node(node->get_default_value());
+    return true;
+}
+
+bool ast_serializer::visit_ternary_operator(ternary_operator* node) {
+    put_header(node);
+    put_node(node->get_condition());
+    put_node(node->get_left());
+    put_node(node->get_right());
+    return true;
+}
+
+bool ast_serializer::visit_binary_operator(binary_operator* node) {
+    put_header(node);
+    put_u8((u8)node->get_operator_type());
+    put_node(node->get_left());
+    put_node(node->get_right());
+    put_node(node->get_optimized_number());
+    put_node(node->get_optimized_string());
+    return true;
+}
+
+bool ast_serializer::visit_unary_operator(unary_operator* node) {
+    put_header(node);
+    put_u8((u8)node->get_operator_type());
+    put_node(node->get_value());
+    put_node(node->get_optimized_number());
+    return true;
+}
+
+bool ast_serializer::visit_call_expr(call_expr* node) {
+    put_header(node);
+    put_node(node->get_first());
+    put_u32(node->get_calls().size());
+    for(auto i : node->get_calls()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_call_hash(call_hash* node) {
+    put_header(node);
+    put_string(node->get_field());
+    return true;
+}
+
+bool ast_serializer::visit_call_vector(call_vector* node) {
+    put_header(node);
+    put_u32(node->get_slices().size());
+    for(auto i : node->get_slices()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_call_function(call_function* node) {
+    put_header(node);
+    put_u32(node->get_argument().size());
+    for(auto i : node->get_argument()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_slice_vector(slice_vector* node) {
+    put_header(node);
+    put_node(node->get_begin());
+    put_node(node->get_end());
+    return true;
+}
+
+bool ast_serializer::visit_definition_expr(definition_expr* node) {
+    put_header(node);
+    put_node(node->get_variable_name());
+    put_node(node->get_variables());
+    put_node(node->get_tuple());
+    put_node(node->get_value());
+    return true;
+}
+
+bool ast_serializer::visit_assignment_expr(assignment_expr* node) {
+    put_header(node);
+    put_u8((u8)node->get_assignment_type());
+    put_node(node->get_left());
+    put_node(node->get_right());
+    return true;
+}
+
+bool ast_serializer::visit_multi_identifier(multi_identifier* node) {
+    put_header(node);
+    put_u32(node->get_variables().size());
+    for(auto i : node->get_variables()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_tuple_expr(tuple_expr* node) {
+    put_header(node);
+    put_u32(node->get_elements().size());
+    for(auto i : node->get_elements()) {
+        put_node(i);
+    }
+    return true;
+}
+
+bool ast_serializer::visit_multi_assign(multi_assign* node) {
+    put_header(node);
+    put_node(node->get_tuple());
+    put_node(node->get_value());
+    return true;
+}
+
+bool ast_serializer::visit_while_expr(while_expr* node) {
+    put_header(node);
+    put_node(node->get_condition());
+    put_node(node->get_code_block());
+    return true;
+}
+
+bool ast_serializer::visit_for_expr(for_expr* node) {
+    put_header(node);
+    put_node(node->get_initial());
+    put_node(node->get_condition());
+    put_node(node->get_step());
+    put_node(node->get_code_block());
+    return true;
+}
+
+bool ast_serializer::visit_iter_expr(iter_expr* node) {
+    put_header(node);
+    put_u8(node->is_definition());
+    put_node(node->get_name());
+    put_node(node->get_call());
+    return true;
+}
+
+bool ast_serializer::visit_forei_expr(forei_expr* node) {
+    put_header(node);
+    put_u8((u8)node->get_loop_type());
+    put_node(node->get_iterator());
+    put_node(node->get_value());
+    put_node(node->get_code_block());
+    return true;
+}
+
+bool ast_serializer::visit_condition_expr(condition_expr* node) {
+    put_header(node);
+    put_node(node->get_if_statement());
+    put_u32(node->get_elsif_stataments().size());
+    for(auto i : node->get_elsif_stataments()) {
+        put_node(i);
+    }
+    put_node(node->get_else_statement());
+    return true;
+}
+
+bool ast_serializer::visit_if_expr(if_expr* node) {
+    put_header(node);
+    put_node(node->get_condition());
+    put_node(node->get_code_block());
+    return true;
+}
+
+bool ast_serializer::visit_continue_expr(continue_expr* node) {
+    put_header(node);
+    return true;
+}
+
+bool ast_serializer::visit_break_expr(break_expr* node) {
+    put_header(node);
+    return true;
+}
+
+bool ast_serializer::visit_return_expr(return_expr* node) {
+    put_header(node);
+    put_node(node->get_value());
+    return true;
+}
+
+std::string ast_serializer::serialize(code_block* root) {
+    strings.clear();
+    string_index.clear();
+    body.clear();
+    put_node(root);
+
+    // string table must be placed before nodes,
+    // so nodes are generated first and then copied after the table
+    auto nodes = std::move(body);
+    body = ast_magic;
+    put_u32(ast_version);
+    put_u32(strings.size());
+    for(const auto& i : strings) {
+        put_u32(i.length());
+        body += i;
+    }
+    body += nodes;
+    return std::move(body);
+}
+
+bool ast_serializer::serialize(code_block* root, const std::string& path) {
+    std::ofstream out(path, std::ios::binary);
+    if (out.fail()) {
+        return false;
+    }
+    const auto data = serialize(root);
+    out.write(data.data(), data.size());
+    return !out.fail();
+}
+
+u8 ast_deserializer::get_u8() {
+    if (ptr>=end) {
+        failed = true;
+        return 0;
+    }
+    return *ptr++;
+}
+
+template<typename T>
+T ast_deserializer::get_enum(T last) {
+    const auto value = get_u8();
+    if (value>static_cast<u8>(last)) {
+        failed = true;
+        return last;
+    }
+    return static_cast<T>(value);
+}
+
+u32 ast_deserializer::get_u32() {
+    if (4>static_cast<usize>(end-ptr)) {
+        failed = true;
+        return 0;
+    }
+    u32 res = 0;
+    for(u32 i = 0; i<4; ++i) {
+        res |= ((u32)*ptr++)<<(i*8);
+    }
+    return res;
+}
+
+f64 ast_deserializer::get_f64() {
+    if (8>static_cast<usize>(end-ptr)) {
+        failed = true;
+        return 0;
+    }
+    u64 bits = 0;
+    for(u32 i = 0; i<8; ++i) {
+        bits |= ((u64)*ptr++)<<(i*8);
+    }
+    f64 res = 0;
+    std::memcpy(&res, &bits, sizeof(res));
+    return res;
+}
+
+const std::string& ast_deserializer::get_string() {
+    static const std::string empty = "";
+    const auto index = get_u32();
+    if (index>=strings.size()) {
+        failed = true;
+        return empty;
+    }
+    return strings[index];
+}
+
+span ast_deserializer::get_span() {
+    span loc;
+    loc.file = get_string();
+    loc.begin_line = get_u32();
+    loc.begin_column = get_u32();
+    loc.end_line = get_u32();
+    loc.end_column = get_u32();
+    return loc;
+}
+
+template<typename T>
+T* ast_deserializer::get_node_as(expr_type type) {
+    auto node = get_node();
+    if (node && node->get_type()!=type) {
+        failed = true;
+        delete node;
+        return nullptr;
+    }
+    return (T*)node;
+}
+
+// child that parser never leaves empty, null marker is rejected
+expr* ast_deserializer::get_child() {
+    auto node = get_node();
+    if (!node) {
+        failed = true;
+    }
+    return node;
+}
+
+template<typename T>
+T* ast_deserializer::get_child_as(expr_type type) {
+    auto node = get_node_as<T>(type);
+    if (!node) {
+        failed = true;
+    }
+    return node;
+}
+
+expr* ast_deserializer::get_node() {
+    if (failed) {
+        return nullptr;
+    }
+    if (depth>=ast_max_depth) {
+        failed = true;
+        return nullptr;
+    }
+    ++depth;
+    auto node = read_node();
+    --depth;
+    return node;
+}
+
+expr* ast_deserializer::read_node() {
+    const auto type = get_u8();
+    if (failed || type==ast_null_pointer) {
+        return nullptr;
+    }
+    const auto loc = get_span();
+    if (failed) {
+        return nullptr;
+    }
+    switch((expr_type)type) {
+        case expr_type::ast_null: return new null_expr(loc);
+        case expr_type::ast_nil: return new nil_expr(loc);
+        case expr_type::ast_num: return new number_literal(loc, get_f64());
+        case expr_type::ast_str: return new string_literal(loc, get_string());
+        case expr_type::ast_id: return new identifier(loc, get_string());
+        case expr_type::ast_bool: return new bool_literal(loc, get_u8());
+        case expr_type::ast_vec: {
+            auto node = new vector_expr(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_element(get_child());
+            }
+            return node;
+        }
+        case expr_type::ast_hash: {
+            auto node = new hash_expr(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_member(
+                    get_child_as<hash_pair>(expr_type::ast_pair)
+                );
+            }
+            return node;
+        }
+        case expr_type::ast_pair: {
+            auto node = new hash_pair(loc);
+            node->set_name(get_string());
+            node->set_value(get_child());
+            return node;
+        }
+        case expr_type::ast_func: {
+            auto node = new function(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_parameter(
+                    get_child_as<parameter>(expr_type::ast_param)
+                );
+            }
+            node->set_code_block(
+                get_child_as<code_block>(expr_type::ast_block)
+            );
+            return node;
+        }
+        case expr_type::ast_block: {
+            auto node = new code_block(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_expression(get_child());
+            }
+            return node;
+        }
+        case expr_type::ast_param: {
+            auto node = new parameter(loc);
+            node->set_parameter_type(
+                get_enum(parameter::param_type::dynamic_parameter)
+            );
+            node->set_parameter_name(get_string());
+            node->set_default_value(get_node());
+            return node;
+        }
+        case expr_type::ast_ternary: {
+            auto node = new ternary_operator(loc);
+            node->set_condition(get_child());
+            node->set_left(get_child());
+            node->set_right(get_child());
+            return node;
+        }
+        case expr_type::ast_binary: {
+            auto node = new binary_operator(loc);
+            node->set_operator_type(
+                get_enum(binary_operator::binary_type::condition_or)
+            );
+            node->set_left(get_child());
+            node->set_right(get_child());
+            node->set_optimized_number(
+                get_node_as<number_literal>(expr_type::ast_num)
+            );
+            node->set_optimized_string(
+                get_node_as<string_literal>(expr_type::ast_str)
+            );
+            return node;
+        }
+        case expr_type::ast_unary: {
+            auto node = new unary_operator(loc);
+            node->set_operator_type(
+                get_enum(unary_operator::unary_type::bitwise_not)
+            );
+            node->set_value(get_child());
+            node->set_optimized_number(
+                get_node_as<number_literal>(expr_type::ast_num)
+            );
+            return node;
+        }
+        case expr_type::ast_call: {
+            auto node = new call_expr(loc);
+            node->set_first(get_child());
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                auto tmp = get_child();
+                if (!tmp) {
+                    break;
+                }
+                switch(tmp->get_type()) {
+                    case expr_type::ast_callh:
+                    case expr_type::ast_callv:
+                    case expr_type::ast_callf:
+                        node->add_call((call*)tmp); break;
+                    case expr_type::ast_null:
+                        // parser generates this when failed to parse a call
+                        node->add_call(
+                            new call(tmp->get_location(), expr_type::ast_null)
+                        );
+                        delete tmp;
+                        break;
+                    default: failed = true; delete tmp; break;
+                }
+            }
+            return node;
+        }
+        case expr_type::ast_callh: return new call_hash(loc, get_string());
+        case expr_type::ast_callv: {
+            auto node = new call_vector(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_slice(
+                    get_child_as<slice_vector>(expr_type::ast_subvec)
+                );
+            }
+            return node;
+        }
+        case expr_type::ast_callf: {
+            auto node = new call_function(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_argument(get_child());
+            }
+            return node;
+        }
+        case expr_type::ast_subvec: {
+            auto node = new slice_vector(loc);
+            node->set_begin(get_child());
+            node->set_end(get_node());
+            return node;
+        }
+        case expr_type::ast_def: {
+            auto node = new definition_expr(loc);
+            node->set_identifier(get_node_as<identifier>(expr_type::ast_id));
+            node->set_multi_define(
+                get_node_as<multi_identifier>(expr_type::ast_multi_id)
+            );
+            node->set_tuple(get_node_as<tuple_expr>(expr_type::ast_tuple));
+            node->set_value(get_node());
+            // one of identifier and multi define, one of tuple and value
+            if (!node->get_variable_name()==!node->get_variables() ||
+                !node->get_tuple()==!node->get_value()) {
+                failed = true;
+            }
+            return node;
+        }
+        case expr_type::ast_assign: {
+            auto node = new assignment_expr(loc);
+            node->set_assignment_type(
+                get_enum(assignment_expr::assign_type::bitwise_xor_equal)
+            );
+            node->set_left(get_child());
+            node->set_right(get_child());
+            return node;
+        }
+        case expr_type::ast_multi_id: {
+            auto node = new multi_identifier(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_var(get_child_as<identifier>(expr_type::ast_id));
+            }
+            return node;
+        }
+        case expr_type::ast_tuple: {
+            auto node = new tuple_expr(loc);
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_element(get_child());
+            }
+            return node;
+        }
+        case expr_type::ast_multi_assign: {
+            auto node = new multi_assign(loc);
+            node->set_tuple(get_child_as<tuple_expr>(expr_type::ast_tuple));
+            node->set_value(get_child());
+            return node;
+        }
+        case expr_type::ast_while: {
+            auto node = new while_expr(loc);
+            node->set_condition(get_child());
+            node->set_code_block(
+                get_child_as<code_block>(expr_type::ast_block)
+            );
+            return node;
+        }
+        case expr_type::ast_for: {
+            auto node = new for_expr(loc);
+            node->set_initial(get_child());
+            node->set_condition(get_child());
+            node->set_step(get_child());
+            node->set_code_block(
+                get_child_as<code_block>(expr_type::ast_block)
+            );
+            return node;
+        }
+        case expr_type::ast_iter: {
+            auto node = new iter_expr(loc);
+            node->set_is_definition(get_u8());
+            node->set_name(get_node_as<identifier>(expr_type::ast_id));
+            node->set_call(get_node_as<call_expr>(expr_type::ast_call));
+            // iterator is either a symbol or a call
+            if (!node->get_name()==!node->get_call()) {
+                failed = true;
+            }
+            return node;
+        }
+        case expr_type::ast_forei: {
+            auto node = new forei_expr(loc);
+            node->set_loop_type(
+                get_enum(forei_expr::forei_loop_type::forindex)
+            );
+            node->set_iterator(get_child_as<iter_expr>(expr_type::ast_iter));
+            node->set_value(get_child());
+            node->set_code_block(
+                get_child_as<code_block>(expr_type::ast_block)
+            );
+            return node;
+        }
+        case expr_type::ast_cond: {
+            auto node = new condition_expr(loc);
+            node->set_if_statement(get_child_as<if_expr>(expr_type::ast_if));
+            for(u32 i = 0, size = get_u32(); i<size && !failed; ++i) {
+                node->add_elsif_statement(
+                    get_child_as<if_expr>(expr_type::ast_if)
+                );
+            }
+            node->set_else_statement(get_node_as<if_expr>(expr_type::ast_if));
+            return node;
+        }
+        case expr_type::ast_if: {
+            auto node = new if_expr(loc);
+            // else statement has no condition
+            node->set_condition(get_node());
+            node->set_code_block(
+                get_child_as<code_block>(expr_type::ast_block)
+            );
+            return node;
+        }
+        case expr_type::ast_continue: return new continue_expr(loc);
+        case expr_type::ast_break: return new break_expr(loc);
+        case expr_type::ast_ret: {
+            auto node = new return_expr(loc);
+            node->set_value(get_child());
+            return node;
+        }
+        default: break;
+    }
+    failed = true;
+    return nullptr;
+}
+
+code_block* ast_deserializer::deserialize(const char* data, usize size) {
+    ptr = (const u8*)data;
+    end = ptr+size;
+    failed = false;
+    depth = 0;
+    strings.clear();
+
+    if (size<4 || std::memcmp(data, ast_magic, 4)) {
+        return nullptr;
+    }
+    ptr += 4;
+    if (get_u32()!=ast_version) {
+        return nullptr;
+    }
+    for(u32 i = 0, count = get_u32(); i<count && !failed; ++i) {
+        const auto length = get_u32();
+        if (failed || length>static_cast<usize>(end-ptr)) {
+            return nullptr;
+        }
+        strings.push_back(std::string((const char*)ptr, length));
+        ptr += length;
+    }
+
+    auto root = get_node_as<code_block>(expr_type::ast_block);
+    if (failed || ptr!=end) {
+        delete root;
+        return nullptr;
+    }
+    return root;
+}
+
+code_block* ast_deserializer::load(const std::string& path) {
+#ifndef _WIN32
+    // map the file instead of copying it into a buffer,
+    // nodes are rebuilt directly from the mapped memory
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd<0) {
+        return nullptr;
+    }
+    struct stat buffer;
+    if (fstat(fd, &buffer)<0 || !S_ISREG(buffer.st_mode) || !buffer.st_size) {
+        close(fd);
+        return nullptr;
+    }
+    const auto size = (usize)buffer.st_size;
+    auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data==MAP_FAILED) {
+        return nullptr;
+    }
+    auto root = deserialize((const char*)data, size);
+    munmap(data, size);
+    return root;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (in.fail()) {
+        return nullptr;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return deserialize(ss.str());
+#endif
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "nasal.h"
+#include "nasal_ast.h"
+#include "ast_visitor.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nasal {
+
+// binary ast format, all integers are little-endian:
+//   header  "NAST" u32:version
+//   strings u32:count {u32:length bytes}
+//   nodes   preorder, each node is
+//           u8:expr_type u32:file u32:begin_line u32:begin_column
+//           u32:end_line u32:end_column payload
+//           null child pointer is stored as a single u8 0xff
+// file names, identifiers and string literals are stored in string table
+class ast_serializer:public ast_visitor {
+private:
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, u32> string_index;
+    std::string body;
+
+    void put_u8(u8);
+    void put_u32(u32);
+    void put_f64(f64);
+    void put_string(const std::string&);
+    void put_node(expr*);
+    void put_header(expr*);
+
+public:
+    bool visit_null_expr(null_expr*) override;
+    bool visit_nil_expr(nil_expr*) override;
+    bool visit_number_literal(number_literal*) override;
+    bool visit_string_literal(string_literal*) override;
+    bool visit_identifier(identifier*) override;
+    bool visit_bool_literal(bool_literal*) override;
+    bool visit_vector_expr(vector_expr*) override;
+    bool visit_hash_expr(hash_expr*) override;
+    bool visit_hash_pair(hash_pair*) override;
+    bool visit_function(function*) override;
+    bool visit_code_block(code_block*) override;
+    bool visit_parameter(parameter*) override;
+    bool visit_ternary_operator(ternary_operator*) override;
+    bool visit_binary_operator(binary_operator*) override;
+    bool visit_unary_operator(unary_operator*) override;
+    bool visit_call_expr(call_expr*) override;
+    bool visit_call_hash(call_hash*) override;
+    bool visit_call_vector(call_vector*) override;
+    bool visit_call_function(call_function*) override;
+    bool visit_slice_vector(slice_vector*) override;
+    bool visit_definition_expr(definition_expr*) override;
+    bool visit_assignment_expr(assignment_expr*) override;
+    bool visit_multi_identifier(multi_identifier*) override;
+    bool visit_tuple_expr(tuple_expr*) override;
+    bool visit_multi_assign(multi_assign*) override;
+    bool visit_while_expr(while_expr*) override;
+    bool visit_for_expr(for_expr*) override;
+    bool visit_iter_expr(iter_expr*) override;
+    bool visit_forei_expr(forei_expr*) override;
+    bool visit_condition_expr(condition_expr*) override;
+    bool visit_if_expr(if_expr*) override;
+    bool visit_continue_expr(continue_expr*) override;
+    bool visit_break_expr(break_expr*) override;
+    bool visit_return_expr(return_expr*) override;
+
+public:
+    std::string serialize(code_block*);
+    bool serialize(code_block*, const std::string&);
+};
+
+// rebuild ast from the binary format above.
+// any malformed or truncated input makes deserialize return nullptr,
+// so caller could treat it as a cache miss and parse source file again
+class ast_deserializer {
+private:
+    const u8* ptr;
+    const u8* end;
+    bool failed;
+    // nesting of nodes being read, limited so that crafted input
+    // could not overflow the stack by recursion
+    u32 depth;
+    std::vector<std::string> strings;
+
+    u8 get_u8();
+    // enum stored as u8, values after the last one are rejected
+    template<typename T>
+    T get_enum(T);
+    u32 get_u32();
+    f64 get_f64();
+    const std::string& get_string();
+    span get_span();
+    expr* get_node();
+    expr* read_node();
+    template<typename T>
+    T* get_node_as(expr_type);
+    expr* get_child();
+    template<typename T>
+    T* get_child_as(expr_type);
+
+public:
+    ast_deserializer():
+        ptr(nullptr), end(nullptr), failed(false), depth(0) {}
+    code_block* deserialize(const char*, usize);
+    code_block* deserialize(const std::string& data) {
+        return deserialize(data.data(), data.size());
+    }
+    code_block* load(const std::string&);
+};
+
+}
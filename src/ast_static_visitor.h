@@ -0,0 +1,306 @@
+#pragma once
+
+#include "nasal_ast.h"
+
+namespace nasal {
+
+// dispatch switch is inlined into every visit_* method, so each call site
+// gets its own indirect jump, which is easier to predict than a shared one
+#if defined(_MSC_VER)
+#define STATIC_VISIT_INLINE __forceinline
+#else
+#define STATIC_VISIT_INLINE __attribute__((always_inline)) inline
+#endif
+
+// static visitor, dispatches nodes by switch on expr_type instead of two
+// virtual calls (expr::accept and ast_visitor::visit_*) for each node.
+// a pass opts into it by inheriting ast_static_visitor<pass> and hiding the
+// visit_* methods it cares about, others use the default traversal below.
+// use visit(node) instead of node->accept(this):
+//
+//   class my_pass : public ast_static_visitor<my_pass> {
+//   public:
+//     bool visit_identifier(identifier *);
+//   };
+template <typename T> class ast_static_visitor {
+private:
+  T *derived() { return static_cast<T *>(this); }
+
+public:
+  STATIC_VISIT_INLINE bool visit(expr *node) {
+    switch (node->get_type()) {
+    case expr_type::ast_null:
+      // call node generated by parse error also uses ast_null
+      return derived()->visit_null_expr((null_expr *)node);
+    case expr_type::ast_block:
+      return derived()->visit_code_block((code_block *)node);
+    case expr_type::ast_nil:
+      return derived()->visit_nil_expr((nil_expr *)node);
+    case expr_type::ast_num:
+      return derived()->visit_number_literal((number_literal *)node);
+    case expr_type::ast_str:
+      return derived()->visit_string_literal((string_literal *)node);
+    case expr_type::ast_id:
+      return derived()->visit_identifier((identifier *)node);
+    case expr_type::ast_bool:
+      return derived()->visit_bool_literal((bool_literal *)node);
+    case expr_type::ast_func:
+      return derived()->visit_function((function *)node);
+    case expr_type::ast_hash:
+      return derived()->visit_hash_expr((hash_expr *)node);
+    case expr_type::ast_vec:
+      return derived()->visit_vector_expr((vector_expr *)node);
+    case expr_type::ast_pair:
+      return derived()->visit_hash_pair((hash_pair *)node);
+    case expr_type::ast_call:
+      return derived()->visit_call_expr((call_expr *)node);
+    case expr_type::ast_callh:
+      return derived()->visit_call_hash((call_hash *)node);
+    case expr_type::ast_callv:
+      return derived()->visit_call_vector((call_vector *)node);
+    case expr_type::ast_callf:
+      return derived()->visit_call_function((call_function *)node);
+    case expr_type::ast_subvec:
+      return derived()->visit_slice_vector((slice_vector *)node);
+    case expr_type::ast_param:
+      return derived()->visit_parameter((parameter *)node);
+    case expr_type::ast_ternary:
+      return derived()->visit_ternary_operator((ternary_operator *)node);
+    case expr_type::ast_binary:
+      return derived()->visit_binary_operator((binary_operator *)node);
+    case expr_type::ast_unary:
+      return derived()->visit_unary_operator((unary_operator *)node);
+    case expr_type::ast_for:
+      return derived()->visit_for_expr((for_expr *)node);
+    case expr_type::ast_forei:
+      return derived()->visit_forei_expr((forei_expr *)node);
+    case expr_type::ast_while:
+      return derived()->visit_while_expr((while_expr *)node);
+    case expr_type::ast_iter:
+      return derived()->visit_iter_expr((iter_expr *)node);
+    case expr_type::ast_cond:
+      return derived()->visit_condition_expr((condition_expr *)node);
+    case expr_type::ast_if:
+      return derived()->visit_if_expr((if_expr *)node);
+    case expr_type::ast_multi_id:
+      return derived()->visit_multi_identifier((multi_identifier *)node);
+    case expr_type::ast_tuple:
+      return derived()->visit_tuple_expr((tuple_expr *)node);
+    case expr_type::ast_def:
+      return derived()->visit_definition_expr((definition_expr *)node);
+    case expr_type::ast_assign:
+      return derived()->visit_assignment_expr((assignment_expr *)node);
+    case expr_type::ast_multi_assign:
+      return derived()->visit_multi_assign((multi_assign *)node);
+    case expr_type::ast_continue:
+      return derived()->visit_continue_expr((continue_expr *)node);
+    case expr_type::ast_break:
+      return derived()->visit_break_expr((break_expr *)node);
+    case expr_type::ast_ret:
+      return derived()->visit_return_expr((return_expr *)node);
+    }
+    return true;
+  }
+
+public:
+  bool visit_null_expr(null_expr *node) { return true; }
+  bool visit_nil_expr(nil_expr *node) { return true; }
+  bool visit_number_literal(number_literal *node) { return true; }
+  bool visit_string_literal(string_literal *node) { return true; }
+  bool visit_identifier(identifier *node) { return true; }
+  bool visit_bool_literal(bool_literal *node) { return true; }
+
+  bool visit_vector_expr(vector_expr *node) {
+    for (auto i : node->get_elements()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_hash_expr(hash_expr *node) {
+    for (auto i : node->get_members()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_hash_pair(hash_pair *node) {
+    if (node->get_value()) {
+      visit(node->get_value());
+    }
+    return true;
+  }
+
+  bool visit_function(function *node) {
+    for (auto i : node->get_parameter_list()) {
+      visit(i);
+    }
+    visit(node->get_code_block());
+    return true;
+  }
+
+  bool visit_code_block(code_block *node) {
+    for (auto i : node->get_expressions()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_parameter(parameter *node) {
+    if (node->get_default_value()) {
+      visit(node->get_default_value());
+    }
+    return true;
+  }
+
+  bool visit_ternary_operator(ternary_operator *node) {
+    visit(node->get_condition());
+    visit(node->get_left());
+    visit(node->get_right());
+    return true;
+  }
+
+  bool visit_binary_operator(binary_operator *node) {
+    visit(node->get_left());
+    visit(node->get_right());
+    return true;
+  }
+
+  bool visit_unary_operator(unary_operator *node) {
+    visit(node->get_value());
+    return true;
+  }
+
+  bool visit_call_expr(call_expr *node) {
+    visit(node->get_first());
+    for (auto i : node->get_calls()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_call_hash(call_hash *node) { return true; }
+
+  bool visit_call_vector(call_vector *node) {
+    for (auto i : node->get_slices()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_call_function(call_function *node) {
+    for (auto i : node->get_argument()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_slice_vector(slice_vector *node) {
+    visit(node->get_begin());
+    if (node->get_end()) {
+      visit(node->get_end());
+    }
+    return true;
+  }
+
+  bool visit_definition_expr(definition_expr *node) {
+    if (node->get_variable_name()) {
+      visit(node->get_variable_name());
+    } else {
+      visit(node->get_variables());
+    }
+    if (node->get_tuple()) {
+      visit(node->get_tuple());
+    } else {
+      visit(node->get_value());
+    }
+    return true;
+  }
+
+  bool visit_assignment_expr(assignment_expr *node) {
+    visit(node->get_left());
+    visit(node->get_right());
+    return true;
+  }
+
+  bool visit_multi_identifier(multi_identifier *node) {
+    for (auto i : node->get_variables()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_tuple_expr(tuple_expr *node) {
+    for (auto i : node->get_elements()) {
+      visit(i);
+    }
+    return true;
+  }
+
+  bool visit_multi_assign(multi_assign *node) {
+    visit(node->get_tuple());
+    visit(node->get_value());
+    return true;
+  }
+
+  bool visit_while_expr(while_expr *node) {
+    visit(node->get_condition());
+    visit(node->get_code_block());
+    return true;
+  }
+
+  bool visit_for_expr(for_expr *node) {
+    visit(node->get_initial());
+    visit(node->get_condition());
+    visit(node->get_step());
+    visit(node->get_code_block());
+    return true;
+  }
+
+  bool visit_iter_expr(iter_expr *node) {
+    if (node->get_name()) {
+      visit(node->get_name());
+    } else {
+      visit(node->get_call());
+    }
+    return true;
+  }
+
+  bool visit_forei_expr(forei_expr *node) {
+    visit(node->get_iterator());
+    visit(node->get_value());
+    visit(node->get_code_block());
+    return true;
+  }
+
+  bool visit_condition_expr(condition_expr *node) {
+    visit(node->get_if_statement());
+    for (auto i : node->get_elsif_stataments()) {
+      visit(i);
+    }
+    if (node->get_else_statement()) {
+      visit(node->get_else_statement());
+    }
+    return true;
+  }
+
+  bool visit_if_expr(if_expr *node) {
+    if (node->get_condition()) {
+      visit(node->get_condition());
+    }
+    visit(node->get_code_block());
+    return true;
+  }
+
+  bool visit_continue_expr(continue_expr *node) { return true; }
+  bool visit_break_expr(break_expr *node) { return true; }
+
+  bool visit_return_expr(return_expr *node) {
+    if (node->get_value()) {
+      visit(node->get_value());
+    }
+    return true;
+  }
+};
+
+} // namespace nasal
@@ -15,7 +15,7 @@ void dynamic_library_destructor(void* pointer) {
 
 var builtin_dlopen(context* ctx, gc* ngc) {
     auto dlname = ctx->localr[1];
-    if (dlname.type!=vm_str) {
+    if (dlname.type()!=vm_str) {
         return nas_err("dylib::dlopen", "\"libname\" must be string");
     }
 
@@ -49,7 +49,7 @@ var builtin_dlopen(context* ctx, gc* ngc) {
         dynamic_library_destructor,
         dynamic_library_pointer
     );
-    return_hash.hash().elems["lib"] = library_object;
+    return_hash.hash().at("lib") = library_object;
 
     // get "get" function, to get the register table
 #ifdef _WIN32
@@ -78,7 +78,7 @@ var builtin_dlopen(context* ctx, gc* ngc) {
             nullptr,
             function_pointer
         );
-        return_hash.hash().elems[table[i].name] = function_object;
+        return_hash.hash().at(table[i].name) = function_object;
     }
 
     ngc->temp = nil;
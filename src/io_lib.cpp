@@ -13,7 +13,7 @@ void filehandle_destructor(void* ptr) {
 
 var builtin_readfile(context* ctx, gc* ngc) {
     auto filename = ctx->localr[1];
-    if (filename.type!=vm_str) {
+    if (filename.type()!=vm_str) {
         return nas_err("io::readfile", "\"filename\" must be string");
     }
     std::ifstream in(filename.str(), std::ios::binary);
@@ -28,7 +28,7 @@ var builtin_fout(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     auto filename = local[1];
     auto source = local[2];
-    if (filename.type!=vm_str) {
+    if (filename.type()!=vm_str) {
         return nas_err("io::fout", "\"filename\" must be string");
     }
     std::ofstream out(filename.str());
@@ -41,7 +41,7 @@ var builtin_fout(context* ctx, gc* ngc) {
 
 var builtin_exists(context* ctx, gc* ngc) {
     auto filename = ctx->localr[1];
-    if (filename.type!=vm_str) {
+    if (filename.type()!=vm_str) {
         return zero;
     }
     return access(filename.str().c_str(), F_OK)!=-1? one:zero;
@@ -51,10 +51,10 @@ var builtin_open(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     auto name = local[1];
     auto mode = local[2];
-    if (name.type!=vm_str) {
+    if (name.type()!=vm_str) {
         return nas_err("io::open", "\"filename\" must be string");
     }
-    if (mode.type!=vm_str) {
+    if (mode.type()!=vm_str) {
         return nas_err("io::open", "\"mode\" must be string");
     }
     auto file_descriptor = fopen(name.str().c_str(), mode.str().c_str());
@@ -85,10 +85,10 @@ var builtin_read(context* ctx, gc* ngc) {
     if (!file_descriptor.object_check(file_type_name)) {
         return nas_err("io::read", "not a valid filehandle");
     }
-    if (buffer.type!=vm_str || buffer.val.gcobj->unmutable) {
+    if (buffer.type()!=vm_str || buffer.gcobj()->unmutable) {
         return nas_err("io::read", "\"buf\" must be mutable string");
     }
-    if (length.type!=vm_num) {
+    if (length.type()!=vm_num) {
         return nas_err("io::read", "\"len\" must be number");
     }
     if (length.num()<=0 || length.num()>=(1<<30)) {
@@ -103,7 +103,7 @@ var builtin_read(context* ctx, gc* ngc) {
         static_cast<FILE*>(file_descriptor.ghost().pointer)
     );
     buffer.str() = temp_buffer;
-    buffer.val.gcobj->unmutable = true;
+    buffer.gcobj()->unmutable = true;
     delete []temp_buffer;
     return var::num(read_size);
 }
@@ -115,7 +115,7 @@ var builtin_write(context* ctx, gc* ngc) {
     if (!file_descriptor.object_check(file_type_name)) {
         return nas_err("io::write", "not a valid filehandle");
     }
-    if (source.type!=vm_str) {
+    if (source.type()!=vm_str) {
         return nas_err("io::write", "\"str\" must be string");
     }
     return var::num(static_cast<f64>(fwrite(
@@ -173,7 +173,7 @@ var builtin_readln(context* ctx, gc* ngc) {
 
 var builtin_stat(context* ctx, gc* ngc) {
     auto name = ctx->localr[1];
-    if (name.type!=vm_str) {
+    if (name.type()!=vm_str) {
         return nas_err("io::stat", "\"filename\" must be string");
     }
     struct stat buffer;
@@ -6,17 +6,21 @@
 #include "nasal_dbg.h"
 #include "nasal_err.h"
 #include "nasal_gc.h"
+#include "nasal_image.h"
 #include "nasal_import.h"
 #include "nasal_lexer.h"
 #include "nasal_parse.h"
 #include "nasal_type.h"
 #include "nasal_vm.h"
 #include "optimizer.h"
+#include "peephole.h"
 #include "repl.h"
 #include "symbol_finder.h"
 
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <thread>
 #include <unordered_map>
 
@@ -32,13 +36,104 @@ void parse(const std::string &file, const std::string &filesname) {
   lex.sscan(file, filesname).chkerr();
 
   // parser gets lexer's token list to compile
-  // will send info to stdout
+  // will send info to stdout, the tree is not used so drop it
+  // after each top-level statement
+  parse.set_stream(true);
   parse.compile(lex).chkerr();
 }
 
+// options of `nasal -e`, given before the file name
+struct execute_option {
+  bool opt_stat = false;     // --opt-stat: print peephole hits to stderr
+  bool no_jit = false;       // --no-jit: interpret only, in NASAL_JIT build
+  bool no_tail_call = false; // --no-tail-call: keep frames in call trace
+  bool no_cache = false;     // --no-cache or NASAL_NO_CACHE: skip the image
+};
+
+void execute(const std::string &file, const std::vector<std::string> &argv,
+             const execute_option &option) {
+  auto runtime = std::unique_ptr<nasal::vm>(new nasal::vm);
+  runtime->set_jit_flag(!option.no_jit);
+
+  // image is used only if it is built from the same, unchanged sources,
+  // --opt-stat compiles again because peephole does not run on images.
+  // bytecode without tail calls is neither loaded from nor saved to cache
+  const bool use_cache = !option.no_cache && !option.no_tail_call;
+  nasal::bytecode_image image;
+  if (use_cache && !option.opt_stat && image.load_cache(file)) {
+    runtime->run(image, argv);
+    return;
+  }
+
+  nasal::lexer lex;
+  nasal::parse parse;
+  nasal::linker ld;
+  nasal::codegen gen;
+
+  // lsp events are not needed when executing
+  std::stringstream events;
+  parse.set_output(events);
+  ld.set_output(events);
+
+  lex.scan(file).chkerr();
+  parse.compile(lex).chkerr();
+  ld.link(parse, file, false).chkerr();
+  nasal::optimizer optimizer;
+  optimizer.set_tail_call(!option.no_tail_call);
+  optimizer.do_optimization(parse.tree());
+  gen.compile(parse, ld, false).chkerr();
+  nasal::peephole opt;
+  opt.do_optimization(gen);
+  if (option.opt_stat) {
+    std::clog << "peephole:\n";
+    opt.print_statistics(std::clog);
+  }
+
+  // failing to write the image only makes the next run compile again
+  if (use_cache && image.build(gen, ld)) {
+    image.save_cache(file);
+  }
+  runtime->run(gen, ld, argv);
+}
+
 i32 main(i32 argc, const char *argv[]) {
     std::string line = "";
     std::string filesname = "";
+    // nasal -e [options] <file> [args...] executes the file
+    // instead of parsing stdin
+    if (argc >= 2 && std::string(argv[1]) == "-e") {
+        execute_option option;
+        const char* no_cache = getenv("NASAL_NO_CACHE");
+        option.no_cache = no_cache && *no_cache;
+        i32 i = 2;
+        for(; i<argc && argv[i][0]=='-' && argv[i][1]=='-'; ++i) {
+            const std::string opt = argv[i];
+            if (opt == "--opt-stat") {
+                option.opt_stat = true;
+            } else if (opt == "--no-jit") {
+                option.no_jit = true;
+            } else if (opt == "--no-tail-call") {
+                option.no_tail_call = true;
+            } else if (opt == "--no-cache") {
+                option.no_cache = true;
+            } else {
+                std::cerr << "nasal: unknown option " << opt << "\n";
+                return 1;
+            }
+        }
+        if (i>=argc) {
+            std::cerr << "nasal: -e needs a file to execute\n";
+            return 1;
+        }
+        execute(argv[i], std::vector<std::string>(argv + i + 1, argv + argc), option);
+        return 0;
+    }
+    // nasal -r starts the repl, library and modules are parsed once
+    // and kept in module_cache during the session
+    if (argc >= 2 && std::string(argv[1]) == "-r") {
+        nasal::repl::repl().execute();
+        return 0;
+    }
     if (argc >= 2) {
         if (*argv[1] == 'n'){
             std::getline(std::cin, filesname);
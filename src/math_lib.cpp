@@ -5,7 +5,7 @@ namespace nasal {
 var builtin_pow(context* ctx, gc* ngc) {
     auto x = ctx->localr[1];
     auto y = ctx->localr[2];
-    if (x.type!=vm_num || y.type!=vm_num) {
+    if (x.type()!=vm_num || y.type()!=vm_num) {
         return var::num(std::nan(""));
     }
     return var::num(std::pow(x.num(), y.num()));
@@ -13,43 +13,43 @@ var builtin_pow(context* ctx, gc* ngc) {
 
 var builtin_sin(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? sin(val.num()):std::nan(""));
+    return var::num(val.type()==vm_num? sin(val.num()):std::nan(""));
 }
 
 var builtin_cos(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? cos(val.num()):std::nan(""));
+    return var::num(val.type()==vm_num? cos(val.num()):std::nan(""));
 }
 
 var builtin_tan(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? tan(val.num()):std::nan(""));
+    return var::num(val.type()==vm_num? tan(val.num()):std::nan(""));
 }
 
 var builtin_exp(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? exp(val.num()):std::nan(""));
+    return var::num(val.type()==vm_num? exp(val.num()):std::nan(""));
 }
 
 var builtin_lg(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? log(val.num())/log(10.0):std::nan(""));
+    return var::num(val.type()==vm_num? log(val.num())/log(10.0):std::nan(""));
 }
 
 var builtin_ln(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? log(val.num()):std::nan(""));
+    return var::num(val.type()==vm_num? log(val.num()):std::nan(""));
 }
 
 var builtin_sqrt(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    return var::num(val.type==vm_num? sqrt(val.num()):std::nan(""));
+    return var::num(val.type()==vm_num? sqrt(val.num()):std::nan(""));
 }
 
 var builtin_atan2(context* ctx, gc* ngc) {
     auto x = ctx->localr[1];
     auto y = ctx->localr[2];
-    if (x.type!=vm_num || y.type!=vm_num) {
+    if (x.type()!=vm_num || y.type()!=vm_num) {
         return var::num(std::nan(""));
     }
     return var::num(atan2(y.num(), x.num()));
@@ -57,7 +57,7 @@ var builtin_atan2(context* ctx, gc* ngc) {
 
 var builtin_isnan(context* ctx, gc* ngc) {
     auto x = ctx->localr[1];
-    return (x.type==vm_num && std::isnan(x.num()))? one:zero;
+    return (x.type()==vm_num && std::isnan(x.num()))? one:zero;
 }
 
 nasal_builtin_table math_lib_native[] = {
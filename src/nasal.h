@@ -36,8 +36,13 @@ bool is_powerpc();
 bool is_superh();
 
 
-// virtual machine stack depth, both global depth and value stack depth
+// virtual machine stack depth, both global depth and max local scope size
 const u32 STACK_DEPTH = 4096;
+// value stack starts with this size, doubles when top reaches canary,
+// and halves after returning from deep recursion
+const u32 STACK_INITIAL_SIZE = 256;
+// value stack could not grow larger than this size
+const u32 STACK_MAX_SIZE = 1<<20;
 
 f64 hex2f(const char*);
 f64 oct2f(const char*);
@@ -639,13 +639,17 @@ public:
 class return_expr : public expr {
 private:
   expr *value;
+  // set by optimizer if the value is a function call in tail position
+  bool tail_call;
 
 public:
   return_expr(const span &location)
-      : expr(location, expr_type::ast_ret), value(nullptr) {}
+      : expr(location, expr_type::ast_ret), value(nullptr), tail_call(false) {}
   ~return_expr() override;
   void set_value(expr *node) { value = node; }
+  void set_tail_call(bool flag) { tail_call = flag; }
   expr *get_value() { return value; }
+  bool is_tail_call() const { return tail_call; }
   void accept(ast_visitor *) override;
 };
 
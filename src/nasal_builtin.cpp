@@ -33,7 +33,7 @@ var builtin_append(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var vec = local[1];
     var elem = local[2];
-    if (vec.type!=vm_vec) {
+    if (vec.type()!=vm_vec) {
         return nas_err("append", "\"vec\" must be vector");
     }
     auto& v = vec.vec().elems;
@@ -47,10 +47,10 @@ var builtin_setsize(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var vec = local[1];
     var size = local[2];
-    if (vec.type!=vm_vec) {
+    if (vec.type()!=vm_vec) {
         return nas_err("setsize", "\"vec\" must be vector");
     }
-    if (size.type!=vm_num || size.num()<0) {
+    if (size.type()!=vm_num || size.num()<0) {
         return nil;
     }
     vec.vec().elems.resize(static_cast<i64>(size.num()), nil);
@@ -59,7 +59,7 @@ var builtin_setsize(context* ctx, gc* ngc) {
 
 var builtin_system(context* ctx, gc* ngc) {
     auto str = ctx->localr[1];
-    if (str.type!=vm_str) {
+    if (str.type()!=vm_str) {
         return var::num(-1);
     }
     return var::num(static_cast<f64>(system(str.str().c_str())));
@@ -69,7 +69,7 @@ var builtin_input(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var end = local[1];
     var ret = ngc->alloc(vm_str);
-    if (end.type!=vm_str || end.str().length()>1 || !end.str().length()) {
+    if (end.type()!=vm_str || end.str().length()>1 || !end.str().length()) {
         std::cin >> ret.str();
     } else {
         std::getline(std::cin, ret.str(), end.str()[0]);
@@ -81,10 +81,10 @@ var builtin_split(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var delimeter = local[1];
     var str = local[2];
-    if (delimeter.type!=vm_str) {
+    if (delimeter.type()!=vm_str) {
         return nas_err("split", "\"separator\" must be string");
     }
-    if (str.type!=vm_str) {
+    if (str.type()!=vm_str) {
         return nas_err("split", "\"str\" must be string");
     }
     const auto& deli = delimeter.str();
@@ -119,10 +119,10 @@ var builtin_split(context* ctx, gc* ngc) {
 
 var builtin_rand(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    if (val.type!=vm_num && val.type!=vm_nil) {
+    if (val.type()!=vm_num && val.type()!=vm_nil) {
         return nas_err("rand", "\"seed\" must be nil or number");
     }
-    if (val.type==vm_num) {
+    if (val.type()==vm_num) {
         srand(static_cast<u32>(val.num()));
         return nil;
     }
@@ -137,16 +137,16 @@ var builtin_id(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
     std::stringstream ss;
     ss << "0";
-    if (val.type>vm_num) {
+    if (val.type()>vm_num) {
         ss << "x" << std::hex;
-        ss << reinterpret_cast<u64>(val.val.gcobj) << std::dec;
+        ss << reinterpret_cast<u64>(val.gcobj()) << std::dec;
     }
     return ngc->newstr(ss.str());
 }
 
 var builtin_int(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    if (val.type!=vm_num && val.type!=vm_str) {
+    if (val.type()!=vm_num && val.type()!=vm_str) {
         return nil;
     }
     return var::num(static_cast<f64>(static_cast<i32>(val.to_num())));
@@ -164,10 +164,10 @@ var builtin_ceil(context* ctx, gc* ngc) {
 
 var builtin_num(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    if (val.type==vm_num) {
+    if (val.type()==vm_num) {
         return val;
     }
-    if (val.type!=vm_str) {
+    if (val.type()!=vm_str) {
         return nil;
     }
     auto res = val.to_num();
@@ -179,7 +179,7 @@ var builtin_num(context* ctx, gc* ngc) {
 
 var builtin_pop(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    if (val.type!=vm_vec) {
+    if (val.type()!=vm_vec) {
         return nas_err("pop", "\"vec\" must be vector");
     }
     auto& vec = val.vec().elems;
@@ -198,19 +198,19 @@ var builtin_str(context* ctx, gc* ngc) {
 var builtin_size(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
     f64 num = 0;
-    switch(val.type) {
+    switch(val.type()) {
         case vm_num:  num = val.num(); break;
         case vm_str:  num = val.str().length(); break;
         case vm_vec:  num = val.vec().size(); break;
         case vm_hash: num = val.hash().size(); break;
-        case vm_map:  num = val.map().mapper.size(); break;
+        case vm_map:  num = val.map().size(); break;
     }
     return var::num(num);
 }
 
 var builtin_time(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    if (val.type!=vm_num) {
+    if (val.type()!=vm_num) {
         return nas_err("time", "\"begin\" must be number");
     }
     auto begin = static_cast<time_t>(val.num());
@@ -221,43 +221,43 @@ var builtin_contains(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var hash = local[1];
     var key = local[2];
-    if (hash.type!=vm_hash || key.type!=vm_str) {
+    if (hash.type()!=vm_hash || key.type()!=vm_str) {
         return zero;
     }
-    return hash.hash().elems.count(key.str())? one:zero;
+    return hash.hash().contains(key.str())? one:zero;
 }
 
 var builtin_delete(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var hash = local[1];
     var key = local[2];
-    if (hash.type!=vm_hash) {
+    if (hash.type()!=vm_hash) {
         return nas_err("delete", "\"hash\" must be hash");
     }
-    if (key.type!=vm_str) {
+    if (key.type()!=vm_str) {
         return nil;
     }
-    if (hash.hash().elems.count(key.str())) {
-        hash.hash().elems.erase(key.str());
-    }
+    hash.hash().erase(key.str());
     return nil;
 }
 
 var builtin_keys(context* ctx, gc* ngc) {
     auto hash = ctx->localr[1];
-    if (hash.type!=vm_hash && hash.type!=vm_map) {
+    if (hash.type()!=vm_hash && hash.type()!=vm_map) {
         return nas_err("keys", "\"hash\" must be hash");
     }
     // avoid being sweeped
     auto res = ngc->temp = ngc->alloc(vm_vec);
     auto& vec = res.vec().elems;
-    if (hash.type==vm_hash) {
-        for(const auto& iter : hash.hash().elems) {
-            vec.push_back(ngc->newstr(iter.first));
+    if (hash.type()==vm_hash) {
+        const auto& ref = hash.hash();
+        for(usize i = 0; i<ref.size(); ++i) {
+            vec.push_back(ngc->newstr(ref.key(i)));
         }
     } else {
-        for(const auto& iter : hash.map().mapper) {
-            vec.push_back(ngc->newstr(iter.first));
+        const auto& ref = hash.map();
+        for(usize i = 0; i<ref.size(); ++i) {
+            vec.push_back(ngc->newstr(ref.key(i)));
         }
     }
     ngc->temp=nil;
@@ -280,7 +280,7 @@ var builtin_find(context* ctx, gc* ngc) {
 }
 
 var builtin_type(context* ctx, gc* ngc) {
-    switch(ctx->localr[1].type) {
+    switch(ctx->localr[1].type()) {
         case vm_none: return ngc->newstr("undefined");
         case vm_nil: return ngc->newstr("nil");
         case vm_num: return ngc->newstr("num");
@@ -300,13 +300,13 @@ var builtin_substr(context* ctx, gc* ngc) {
     var str = local[1];
     var beg = local[2];
     var len = local[3];
-    if (str.type!=vm_str) {
+    if (str.type()!=vm_str) {
         return nas_err("substr", "\"str\" must be string");
     }
-    if (beg.type!=vm_num || beg.num()<0) {
+    if (beg.type()!=vm_num || beg.num()<0) {
         return nas_err("substr", "\"begin\" should be number >= 0");
     }
-    if (len.type!=vm_num || len.num()<0) {
+    if (len.type()!=vm_num || len.num()<0) {
         return nas_err("substr", "\"length\" should be number >= 0");
     }
     usize begin = (usize)beg.num();
@@ -317,12 +317,19 @@ var builtin_substr(context* ctx, gc* ngc) {
     return ngc->newstr(str.str().substr(begin,length));
 }
 
+var builtin_mut(context* ctx, gc* ngc) {
+    // strings made by newstr may be shared, so copy it to a new one
+    var res = ngc->alloc(vm_str);
+    res.str() = ctx->localr[1].to_str();
+    return res;
+}
+
 var builtin_streq(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var a = local[1];
     var b = local[2];
     return var::num(static_cast<f64>(
-        (a.type!=vm_str || b.type!=vm_str)? 0:(a.str()==b.str())
+        (a.type()!=vm_str || b.type()!=vm_str)? 0:string_equal(a, b)
     ));
 }
 
@@ -330,10 +337,10 @@ var builtin_left(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var str = local[1];
     var len = local[2];
-    if (str.type!=vm_str) {
+    if (str.type()!=vm_str) {
         return nas_err("left", "\"string\" must be string");
     }
-    if (len.type!=vm_num) {
+    if (len.type()!=vm_num) {
         return nas_err("left", "\"length\" must be number");
     }
     if (len.num()<0) {
@@ -346,10 +353,10 @@ var builtin_right(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var str = local[1];
     var len = local[2];
-    if (str.type!=vm_str) {
+    if (str.type()!=vm_str) {
         return nas_err("right", "\"string\" must be string");
     }
-    if (len.type!=vm_num) {
+    if (len.type()!=vm_num) {
         return nas_err("right", "\"length\" must be number");
     }
     i32 length = static_cast<i32>(len.num());
@@ -367,7 +374,7 @@ var builtin_cmp(context* ctx, gc* ngc) {
     auto local = ctx->localr;
     var a = local[1];
     var b = local[2];
-    if (a.type!=vm_str || b.type!=vm_str) {
+    if (a.type()!=vm_str || b.type()!=vm_str) {
         return nas_err("cmp", "\"a\" and \"b\" must be string");
     }
     return var::num(static_cast<f64>(strcmp(
@@ -410,18 +417,18 @@ var builtin_char(context* ctx, gc* ngc) {
 
 var builtin_values(context* ctx, gc* ngc) {
     auto hash = ctx->localr[1];
-    if (hash.type!=vm_hash && hash.type!=vm_map) {
+    if (hash.type()!=vm_hash && hash.type()!=vm_map) {
         return nas_err("values", "\"hash\" must be hash or namespace");
     }
     auto vec = ngc->alloc(vm_vec);
     auto& v = vec.vec().elems;
-    if (hash.type==vm_hash) {
-        for(auto& i : hash.hash().elems) {
-            v.push_back(i.second);
+    if (hash.type()==vm_hash) {
+        for(auto& i : hash.hash().slots) {
+            v.push_back(i);
         }
     } else {
-        for(auto& i : hash.map().mapper) {
-            v.push_back(*i.second);
+        for(auto i : hash.map().values) {
+            v.push_back(*i);
         }
     }
     return vec;
@@ -429,7 +436,7 @@ var builtin_values(context* ctx, gc* ngc) {
 
 var builtin_sleep(context* ctx, gc* ngc) {
     auto val = ctx->localr[1];
-    if (val.type!=vm_num) {
+    if (val.type()!=vm_num) {
         return nil;
     }
 #if defined(_WIN32) && !defined(_GLIBCXX_HAS_GTHREADS)
@@ -561,7 +568,7 @@ std::string md5(const std::string& src) {
 
 var builtin_md5(context* ctx, gc* ngc) {
     auto str = ctx->localr[1];
-    if (str.type!=vm_str) {
+    if (str.type()!=vm_str) {
         return nas_err("md5", "\"str\" must be string");
     }
     return ngc->newstr(md5(str.str()));
@@ -576,7 +583,7 @@ var builtin_millisec(context* ctx, gc* ngc) {
 
 var builtin_gcextend(context* ctx, gc* ngc) {
     auto type = ctx->localr[1];
-    if (type.type!=vm_str) {
+    if (type.type()!=vm_str) {
         return nil;
     }
     const auto& s = type.str();
@@ -607,12 +614,12 @@ var builtin_gcinfo(context* ctx, gc* ngc) {
         total += ngc->gcnt[i];
     }
     // using ms
-    auto& map = res.hash().elems;
-    map["total"] = var::num(ngc->worktime*1.0/den*1000);
-    map["average"] = var::num(ngc->worktime*1.0/den*1000/total);
-    map["max_gc"] = var::num(ngc->max_time*1.0/den*1000);
-    map["max_mark"] = var::num(ngc->max_mark_time*1.0/den*1000);
-    map["max_sweep"] = var::num(ngc->max_sweep_time*1.0/den*1000);
+    auto& map = res.hash();
+    map.at("total") = var::num(ngc->worktime*1.0/den*1000);
+    map.at("average") = var::num(ngc->worktime*1.0/den*1000/total);
+    map.at("max_gc") = var::num(ngc->max_time*1.0/den*1000);
+    map.at("max_mark") = var::num(ngc->max_mark_time*1.0/den*1000);
+    map.at("max_sweep") = var::num(ngc->max_sweep_time*1.0/den*1000);
     return res;
 }
 
@@ -634,7 +641,7 @@ var builtin_logtime(context* ctx, gc* ngc) {
 
 var builtin_ghosttype(context* ctx, gc* ngc) {
     auto arg = ctx->localr[1];
-    if (arg.type!=vm_obj) {
+    if (arg.type()!=vm_obj) {
         return nas_err("ghosttype", "this is not a ghost object.");
     }
     const auto& name = arg.ghost().get_ghost_name();
@@ -671,6 +678,7 @@ nasal_builtin_table builtin[] = {
     {"__find", builtin_find},
     {"__type", builtin_type},
     {"__substr", builtin_substr},
+    {"__mut", builtin_mut},
     {"__streq", builtin_streq},
     {"__left", builtin_left},
     {"__right", builtin_right},
@@ -55,6 +55,7 @@ var builtin_die(context*, gc*);
 var builtin_find(context*, gc*);
 var builtin_type(context*, gc*);
 var builtin_substr(context*, gc*);
+var builtin_mut(context*, gc*);
 var builtin_streq(context*, gc*);
 var builtin_left(context*, gc*);
 var builtin_right(context*, gc*);
@@ -1,4 +1,5 @@
 #include "nasal_codegen.h"
+#include "optimizer.h"
 
 namespace nasal {
 
@@ -21,15 +22,126 @@ void codegen::load_native_function_table(nasal_builtin_table* table) {
     }
 }
 
+const std::vector<nasal_builtin_table*>& codegen::native_tables() {
+    static const std::vector<nasal_builtin_table*> tables = {
+        builtin,
+        io_lib_native,
+        math_lib_native,
+        bits_native,
+        coroutine_native,
+        flight_gear_native,
+        dylib_lib_native,
+        unix_lib_native
+    };
+    return tables;
+}
+
 void codegen::init_native_function() {
-    load_native_function_table(builtin);
-    load_native_function_table(io_lib_native);
-    load_native_function_table(math_lib_native);
-    load_native_function_table(bits_native);
-    load_native_function_table(coroutine_native);
-    load_native_function_table(flight_gear_native);
-    load_native_function_table(dylib_lib_native);
-    load_native_function_table(unix_lib_native);
+    for(auto table : native_tables()) {
+        load_native_function_table(table);
+    }
+}
+
+void codegen::find_native_forwarder(code_block* root) {
+    // coroutine functions switch the running context,
+    // so they need a real function frame
+    std::unordered_set<std::string> frame_required;
+    for(auto i = coroutine_native; i->name; ++i) {
+        frame_required.insert(i->name);
+    }
+
+    assignment_finder finder;
+    finder.do_find(root);
+    // global variables could be changed by globals.name = ...
+    if (finder.use_globals) {
+        return;
+    }
+
+    for(auto i : root->get_expressions()) {
+        if (i->get_type()!=expr_type::ast_def) {
+            continue;
+        }
+        auto def = (definition_expr*)i;
+        if (!def->get_variable_name() || !def->get_value() ||
+            def->get_value()->get_type()!=expr_type::ast_func) {
+            continue;
+        }
+        const auto& name = def->get_variable_name()->get_name();
+        const auto& state = finder.state(root, name);
+        if (state.definition_count!=1 || state.assigned) {
+            continue;
+        }
+
+        // only normal parameters, so native function gets them by
+        // localr[1] ... localr[n] both in wrapper and op_callnb
+        auto func = (function*)def->get_value();
+        bool normal = true;
+        for(auto p : func->get_parameter_list()) {
+            normal &= p->get_parameter_type()==
+                parameter::param_type::normal_parameter;
+        }
+        const auto& block = func->get_code_block()->get_expressions();
+        if (!normal || block.size()!=1 ||
+            block[0]->get_type()!=expr_type::ast_ret) {
+            continue;
+        }
+
+        // return __native(a, b); arguments are ignored by op_callb,
+        // but should have no side effect
+        auto value = ((return_expr*)block[0])->get_value();
+        if (!value || value->get_type()!=expr_type::ast_call) {
+            continue;
+        }
+        auto call = (call_expr*)value;
+        if (call->get_first()->get_type()!=expr_type::ast_id ||
+            call->get_calls().size()!=1 ||
+            call->get_calls()[0]->get_type()!=expr_type::ast_callf) {
+            continue;
+        }
+        const auto& native = ((identifier*)call->get_first())->get_name();
+        if (!native_function_mapper.count(native) ||
+            frame_required.count(native)) {
+            continue;
+        }
+        bool simple_argument = true;
+        for(auto arg : ((call_function*)call->get_calls()[0])->get_argument()) {
+            simple_argument &= arg->get_type()==expr_type::ast_id;
+        }
+        const auto index = native_function_mapper.at(native);
+        const auto argc = func->get_parameter_list().size();
+        if (!simple_argument || index>0xffff || argc>0xffff) {
+            continue;
+        }
+        forwarder_candidate[name] = {
+            static_cast<u32>(index),
+            static_cast<u32>(argc)
+        };
+    }
+}
+
+bool codegen::is_native_forwarder_call(call_expr* node) {
+    if (node->get_first()->get_type()!=expr_type::ast_id ||
+        node->get_calls().empty() ||
+        node->get_calls()[0]->get_type()!=expr_type::ast_callf) {
+        return false;
+    }
+    // local variable with the same name hides the wrapper
+    const auto& name = ((identifier*)node->get_first())->get_name();
+    if (!forwarder.count(name) ||
+        resolve_symbol(name).kind!=symbol_kind::global) {
+        return false;
+    }
+    // missing or extra arguments are handled by op_callfv
+    const auto& args = ((call_function*)node->get_calls()[0])->get_argument();
+    if (args.size()!=forwarder.at(name).argc) {
+        return false;
+    }
+    for(auto i : args) {
+        if (i->get_type()==expr_type::ast_pair) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void codegen::check_id_exist(identifier* node) {
@@ -43,13 +155,7 @@ void codegen::check_id_exist(identifier* node) {
         return;
     }
 
-    if (local_symbol_find(name)>=0) {
-        return;
-    }
-    if (upvalue_symbol_find(name)>=0) {
-        return;
-    }
-    if (global_symbol_find(name)>=0) {
+    if (resolve_symbol(name).kind!=symbol_kind::undefined) {
         return;
     }
     die("undefined symbol \"" + name +
@@ -99,53 +205,89 @@ void codegen::find_symbol(code_block* node) {
 }
 
 void codegen::add_symbol(const std::string& name) {
+    auto iter = symbol_id.find(name);
+    if (iter==symbol_id.end()) {
+        iter = symbol_id.insert({name, symbol_table.size()}).first;
+        symbol_table.push_back({});
+    }
+    auto& bindings = symbol_table[iter->second];
+    const u32 depth = local.size();
+    // already declared in this scope
+    if (bindings.size() && bindings.back().depth==depth) {
+        return;
+    }
     if (local.empty()) {
-        if (global.count(name)) {
-            return;
-        }
         i32 index = global.size();
         global[name] = index;
+        bindings.push_back({depth, index});
         return;
     }
-    if (local.back().count(name)) {
-        return;
+    bindings.push_back({depth, static_cast<i32>(local.back().size())});
+    local.back().push_back(iter->second);
+}
+
+void codegen::push_local_scope() {
+    local.push_back({});
+    // special keyword 'me' uses index 0 in every function scope
+    add_symbol("me");
+}
+
+void codegen::pop_local_scope() {
+    for(auto id : local.back()) {
+        symbol_table[id].pop_back();
     }
-    i32 index = local.back().size();
-    local.back()[name] = index;
+    local.pop_back();
 }
 
-i32 codegen::local_symbol_find(const std::string& name) {
-    if (local.empty()) {
-        return -1;
+const std::vector<codegen::symbol_binding>* codegen::find_bindings(
+    const std::string& name) const {
+    auto iter = symbol_id.find(name);
+    if (iter==symbol_id.end() || symbol_table[iter->second].empty()) {
+        return nullptr;
     }
-    return local.back().count(name)? local.back().at(name):-1;
+    return &symbol_table[iter->second];
 }
 
-i32 codegen::global_symbol_find(const std::string& name) {
-    return global.count(name)? global.at(name):-1;
+codegen::symbol_location codegen::resolve_symbol(
+    const std::string& name) const {
+    auto bindings = find_bindings(name);
+    if (!bindings) {
+        return {symbol_kind::undefined, -1};
+    }
+    // bindings are sorted by depth, so the innermost one is at the back
+    const u32 depth = local.size();
+    auto iter = bindings->rbegin();
+    if (depth && iter->depth==depth) {
+        return {symbol_kind::local, iter->index};
+    }
+    if (iter->depth) {
+        // 32768 level 65536 upvalues
+        return {
+            symbol_kind::upvalue,
+            static_cast<i32>(((iter->depth-1)<<16)|iter->index)
+        };
+    }
+    return {symbol_kind::global, iter->index};
 }
 
-i32 codegen::upvalue_symbol_find(const std::string& name) {
-    // 32768 level 65536 upvalues
-    i32 index = -1;
-    usize size = local.size();
-    if (size<=1) {
+i32 codegen::local_symbol_find(const std::string& name) const {
+    const auto res = resolve_symbol(name);
+    return res.kind==symbol_kind::local? res.index:-1;
+}
+
+i32 codegen::global_symbol_find(const std::string& name) const {
+    auto bindings = find_bindings(name);
+    // global binding is always the first one
+    if (!bindings || bindings->front().depth) {
         return -1;
     }
-    auto iter = local.begin();
-    for(u32 i = 0; i<size-1; ++i, ++iter) {
-        if (iter->count(name)) {
-            index = ((i<<16)|(*iter).at(name));
-        }
-    }
-    return index;
+    return bindings->front().index;
 }
 
 void codegen::emit(u8 operation_code, u32 immediate_num, const span& location) {
-    code.push_back({
-        operation_code,
+    code.push_back({operation_code, immediate_num});
+    code_location.push_back({
         static_cast<u16>(file_map.at(location.file)),
-        immediate_num,
         location.begin_line
     });
 }
@@ -233,7 +375,7 @@ void codegen::func_gen(function* node) {
     // this keyword is set to nil as default value
     // after calling a hash, this keyword is set to this hash
     // this symbol's index will be 0
-    local.push_back({{"me", 0}});
+    push_local_scope();
 
     // generate parameter list
     for(auto tmp : node->get_parameter_list()) {
@@ -295,7 +437,7 @@ void codegen::func_gen(function* node) {
             std::to_string(local.back().size()), block->get_location()
         );
     }
-    local.pop_back();
+    pop_local_scope();
 
     if (!block->get_expressions().size() ||
         block->get_expressions().back()->get_type()!=expr_type::ast_ret) {
@@ -306,11 +448,26 @@ void codegen::func_gen(function* node) {
 }
 
 void codegen::call_gen(call_expr* node) {
-    calc_gen(node->get_first());
-    if (code.back().op==op_callb) {
-        return;
+    usize begin = 0;
+    if (is_native_forwarder_call(node)) {
+        // arguments are laid out on the stack without the wrapper frame
+        const auto& info = forwarder.at(
+            ((identifier*)node->get_first())->get_name()
+        );
+        auto call = (call_function*)node->get_calls()[0];
+        for(auto i : call->get_argument()) {
+            calc_gen(i);
+        }
+        emit(op_callnb, (info.argc<<16)|info.index, call->get_location());
+        begin = 1;
+    } else {
+        calc_gen(node->get_first());
+        if (code.back().op==op_callb) {
+            return;
+        }
     }
-    for(auto i : node->get_calls()) {
+    for(usize index = begin; index<node->get_calls().size(); ++index) {
+        auto i = node->get_calls()[index];
         switch(i->get_type()) {
             case expr_type::ast_callh: call_hash_gen((call_hash*)i); break;
             case expr_type::ast_callv: call_vector_gen((call_vector*)i); break;
@@ -335,18 +492,18 @@ void codegen::call_id(identifier* node) {
         return;
     }
 
-    i32 index;
-    if ((index = local_symbol_find(name))>=0) {
-        emit(op_calll, index, node->get_location());
-        return;
-    }
-    if ((index = upvalue_symbol_find(name))>=0) {
-        emit(op_upval, index, node->get_location());
-        return;
-    }
-    if ((index = global_symbol_find(name))>=0) {
-        emit(op_callg, index, node->get_location());
-        return;
+    const auto symbol = resolve_symbol(name);
+    switch(symbol.kind) {
+        case symbol_kind::local:
+            emit(op_calll, symbol.index, node->get_location());
+            return;
+        case symbol_kind::upvalue:
+            emit(op_upval, symbol.index, node->get_location());
+            return;
+        case symbol_kind::global:
+            emit(op_callg, symbol.index, node->get_location());
+            return;
+        default: break;
     }
     die("undefined symbol \"" + name + "\"", node->get_location());
 }
@@ -447,18 +604,18 @@ void codegen::mcall_id(identifier* node) {
         return;
     }
 
-    i32 index;
-    if ((index = local_symbol_find(name))>=0) {
-        emit(op_mcalll, index, node->get_location());
-        return;
-    }
-    if ((index = upvalue_symbol_find(name))>=0) {
-        emit(op_mupval, index, node->get_location());
-        return;
-    }
-    if ((index = global_symbol_find(name))>=0) {
-        emit(op_mcallg, index, node->get_location());
-        return;
+    const auto symbol = resolve_symbol(name);
+    switch(symbol.kind) {
+        case symbol_kind::local:
+            emit(op_mcalll, symbol.index, node->get_location());
+            return;
+        case symbol_kind::upvalue:
+            emit(op_mupval, symbol.index, node->get_location());
+            return;
+        case symbol_kind::global:
+            emit(op_mcallg, symbol.index, node->get_location());
+            return;
+        default: break;
     }
     die("undefined symbol \"" + name + "\"", node->get_location());
 }
@@ -491,6 +648,10 @@ void codegen::single_def(definition_expr* node) {
     }
     if (local.empty()) {
         emit(op_loadg, global_symbol_find(str), node->get_location());
+        // calls after this definition could skip the wrapper
+        if (forwarder_candidate.count(str)) {
+            forwarder[str] = forwarder_candidate.at(str);
+        }
     } else {
         emit(op_loadl, local_symbol_find(str), node->get_location());
     }
@@ -805,7 +966,73 @@ void codegen::while_gen(while_expr* node) {
     load_continue_break(code.size()-1, code.size());
 }
 
+bool codegen::counted_loop_gen(for_expr* node) {
+    // for(...; i<1e6; i+=1) with i in local or global scope
+    if (node->get_condition()->get_type()!=expr_type::ast_binary ||
+        node->get_step()->get_type()!=expr_type::ast_assign) {
+        return false;
+    }
+    auto cond = (binary_operator*)node->get_condition();
+    auto step = (assignment_expr*)node->get_step();
+    u8 cmp_op = op_exit;
+    switch(cond->get_operator_type()) {
+        case binary_operator::binary_type::less: cmp_op = op_lessc; break;
+        case binary_operator::binary_type::leq: cmp_op = op_leqc; break;
+        case binary_operator::binary_type::grt: cmp_op = op_grtc; break;
+        case binary_operator::binary_type::geq: cmp_op = op_geqc; break;
+        default: return false;
+    }
+    u8 step_op = op_exit;
+    switch(step->get_assignment_type()) {
+        case assignment_expr::assign_type::add_equal: step_op = op_addecp; break;
+        case assignment_expr::assign_type::sub_equal: step_op = op_subecp; break;
+        default: return false;
+    }
+    if (cond->get_left()->get_type()!=expr_type::ast_id ||
+        cond->get_right()->get_type()!=expr_type::ast_num ||
+        step->get_left()->get_type()!=expr_type::ast_id ||
+        step->get_right()->get_type()!=expr_type::ast_num) {
+        return false;
+    }
+    const auto& name = ((identifier*)cond->get_left())->get_name();
+    if (name!=((identifier*)step->get_left())->get_name()) {
+        return false;
+    }
+    const auto symbol = resolve_symbol(name);
+    if (symbol.kind!=symbol_kind::local && symbol.kind!=symbol_kind::global) {
+        return false;
+    }
+    const auto is_local = symbol.kind==symbol_kind::local;
+    const auto limit = ((number_literal*)cond->get_right())->get_number();
+    const auto delta = ((number_literal*)step->get_right())->get_number();
+    regist_num(limit);
+    regist_num(delta);
+
+    statement_generation(node->get_initial());
+    // first check before entering the loop body
+    usize check_place = code.size();
+    emit(is_local? op_calll:op_callg, symbol.index, cond->get_location());
+    emit(cmp_op, const_number_map.at(limit), cond->get_location());
+    usize label_exit = code.size();
+    emit(op_jf, 0, cond->get_location());
+
+    block_gen(node->get_code_block());
+    usize continue_place = code.size();
+    // lloop/gloop does step, check and jump in one instruction,
+    // it reads the step from the next opcode and the check from check_place
+    emit(is_local? op_lloop:op_gloop, symbol.index, step->get_location());
+    emit(step_op, const_number_map.at(delta), step->get_location());
+    emit(op_jmp, check_place, step->get_location());
+    code[label_exit].num = code.size();
+
+    load_continue_break(continue_place, code.size());
+    return true;
+}
+
 void codegen::for_gen(for_expr* node) {
+    if (counted_loop_gen(node)) {
+        return;
+    }
     statement_generation(node->get_initial());
     usize jmp_place = code.size();
     if (node->get_condition()->get_type()==expr_type::ast_null) {
@@ -1220,6 +1447,10 @@ void codegen::ret_gen(return_expr* node) {
         emit(op_pop, 0, node->get_location());
     }
     calc_gen(node->get_value());
+    // builtin calls are not generated as callfv
+    if (node->is_tail_call() && code.back().op==op_callfv) {
+        code.back().op = op_tcallfv;
+    }
     emit(op_ret, 0, node->get_location());
 }
 
@@ -1237,6 +1468,7 @@ const error& codegen::compile(parse& parse, linker& import, bool repl_flag) {
 
     // search global symbols first
     find_symbol(parse.tree());
+    find_native_forwarder(parse.tree());
 
     // generate main block
     block_gen(parse.tree());
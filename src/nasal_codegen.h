@@ -31,6 +31,10 @@
 namespace nasal {
 
 class codegen {
+private:
+    // peephole optimizer rewrites generated opcodes in place
+    friend class peephole;
+
 private:
     error err;
 
@@ -56,8 +60,22 @@ private:
     void load_native_function_table(nasal_builtin_table*);
     void init_native_function();
 
-    // generated opcodes
+    // global wrapper like var size = func(object) {return __size(object);}
+    // which is never changed, user calls of it are generated as op_callnb.
+    // candidates are found before generation, and only used after the
+    // definition is generated
+    struct native_forwarder {
+        u32 index;
+        u32 argc;
+    };
+    std::unordered_map<std::string, native_forwarder> forwarder_candidate;
+    std::unordered_map<std::string, native_forwarder> forwarder;
+    void find_native_forwarder(code_block*);
+    bool is_native_forwarder_call(call_expr*);
+
+    // generated opcodes, and file/line of each opcode
     std::vector<opcode> code;
+    std::vector<opcode_location> code_location;
 
     // used to store jmp operands index, to fill the jump address back
     std::list<std::vector<i32>> continue_ptr;
@@ -70,7 +88,30 @@ private:
 
     // local  : max 32768 upvalues 65536 values
     // but in fact local scope also has less than STACK_DEPTH value
-    std::list<std::unordered_map<std::string, i32>> local;
+    // each function scope records ids of symbols declared in it,
+    // size of the scope is the count of local values
+    std::vector<std::vector<u32>> local;
+
+    // flat symbol table, symbol name is interned into an id, and each id
+    // has a stack of bindings, the top is the innermost one.
+    // depth 0 is global scope, depth n is the n-th function scope
+    struct symbol_binding {
+        u32 depth;
+        i32 index;
+    };
+    std::unordered_map<std::string, u32> symbol_id;
+    std::vector<std::vector<symbol_binding>> symbol_table;
+
+    enum class symbol_kind {
+        local,
+        upvalue,
+        global,
+        undefined
+    };
+    struct symbol_location {
+        symbol_kind kind;
+        i32 index;
+    };
 
     void check_id_exist(identifier*);
     
@@ -82,9 +123,12 @@ private:
     void regist_str(const std::string&);
     void find_symbol(code_block*);
     void add_symbol(const std::string&);
-    i32 local_symbol_find(const std::string&);
-    i32 global_symbol_find(const std::string&);
-    i32 upvalue_symbol_find(const std::string&);
+    void push_local_scope();
+    void pop_local_scope();
+    const std::vector<symbol_binding>* find_bindings(const std::string&) const;
+    symbol_location resolve_symbol(const std::string&) const;
+    i32 local_symbol_find(const std::string&) const;
+    i32 global_symbol_find(const std::string&) const;
 
     void emit(u8, u32, const span&);
 
@@ -115,6 +159,7 @@ private:
     void loop_gen(expr*);
     void load_continue_break(i32, i32);
     void while_gen(while_expr*);
+    bool counted_loop_gen(for_expr*);
     void for_gen(for_expr*);
     void forei_gen(forei_expr*);
     void statement_generation(expr*);
@@ -133,11 +178,17 @@ public:
     const auto& nums() const {return const_number_table;}
     const auto& natives() const {return native_function;}
     const auto& codes() const {return code;}
+    auto& codes() {return code;}
+    const auto& locations() const {return code_location;}
     const auto& globals() const {return global;}
     const auto& get_experimental_namespace() const {
         return experimental_namespace;
     }
 
+public:
+    // all native function tables, in the order of loading
+    static const std::vector<nasal_builtin_table*>& native_tables();
+
 public:
     codegen() = default;
     const error& compile(parse&, linker&, bool);
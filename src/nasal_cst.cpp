@@ -0,0 +1,184 @@
+#include "nasal_cst.h"
+
+#include <algorithm>
+
+namespace nasal {
+
+cst::cst(const lexer &lex)
+    : source(lex.source()), toks(lex.result()), trivias(lex.trivia()) {
+  if (!lex.is_lossless() || trivias.size() != toks.size()) {
+    // lexer does not run in lossless mode, so nothing could be mapped back
+    trivias.clear();
+  }
+}
+
+bool cst::find_begin(u32 line, u32 column, usize &index) const {
+  if (trivias.empty()) {
+    return false;
+  }
+  // eof token is not included, it shares location with the last token
+  auto end = toks.begin() + (toks.size() - 1);
+  auto res = std::lower_bound(
+      toks.begin(), end, std::make_pair(line, column),
+      [](const token &t, const std::pair<u32, u32> &pos) {
+        return t.loc.begin_line < pos.first ||
+               (t.loc.begin_line == pos.first &&
+                t.loc.begin_column < pos.second);
+      });
+  if (res == end || res->loc.begin_line != line ||
+      res->loc.begin_column != column) {
+    return false;
+  }
+  index = res - toks.begin();
+  return true;
+}
+
+bool cst::find_end(u32 line, u32 column, usize &index) const {
+  if (trivias.empty()) {
+    return false;
+  }
+  auto end = toks.begin() + (toks.size() - 1);
+  auto res = std::lower_bound(
+      toks.begin(), end, std::make_pair(line, column),
+      [](const token &t, const std::pair<u32, u32> &pos) {
+        return t.loc.end_line < pos.first ||
+               (t.loc.end_line == pos.first && t.loc.end_column < pos.second);
+      });
+  if (res == end || res->loc.end_line != line ||
+      res->loc.end_column != column) {
+    return false;
+  }
+  index = res - toks.begin();
+  return true;
+}
+
+bool cst::token_range(expr *node, usize &first, usize &last) const {
+  if (!node) {
+    return false;
+  }
+  const auto &loc = node->get_location();
+  if (!find_begin(loc.begin_line, loc.begin_column, first) ||
+      !find_end(loc.end_line, loc.end_column, last)) {
+    return false;
+  }
+
+  // these nodes' location begins at the operator token,
+  // so the leftmost child decides where the source text begins
+  expr *leftmost = nullptr;
+  switch (node->get_type()) {
+  case expr_type::ast_binary:
+    leftmost = ((binary_operator *)node)->get_left();
+    break;
+  case expr_type::ast_ternary:
+    leftmost = ((ternary_operator *)node)->get_condition();
+    break;
+  case expr_type::ast_assign:
+    leftmost = ((assignment_expr *)node)->get_left();
+    break;
+  case expr_type::ast_call:
+    leftmost = ((call_expr *)node)->get_first();
+    break;
+  default:
+    break;
+  }
+  usize child_first = 0, child_last = 0;
+  if (leftmost && token_range(leftmost, child_first, child_last)) {
+    first = std::min(first, child_first);
+  }
+  return first <= last;
+}
+
+std::string cst::text(usize index) const {
+  if (index >= trivias.size()) {
+    return "";
+  }
+  const auto &t = trivias[index];
+  return source.substr(t.begin, t.end - t.begin);
+}
+
+std::string cst::leading_trivia(usize index) const {
+  if (index >= trivias.size()) {
+    return "";
+  }
+  const auto &t = trivias[index];
+  return source.substr(t.leading_begin, t.begin - t.leading_begin);
+}
+
+std::string cst::trailing_trivia(usize index) const {
+  if (index >= trivias.size()) {
+    return "";
+  }
+  const auto &t = trivias[index];
+  return source.substr(t.end, t.trailing_end - t.end);
+}
+
+std::string cst::text(expr *node) const {
+  usize first = 0, last = 0;
+  if (!token_range(node, first, last)) {
+    return "";
+  }
+  const auto begin = trivias[first].begin;
+  return source.substr(begin, trivias[last].end - begin);
+}
+
+std::string cst::leading_trivia(expr *node) const {
+  usize first = 0, last = 0;
+  if (!token_range(node, first, last)) {
+    return "";
+  }
+  return leading_trivia(first);
+}
+
+std::string cst::trailing_trivia(expr *node) const {
+  usize first = 0, last = 0;
+  if (!token_range(node, first, last)) {
+    return "";
+  }
+  return trailing_trivia(last);
+}
+
+bool cst::add_edit(usize begin, usize end, const std::string &str) {
+  for (const auto &i : edits) {
+    if (begin < i.end && i.begin < end) {
+      return false;
+    }
+    // two insertions at the same place have no stable order
+    if (begin == end && i.begin == i.end && begin == i.begin) {
+      return false;
+    }
+  }
+  edits.push_back({begin, end, str});
+  return true;
+}
+
+bool cst::replace(usize index, const std::string &str) {
+  if (index >= trivias.size()) {
+    return false;
+  }
+  return add_edit(trivias[index].begin, trivias[index].end, str);
+}
+
+bool cst::replace(expr *node, const std::string &str) {
+  usize first = 0, last = 0;
+  if (!token_range(node, first, last)) {
+    return false;
+  }
+  return add_edit(trivias[first].begin, trivias[last].end, str);
+}
+
+std::string cst::print() const {
+  auto sorted = edits;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const edit &a, const edit &b) { return a.begin < b.begin; });
+  std::string out = "";
+  usize ptr = 0;
+  for (const auto &i : sorted) {
+    out += source.substr(ptr, i.begin - ptr);
+    out += i.text;
+    ptr = i.end;
+  }
+  out += source.substr(ptr);
+  return out;
+}
+
+} // namespace nasal
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "nasal.h"
+#include "nasal_ast.h"
+#include "nasal_lexer.h"
+
+namespace nasal {
+
+// concrete syntax tree view of a source file.
+// it is built from the token list and trivia ranges of a lexer running in
+// lossless mode, and maps ast nodes back to the exact source text they came
+// from, so formatter and refactoring tools can rewrite parts of a file and
+// keep every untouched byte (whitespace, comments) as it is.
+class cst {
+private:
+  struct edit {
+    usize begin;
+    usize end;
+    std::string text;
+  };
+
+private:
+  std::string source;
+  std::vector<token> toks;
+  std::vector<token_trivia> trivias;
+  std::vector<edit> edits;
+
+  bool find_begin(u32, u32, usize &) const;
+  bool find_end(u32, u32, usize &) const;
+  bool add_edit(usize, usize, const std::string &);
+
+public:
+  cst(const lexer &);
+
+  // count of mapped tokens, 0 if the lexer does not run in lossless mode.
+  // token index used below must be less than size()
+  usize size() const { return trivias.size(); }
+  const token &get_token(usize index) const { return toks[index]; }
+  const token_trivia &get_trivia(usize index) const { return trivias[index]; }
+
+  // first and last token of a node, including all children of the node
+  bool token_range(expr *, usize &, usize &) const;
+
+  std::string text(usize) const;
+  std::string leading_trivia(usize) const;
+  std::string trailing_trivia(usize) const;
+  std::string text(expr *) const;
+  std::string leading_trivia(expr *) const;
+  std::string trailing_trivia(expr *) const;
+
+  // edits must not overlap, return false if failed to add this edit
+  bool replace(usize, const std::string &);
+  bool replace(expr *, const std::string &);
+  void clear_edits() { edits.clear(); }
+
+  // print source with all edits applied,
+  // without edits the output is exactly the same as the input source
+  std::string print() const;
+};
+
+} // namespace nasal
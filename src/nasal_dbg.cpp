@@ -147,10 +147,10 @@ void dbg::list_file() const {
 }
 
 void dbg::step_info() {
-    u32 line = bytecode[ctx.pc].line==0? 0:bytecode[ctx.pc].line-1;
+    u32 line = locations[ctx.pc].line==0? 0:locations[ctx.pc].line-1;
     u32 begin = (line>>3)==0? 0:((line>>3)<<3);
     u32 end = (1+(line>>3))<<3;
-    src.load(files[bytecode[ctx.pc].fidx]);
+    src.load(files[locations[ctx.pc].fidx]);
     std::clog << "\nsource code:\n";
     for(u32 i = begin; i<end && i<src.size(); ++i) {
         std::clog << (i==line? back_white:reset);
@@ -159,7 +159,9 @@ void dbg::step_info() {
 
     begin = (ctx.pc>>3)==0? 0:((ctx.pc>>3)<<3);
     end = (1+(ctx.pc>>3))<<3;
-    codestream::set(const_number, const_string, native_function.data(), files);
+    codestream::set(
+        const_number, const_string, native_function.data(), files, locations
+    );
     std::clog << "\nnext bytecode:\n";
     for(u32 i = begin; i<end && bytecode[i].op!=op_exit; ++i) {
         std::clog
@@ -183,8 +185,8 @@ void dbg::interact() {
     }
 
     // is not break point and is not next stop command
-    const auto& code = bytecode[ctx.pc];
-    if ((code.fidx!=break_file_index || code.line!=break_line) && !next) {
+    const auto& loc = locations[ctx.pc];
+    if ((loc.fidx!=break_file_index || loc.line!=break_line) && !next) {
         return;
     }
 
@@ -235,13 +237,15 @@ void dbg::interact() {
 }
 
 void dbg::run(
-    const codegen& gen,
+    codegen& gen,
     const linker& linker,
     const std::vector<std::string>& argv,
     bool profile,
     bool show_all_prof_result) {
 
     set_detail_report_info(true);
+    // debugger runs every opcode in its own loop
+    set_jit_flag(false);
     do_profiling = profile || show_all_prof_result;
 
     const auto& file_list = linker.get_file_list();
@@ -251,27 +255,21 @@ void dbg::run(
         gen.nums(),
         gen.natives(),
         gen.codes(),
+        gen.locations(),
         gen.globals(),
         file_list,
         argv
     );
     data.init(file_list);
 
-    std::vector<u32> code;
-    std::vector<u16> code_file_index;
-    std::vector<u32> code_line;
-    for(auto& i : gen.codes()) {
-        code.push_back(i.op);
-        code_file_index.push_back(i.fidx);
-        code_line.push_back(i.line);
-        imm.push_back(i.num);
-    }
-    while(operand_function[code[ctx.pc]]) {
+    while(operand_function[bytecode[ctx.pc].op]) {
         interact();
-        data.add_operand_counter(code[ctx.pc]);
-        data.add_code_line_counter(code_file_index[ctx.pc], code_line[ctx.pc]);
-        (this->*operand_function[code[ctx.pc]])();
-        if (ctx.top>=ctx.canary) {
+        data.add_operand_counter(bytecode[ctx.pc].op);
+        data.add_code_line_counter(
+            locations[ctx.pc].fidx, locations[ctx.pc].line
+        );
+        (this->*operand_function[bytecode[ctx.pc].op])();
+        if (ctx.top>=ctx.canary && !grow_stack(0)) {
             die("stack overflow");
         }
         ++ctx.pc;
@@ -285,7 +283,6 @@ void dbg::run(
     }
     ngc.info();
     ngc.clear();
-    imm.clear();
     return;
 }
 
@@ -84,6 +84,14 @@ private:
         &dbg::o_slc2,   &dbg::o_mcallg,
         &dbg::o_mcalll, &dbg::o_mupval,
         &dbg::o_mcallv, &dbg::o_mcallh,
+        &dbg::o_lcmpjf, &dbg::o_gcmpjf,
+        &dbg::o_lcalc,  &dbg::o_gcalc,
+        &dbg::o_callnb, &dbg::o_lloop,
+        &dbg::o_gloop,  &dbg::o_addn,
+        &dbg::o_subn,   &dbg::o_muln,
+        &dbg::o_divn,   &dbg::o_lessn,
+        &dbg::o_leqn,   &dbg::o_grtn,
+        &dbg::o_geqn,   &dbg::o_tcallfv,
         &dbg::o_ret
     };
 
@@ -162,7 +170,7 @@ public:
         break_file_index(0), break_line(0),
         do_profiling(false) {}
     void run(
-        const codegen&,
+        codegen&,
         const linker&,
         const std::vector<std::string>&,
         bool,
@@ -113,7 +113,10 @@ void flstream::load(const std::string& f) {
 
 void error::err(const std::string& stage, const std::string& info) {
     ++cnt;
-    std::cerr << red << stage << ": " << white << info << reset << "\n\n";
+    if (quiet) {
+        return;
+    }
+    *out << red << stage << ": " << white << info << reset << "\n\n";
 }
 
 void error::warn(const std::string& stage, const std::string& info) {
@@ -122,12 +125,15 @@ void error::warn(const std::string& stage, const std::string& info) {
 
 void error::err(
     const std::string& stage, const span& loc, const std::string& info) {
+    ++cnt;
+    if (quiet) {
+        return;
+    }
+
     // load error occurred file into string lines
     load(loc.file);
 
-    ++cnt;
-
-    std::cerr
+    *out
     << red << stage << ": " << white << info << reset << "\n" << cyan << "  --> "
     << red << loc.file << ":" << loc.begin_line << ":" << loc.begin_column+1
     << reset << "\n";
@@ -143,8 +149,8 @@ void error::err(
 
         if (loc.begin_line<line && line<loc.end_line) {
             if (line==loc.begin_line+1) {
-                std::cerr << cyan << iden << " | " << reset << "...\n";
-                std::cerr << cyan << iden << " | " << reset << "\n";
+                *out << cyan << iden << " | " << reset << "...\n";
+                *out << cyan << iden << " | " << reset << "\n";
             }
             continue;
         }
@@ -160,39 +166,39 @@ void error::err(
         }
 
         const auto& code = res[line-1];
-        std::cerr << cyan << leftpad(line, maxlen) << " | " << reset << code << "\n";
+        *out << cyan << leftpad(line, maxlen) << " | " << reset << code << "\n";
         // output underline
-        std::cerr << cyan << iden << " | " << reset;
+        *out << cyan << iden << " | " << reset;
         if (loc.begin_line==loc.end_line) {
             for(u32 i = 0; i<loc.begin_column; ++i) {
-                std::cerr << char(" \t"[code[i]=='\t']);
+                *out << char(" \t"[code[i]=='\t']);
             }
             for(u32 i = loc.begin_column; i<loc.end_column; ++i) {
-                std::cerr << red << (code[i]=='\t'? "^^^^":"^") << reset;
+                *out << red << (code[i]=='\t'? "^^^^":"^") << reset;
             }
         } else if (line==loc.begin_line) {
             for(u32 i = 0; i<loc.begin_column; ++i) {
-                std::cerr << char(" \t"[code[i]=='\t']);
+                *out << char(" \t"[code[i]=='\t']);
             }
             for(u32 i = loc.begin_column; i<code.size(); ++i) {
-                std::cerr << red << (code[i]=='\t'? "^^^^":"^") << reset;
+                *out << red << (code[i]=='\t'? "^^^^":"^") << reset;
             }
         } else if (loc.begin_line<line && line<loc.end_line) {
             for(u32 i = 0; i<code.size(); ++i) {
-                std::cerr << red << (code[i]=='\t'? "^^^^":"^");
+                *out << red << (code[i]=='\t'? "^^^^":"^");
             }
         } else {
             for(u32 i = 0; i<loc.end_column; ++i) {
-                std::cerr << red << (code[i]=='\t'? "^^^^":"^");
+                *out << red << (code[i]=='\t'? "^^^^":"^");
             }
         }
         if (line==loc.end_line) {
-            std::cerr << reset;
+            *out << reset;
         } else {
-            std::cerr << reset << "\n";
+            *out << reset << "\n";
         }
     }
-    std::cerr << "\n\n";
+    *out << "\n\n";
 }
 
 }
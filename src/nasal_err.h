@@ -42,6 +42,8 @@ public:
 class error:public flstream {
 private:
     u32 cnt; // counter for errors
+    std::ostream* out; // error info output, std::cerr by default
+    bool quiet; // only count errors, source file is not loaded
 
     std::string identation(usize len) {
         return std::string(len,' ');
@@ -55,7 +57,9 @@ private:
     }
 
 public:
-    error():cnt(0) {}
+    error():cnt(0), out(&std::cerr), quiet(false) {}
+    void set_output(std::ostream& s) {out = &s;}
+    void set_quiet(bool flag) {quiet = flag;}
     void err(const std::string&, const std::string&);
     void warn(const std::string&, const std::string&);
     void err(const std::string&, const span&, const std::string&);
@@ -38,8 +38,8 @@ void gc::mark() {
     while(!bfs.empty()) {
         var value = bfs.back();
         bfs.pop_back();
-        if (value.type<=vm_num ||
-            value.val.gcobj->mark!=nas_val::gc_status::uncollected) {
+        if (value.type()<=vm_num ||
+            value.gcobj()->mark!=nas_val::gc_status::uncollected) {
             continue;
         }
         mark_var(bfs, value);
@@ -50,8 +50,8 @@ void gc::concurrent_mark(std::vector<var>& vec, usize begin, usize end) {
     std::vector<var> bfs;
     for(auto i = begin; i<end; ++i) {
         var value = vec[i];
-        if (value.type<=vm_num ||
-            value.val.gcobj->mark!=nas_val::gc_status::uncollected) {
+        if (value.type()<=vm_num ||
+            value.gcobj()->mark!=nas_val::gc_status::uncollected) {
             continue;
         }
         mark_var(bfs, value);
@@ -59,8 +59,8 @@ void gc::concurrent_mark(std::vector<var>& vec, usize begin, usize end) {
     while(!bfs.empty()) {
         var value = bfs.back();
         bfs.pop_back();
-        if (value.type<=vm_num ||
-            value.val.gcobj->mark!=nas_val::gc_status::uncollected) {
+        if (value.type()<=vm_num ||
+            value.gcobj()->mark!=nas_val::gc_status::uncollected) {
             continue;
         }
         mark_var(bfs, value);
@@ -71,13 +71,13 @@ void gc::mark_context_root(std::vector<var>& bfs_queue) {
     // scan global
     for(usize i = 0; i<main_context_global_size; ++i) {
         auto& val = main_context_global[i];
-        if (val.type>vm_num) {
+        if (val.type()>vm_num) {
             bfs_queue.push_back(val);
         }
     }
     // scan now running context, this context maybe related to coroutine or main
     for(var* i = running_context->stack; i<=running_context->top; ++i) {
-        if (i->type>vm_num) {
+        if (i->type()>vm_num) {
             bfs_queue.push_back(*i);
         }
     }
@@ -91,7 +91,7 @@ void gc::mark_context_root(std::vector<var>& bfs_queue) {
 
     // coroutine is running, so scan main process stack from mctx
     for(var* i = main_context.stack; i<=main_context.top; ++i) {
-        if (i->type>vm_num) {
+        if (i->type()>vm_num) {
             bfs_queue.push_back(*i);
         }
     }
@@ -100,8 +100,8 @@ void gc::mark_context_root(std::vector<var>& bfs_queue) {
 }
 
 void gc::mark_var(std::vector<var>& bfs_queue, var& value) {
-    value.val.gcobj->mark = nas_val::gc_status::found;
-    switch(value.type) {
+    value.gcobj()->mark = nas_val::gc_status::found;
+    switch(value.type()) {
         case vm_vec: mark_vec(bfs_queue, value.vec()); break;
         case vm_hash: mark_hash(bfs_queue, value.hash()); break;
         case vm_func: mark_func(bfs_queue, value.func()); break;
@@ -114,23 +114,23 @@ void gc::mark_var(std::vector<var>& bfs_queue, var& value) {
 
 void gc::mark_vec(std::vector<var>& bfs_queue, nas_vec& vec) {
     for(auto& i : vec.elems) {
-        if (i.type>vm_num) {
+        if (i.type()>vm_num) {
             bfs_queue.push_back(i);
         }
     }
 }
 
 void gc::mark_hash(std::vector<var>& bfs_queue, nas_hash& hash) {
-    for(auto& i : hash.elems) {
-        if (i.second.type>vm_num) {
-            bfs_queue.push_back(i.second);
+    for(auto& i : hash.slots) {
+        if (i.type()>vm_num) {
+            bfs_queue.push_back(i);
         }
     }
 }
 
 void gc::mark_func(std::vector<var>& bfs_queue, nas_func& function) {
     for(auto& i : function.local) {
-        if (i.type>vm_num) {
+        if (i.type()>vm_num) {
             bfs_queue.push_back(i);
         }
     }
@@ -141,7 +141,7 @@ void gc::mark_func(std::vector<var>& bfs_queue, nas_func& function) {
 
 void gc::mark_upval(std::vector<var>& bfs_queue, nas_upval& upval) {
     for(auto& i : upval.elems) {
-        if (i.type>vm_num) {
+        if (i.type()>vm_num) {
             bfs_queue.push_back(i);
         }
     }
@@ -151,16 +151,16 @@ void gc::mark_co(std::vector<var>& bfs_queue, nas_co& co) {
     bfs_queue.push_back(co.ctx.funcr);
     bfs_queue.push_back(co.ctx.upvalr);
     for(var* i = co.ctx.stack; i<=co.ctx.top; ++i) {
-        if (i->type>vm_num) {
+        if (i->type()>vm_num) {
             bfs_queue.push_back(*i);
         }
     }
 }
 
 void gc::mark_map(std::vector<var>& bfs_queue, nas_map& mp) {
-    for(const auto& i : mp.mapper) {
-        if (i.second->type>vm_num) {
-            bfs_queue.push_back(*i.second);
+    for(auto i : mp.values) {
+        if (i->type()>vm_num) {
+            bfs_queue.push_back(*i);
         }
     }
 }
@@ -168,6 +168,9 @@ void gc::mark_map(std::vector<var>& bfs_queue, nas_map& mp) {
 void gc::sweep() {
     for(auto i : memory) {
         if (i->mark==nas_val::gc_status::uncollected) {
+            if (i->type==vm_str && i->ptr.str->interned()) {
+                intern_erase(i);
+            }
             i->clear();
             unused[i->type-vm_str].push_back(i);
             i->mark = nas_val::gc_status::collected;
@@ -177,6 +180,50 @@ void gc::sweep() {
     }
 }
 
+void gc::intern_erase(nas_val* val) {
+    auto range = interned.equal_range(val->ptr.str->hash);
+    for(auto i = range.first; i!=range.second; ++i) {
+        if (i->second==val) {
+            interned.erase(i);
+            return;
+        }
+    }
+}
+
+// constant strings are not managed by gc, so they are always interned.
+// in repl mode the same string may be interned by an old one,
+// which is still unmutable but not interned after this
+void gc::intern_constant(nas_val* val) {
+    auto& str = *val->ptr.str;
+    str.hash = string_hash(str.value);
+    auto range = interned.equal_range(str.hash);
+    for(auto i = range.first; i!=range.second; ++i) {
+        if (i->second->ptr.str->value==str.value) {
+            i->second->ptr.str->hash = 0;
+            interned.erase(i);
+            break;
+        }
+    }
+    interned.emplace(str.hash, val);
+}
+
+var gc::intern(const std::string& buff) {
+    const auto hash = string_hash(buff);
+    auto range = interned.equal_range(hash);
+    for(auto i = range.first; i!=range.second; ++i) {
+        if (i->second->ptr.str->value==buff) {
+            return var::gcobj(i->second);
+        }
+    }
+    var res = alloc(vm_str);
+    auto& str = *res.gcobj()->ptr.str;
+    str.value = buff;
+    str.hash = hash;
+    res.gcobj()->unmutable = 1;
+    interned.emplace(hash, res.gcobj());
+    return res;
+}
+
 void gc::extend(u8 type) {
     const u8 index = type-vm_str;
     size[index] += incr[index];
@@ -210,23 +257,24 @@ void gc::init(
     strs.resize(constant_strings.size());
     for(u32 i = 0; i<strs.size(); ++i) {
         // incremental initialization, avoid memory leak in repl mode
-        if (strs[i].type==vm_str && strs[i].str()==constant_strings[i]) {
+        if (strs[i].type()==vm_str && strs[i].str()==constant_strings[i]) {
             continue;
         }
         strs[i] = var::gcobj(new nas_val(vm_str));
-        strs[i].val.gcobj->unmutable = 1;
+        strs[i].gcobj()->unmutable = 1;
         strs[i].str() = constant_strings[i];
+        intern_constant(strs[i].gcobj());
     }
 
     // record arguments
     env_argv.resize(argv.size());
     for(usize i = 0; i<argv.size(); ++i) {
         // incremental initialization, avoid memory leak in repl mode
-        if (env_argv[i].type==vm_str && env_argv[i].str()==argv[i]) {
+        if (env_argv[i].type()==vm_str && env_argv[i].str()==argv[i]) {
             continue;
         }
         env_argv[i] = var::gcobj(new nas_val(vm_str));
-        env_argv[i].val.gcobj->unmutable = 1;
+        env_argv[i].gcobj()->unmutable = 1;
         env_argv[i].str() = argv[i];
     }
 }
@@ -240,9 +288,10 @@ void gc::clear() {
         unused[i].clear();
     }
     for(auto& i : strs) {
-        delete i.val.gcobj;
+        delete i.gcobj();
     }
     strs.clear();
+    interned.clear();
     env_argv.clear();
 }
 
@@ -347,7 +396,7 @@ var gc::alloc(u8 type) {
         extend(type);
     }
     var ret = var::gcobj(unused[index].back());
-    ret.val.gcobj->mark = nas_val::gc_status::uncollected;
+    ret.gcobj()->mark = nas_val::gc_status::uncollected;
     unused[index].pop_back();
     return ret;
 }
@@ -40,6 +40,11 @@ struct gc {
     std::vector<nas_val*> memory;      // gc memory
     std::vector<nas_val*> unused[gc_type_size]; // gc free list
 
+    /* interned strings, key is the hash of string */
+    std::unordered_multimap<u64, nas_val*> interned;
+    /* strings made by newstr longer than this are not interned */
+    static const usize short_string_length = 40;
+
     /* heap increase size */
     u32 incr[gc_type_size] = {
         128, // vm_str
@@ -81,6 +86,8 @@ private:
     void mark_co(std::vector<var>&, nas_co&);
     void mark_map(std::vector<var>&, nas_map&);
     void sweep();
+    void intern_erase(nas_val*);
+    void intern_constant(nas_val*);
 
 public:
     void extend(u8);
@@ -92,19 +99,22 @@ public:
     void context_reserve();
 
 public:
+    // short strings are interned and unmutable,
+    // use alloc(vm_str) to get a mutable string
+    var intern(const std::string&);
+
     var newstr(char c) {
-        var s = alloc(vm_str);
-        s.str() = c;
-        return s;
+        return intern(std::string(1, c));
     }
 
     var newstr(const char* buff) {
-        var s = alloc(vm_str);
-        s.str() = std::string(buff);
-        return s;
+        return newstr(std::string(buff));
     }
 
     var newstr(const std::string& buff) {
+        if (buff.length()<=short_string_length) {
+            return intern(buff);
+        }
         var s = alloc(vm_str);
         s.str() = buff;
         return s;
@@ -0,0 +1,581 @@
+#include "nasal_image.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#include <process.h>
+#include <stdlib.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+namespace nasal {
+
+const char image_magic[] = "NASC";
+const u32 image_version = 3;
+
+// little-endian writer and bounds-checked reader of the image format
+struct image_writer {
+    std::string data;
+
+    void put_u8(u8 n) {
+        data.push_back((char)n);
+    }
+    void put_u16(u16 n) {
+        put_u8(n&0xff);
+        put_u8((n>>8)&0xff);
+    }
+    void put_u32(u32 n) {
+        for(u32 i = 0; i<4; ++i) {
+            data.push_back((char)((n>>(i*8))&0xff));
+        }
+    }
+    void put_u64(u64 n) {
+        for(u32 i = 0; i<8; ++i) {
+            data.push_back((char)((n>>(i*8))&0xff));
+        }
+    }
+    void put_f64(f64 n) {
+        u64 bits = 0;
+        std::memcpy(&bits, &n, sizeof(bits));
+        put_u64(bits);
+    }
+    void put_string(const std::string& str) {
+        put_u32(str.length());
+        data += str;
+    }
+};
+
+struct image_reader {
+    const u8* ptr;
+    const u8* end;
+    bool failed = false;
+
+    u64 get(u32 size) {
+        if (size>static_cast<usize>(end-ptr)) {
+            failed = true;
+            return 0;
+        }
+        u64 res = 0;
+        for(u32 i = 0; i<size; ++i) {
+            res |= ((u64)*ptr++)<<(i*8);
+        }
+        return res;
+    }
+    u8 get_u8() {return get(1);}
+    u16 get_u16() {return get(2);}
+    u32 get_u32() {return get(4);}
+    u64 get_u64() {return get(8);}
+    f64 get_f64() {
+        const u64 bits = get_u64();
+        f64 res = 0;
+        std::memcpy(&res, &bits, sizeof(res));
+        return res;
+    }
+    std::string get_string() {
+        const auto length = get_u32();
+        if (failed || length>static_cast<usize>(end-ptr)) {
+            failed = true;
+            return "";
+        }
+        std::string res((const char*)ptr, length);
+        ptr += length;
+        return res;
+    }
+    // count of elements, each element uses at least min_size bytes
+    u32 get_count(usize min_size) {
+        const auto count = get_u32();
+        if (failed || count>(usize)(end-ptr)/min_size) {
+            failed = true;
+            return 0;
+        }
+        return count;
+    }
+};
+
+// FNV-1a
+u64 fnv_hash(const std::string& str) {
+    u64 hash = 0xcbf29ce484222325ULL;
+    for(auto c : str) {
+        hash ^= (u8)c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// return 0 if failed to read the file, hash of empty file is not 0
+u64 bytecode_image::source_hash(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (in.fail()) {
+        return 0;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return fnv_hash(ss.str());
+}
+
+// codegen or operand encoding may change without adding an opcode,
+// so images are only used by the same executable that built them.
+// a rebuilt executable has another size or modification time
+u64 bytecode_image::build_id() {
+    std::stringstream id;
+    id << __DATE__ << " " << __TIME__;
+#if defined(__linux__)
+    struct stat buffer;
+    if (stat("/proc/self/exe", &buffer)==0) {
+        id << " " << buffer.st_ino << " " << buffer.st_size << " "
+           << buffer.st_mtim.tv_sec << "." << buffer.st_mtim.tv_nsec;
+    }
+#elif defined(__APPLE__)
+    char path[PATH_MAX];
+    u32 size = sizeof(path);
+    struct stat buffer;
+    if (_NSGetExecutablePath(path, &size)==0 && stat(path, &buffer)==0) {
+        id << " " << buffer.st_ino << " " << buffer.st_size << " "
+           << buffer.st_mtimespec.tv_sec << "."
+           << buffer.st_mtimespec.tv_nsec;
+    }
+#endif
+    return fnv_hash(id.str());
+}
+
+// $XDG_CACHE_HOME/nasal or ~/.cache/nasal, %LOCALAPPDATA%\nasal on windows,
+// empty if none of them is set
+std::string bytecode_image::cache_dir() {
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (!base || !*base) {
+        return "";
+    }
+    return std::string(base) + "\\nasal";
+#else
+    // relative path in XDG_CACHE_HOME is invalid and ignored
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0]=='/') {
+        return std::string(xdg) + "/nasal";
+    }
+    const char* home = getenv("HOME");
+    if (!home || !*home) {
+        return "";
+    }
+    return std::string(home) + "/.cache/nasal";
+#endif
+}
+
+std::string bytecode_image::image_path(const std::string& filename) {
+    const auto dir = cache_dir();
+    if (dir.empty()) {
+        return "";
+    }
+#ifdef _WIN32
+    char* full = _fullpath(nullptr, filename.c_str(), 0);
+    const char separator = '\\';
+#else
+    char* full = realpath(filename.c_str(), nullptr);
+    const char separator = '/';
+#endif
+    if (!full) {
+        return "";
+    }
+    std::stringstream ss;
+    ss << dir << separator << std::hex << fnv_hash(full) << ".nasc";
+    free(full);
+    return ss.str();
+}
+
+bool bytecode_image::build(const codegen& gen, const linker& linker) {
+    files = linker.get_file_list();
+    hashes.clear();
+    for(const auto& i : files) {
+        // source file must be readable, or it could not be checked later
+        hashes.push_back(source_hash(i));
+        if (!hashes.back()) {
+            return false;
+        }
+    }
+    const_string = gen.strs();
+    const_number = gen.nums();
+    native_function = gen.natives();
+    global = gen.globals();
+    code = gen.codes();
+    code_location = gen.locations();
+    return true;
+}
+
+bool bytecode_image::save(const std::string& path) const {
+    image_writer out;
+    out.data.append(image_magic, 4);
+    out.put_u32(image_version);
+    out.put_u32(op_ret+1);
+    out.put_u64(build_id());
+
+    out.put_u32(files.size());
+    for(usize i = 0; i<files.size(); ++i) {
+        out.put_string(files[i]);
+        out.put_u64(hashes[i]);
+    }
+    out.put_u32(const_string.size());
+    for(const auto& i : const_string) {
+        out.put_string(i);
+    }
+    out.put_u32(const_number.size());
+    for(auto i : const_number) {
+        out.put_f64(i);
+    }
+    out.put_u32(native_function.size());
+    for(const auto& i : native_function) {
+        out.put_string(i.name);
+    }
+    out.put_u32(global.size());
+    for(const auto& i : global) {
+        out.put_string(i.first);
+        out.put_u32(i.second);
+    }
+    // hot stream first, then cold file/line table
+    out.put_u32(code.size());
+    for(const auto& i : code) {
+        out.put_u8(i.op);
+        out.put_u32(i.num);
+    }
+    for(const auto& i : code_location) {
+        out.put_u16(i.fidx);
+        out.put_u32(i.line);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (file.fail()) {
+        return false;
+    }
+    file.write(out.data.data(), out.data.size());
+    return !file.fail();
+}
+
+bool bytecode_image::deserialize(const char* data, usize size) {
+    image_reader in = {(const u8*)data, (const u8*)data+size};
+    if (size<4 || std::memcmp(data, image_magic, 4)) {
+        return false;
+    }
+    in.ptr += 4;
+    // opcodes may be changed by other versions
+    if (in.get_u32()!=image_version || in.get_u32()!=op_ret+1 ||
+        in.get_u64()!=build_id()) {
+        return false;
+    }
+
+    files.clear();
+    hashes.clear();
+    for(u32 i = 0, count = in.get_count(12); i<count; ++i) {
+        files.push_back(in.get_string());
+        hashes.push_back(in.get_u64());
+    }
+    const_string.clear();
+    for(u32 i = 0, count = in.get_count(4); i<count; ++i) {
+        const_string.push_back(in.get_string());
+    }
+    const_number.clear();
+    for(u32 i = 0, count = in.get_count(8); i<count; ++i) {
+        const_number.push_back(in.get_f64());
+    }
+
+    // find native functions by name
+    std::unordered_map<std::string, nasal_builtin_table> native_mapper;
+    for(auto table : codegen::native_tables()) {
+        for(usize i = 0; table[i].func; ++i) {
+            if (!native_mapper.count(table[i].name)) {
+                native_mapper[table[i].name] = table[i];
+            }
+        }
+    }
+    native_function.clear();
+    for(u32 i = 0, count = in.get_count(4); i<count; ++i) {
+        const auto name = in.get_string();
+        if (!native_mapper.count(name)) {
+            return false;
+        }
+        native_function.push_back(native_mapper.at(name));
+    }
+
+    global.clear();
+    for(u32 i = 0, count = in.get_count(8); i<count; ++i) {
+        const auto name = in.get_string();
+        global[name] = in.get_u32();
+    }
+    // vm::init needs these two symbols
+    if (!global.count("globals") || !global.count("arg")) {
+        return false;
+    }
+
+    code.clear();
+    code_location.clear();
+    const auto count = in.get_count(11);
+    for(u32 i = 0; i<count; ++i) {
+        opcode op;
+        op.op = in.get_u8();
+        op.num = in.get_u32();
+        if (op.op>op_ret) {
+            return false;
+        }
+        code.push_back(op);
+    }
+    for(u32 i = 0; i<count; ++i) {
+        opcode_location loc;
+        loc.fidx = in.get_u16();
+        loc.line = in.get_u32();
+        if (loc.fidx>=files.size()) {
+            return false;
+        }
+        code_location.push_back(loc);
+    }
+    return !in.failed && in.ptr==in.end && code.size() && verify();
+}
+
+// newf is followed by intl, and the jmp before entry jumps over the body,
+// entry and end of function body and local scope size are stored in info
+bool bytecode_image::check_function(usize pc, std::vector<u32>& info) const {
+    const auto entry = code[pc].num;
+    if (entry<pc+3 || entry>=code.size() || code[pc+1].op!=op_intl ||
+        code[entry-1].op!=op_jmp) {
+        return false;
+    }
+    const auto end = code[entry-1].num;
+    // local scope has "me" and "arg" at least
+    const auto local_size = code[pc+1].num;
+    if (end<entry || end>code.size() || local_size<2 ||
+        local_size>=STACK_DEPTH) {
+        return false;
+    }
+    info = {entry, end, local_size};
+    return true;
+}
+
+// operands decoded from image are used by vm without checks,
+// so every index must be in its table, every jump target in code,
+// and local or upvalue slots in the scope of function where they are used.
+// stack relative operands like argc are not checked, like codegen output
+bool bytecode_image::verify() const {
+    const usize size = code.size();
+    if (global.size()>=STACK_DEPTH || code.back().op!=op_exit) {
+        return false;
+    }
+    for(const auto& i : global) {
+        if (i.second<0 || static_cast<usize>(i.second)>=global.size()) {
+            return false;
+        }
+    }
+
+    // functions from outside to inside: entry, end, local scope size
+    std::vector<std::vector<u32>> scope;
+    // functions whose parameters are being generated: newf, parameter count
+    std::vector<std::pair<usize, u32>> header;
+    // function begins at entry, and newf is found before entry
+    std::unordered_map<u32, std::vector<u32>> function;
+
+    auto is_const_compare = [&](usize pc) {
+        return pc<size && code[pc].op>=op_lessc && code[pc].op<=op_geqc;
+    };
+    auto is_const_calc = [&](usize pc) {
+        return pc<size && code[pc].op>=op_addecp && code[pc].op<=op_divecp;
+    };
+    auto local_slot = [&](u32 slot) {
+        return scope.size() && slot<scope.back()[2];
+    };
+
+    for(usize pc = 0; pc<size; ++pc) {
+        while(scope.size() && pc>=scope.back()[1]) {
+            scope.pop_back();
+        }
+        if (function.count(pc)) {
+            const auto& info = function.at(pc);
+            if (scope.size() && info[1]>scope.back()[1]) {
+                return false;
+            }
+            scope.push_back(info);
+        }
+        // parameters end at the jmp before entry
+        if (header.size() && pc+1==code[header.back().first].num) {
+            const auto local_size = code[header.back().first+1].num;
+            if (header.back().second+2>local_size) {
+                return false;
+            }
+            header.pop_back();
+        }
+
+        const auto op = code[pc].op;
+        const auto num = code[pc].num;
+        bool valid = true;
+        switch(op) {
+            case op_pnum:
+            case op_addc: case op_subc: case op_mulc: case op_divc:
+            case op_addeqc: case op_subeqc: case op_muleqc: case op_diveqc:
+            case op_addecp: case op_subecp: case op_mulecp: case op_divecp:
+            case op_lessc: case op_leqc: case op_grtc: case op_geqc:
+                valid = num<const_number.size(); break;
+            case op_pstr: case op_happ: case op_lnkc: case op_lnkeqc:
+            case op_lnkecp: case op_callh: case op_mcallh:
+                valid = num<const_string.size(); break;
+            case op_para: case op_deft: case op_dyn:
+                valid = num<const_string.size() && header.size();
+                if (valid) {
+                    ++header.back().second;
+                }
+                break;
+            case op_callb: valid = num<native_function.size(); break;
+            case op_callnb:
+                valid = (num&0xffff)<native_function.size(); break;
+            case op_loadg: case op_callg: case op_mcallg:
+                valid = num<global.size(); break;
+            case op_loadl: case op_calll: case op_mcalll:
+                valid = local_slot(num); break;
+            case op_loadu: case op_upval: case op_mupval: {
+                // upvalue i is the local scope of the i-th function
+                // from outside, current function is not included
+                const auto depth = (num>>16)&0xffff;
+                valid = depth+1<scope.size() &&
+                    (num&0xffff)<scope[depth][2];
+            } break;
+            case op_jmp: case op_jt: case op_jf:
+            case op_findex: case op_feach:
+                valid = num<size; break;
+            case op_newf: {
+                std::vector<u32> info;
+                valid = check_function(pc, info) && !function.count(info[0]);
+                if (valid) {
+                    function[info[0]] = info;
+                    header.push_back({pc, 0});
+                }
+            } break;
+            // only generated right after newf
+            case op_intl:
+                valid = pc && code[pc-1].op==op_newf; break;
+            // operands of superinstructions are the next opcodes
+            case op_lcmpjf: case op_gcmpjf:
+                valid = (op==op_lcmpjf? local_slot(num):num<global.size()) &&
+                    is_const_compare(pc+1) &&
+                    pc+2<size && code[pc+2].op==op_jf;
+                break;
+            case op_lcalc: case op_gcalc:
+                valid = (op==op_lcalc? local_slot(num):num<global.size()) &&
+                    is_const_calc(pc+1);
+                break;
+            case op_lloop: case op_gloop: {
+                valid = (op==op_lloop? local_slot(num):num<global.size()) &&
+                    is_const_calc(pc+1) && pc+2<size &&
+                    code[pc+2].op==op_jmp;
+                const auto check = valid? code[pc+2].num:0;
+                valid = valid && is_const_compare(check+1) &&
+                    check+2<size && code[check+2].op==op_jf;
+            } break;
+            default: break;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    return header.empty();
+}
+
+bool bytecode_image::load(const std::string& path) {
+#ifndef _WIN32
+    // map the image instead of copying it into a buffer
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd<0) {
+        return false;
+    }
+    struct stat buffer;
+    if (fstat(fd, &buffer)<0 || !S_ISREG(buffer.st_mode) || !buffer.st_size) {
+        close(fd);
+        return false;
+    }
+    const auto size = (usize)buffer.st_size;
+    auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data==MAP_FAILED) {
+        return false;
+    }
+    auto result = deserialize((const char*)data, size);
+    munmap(data, size);
+    return result;
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (in.fail()) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const auto data = ss.str();
+    return deserialize(data.data(), data.size());
+#endif
+}
+
+bool bytecode_image::up_to_date() const {
+    for(usize i = 0; i<files.size(); ++i) {
+        if (source_hash(files[i])!=hashes[i]) {
+            return false;
+        }
+    }
+    return files.size();
+}
+
+bool bytecode_image::load_cache(const std::string& filename) {
+    const auto path = image_path(filename);
+    if (path.empty() || !load(path)) {
+        return false;
+    }
+    // image is built from another file with the same image path
+    if (files[0]!=filename) {
+        return false;
+    }
+    return up_to_date();
+}
+
+bool bytecode_image::save_cache(const std::string& filename) const {
+    const auto path = image_path(filename);
+    if (path.empty()) {
+        return false;
+    }
+    // create missing parents of cache directory, like mkdir -p
+    const auto dir = path.substr(0, path.find_last_of("/\\"));
+    for(usize i = 1; i<=dir.length(); ++i) {
+        if (i<dir.length() && dir[i]!='/' && dir[i]!='\\') {
+            continue;
+        }
+#ifdef _WIN32
+        _mkdir(dir.substr(0, i).c_str());
+#else
+        mkdir(dir.substr(0, i).c_str(), 0755);
+#endif
+    }
+    // other processes running the same script may load the image meanwhile,
+    // so write a temporary file and rename it to replace the old image
+#ifdef _WIN32
+    const auto temp = path + "." + std::to_string(_getpid());
+#else
+    const auto temp = path + "." + std::to_string(getpid());
+#endif
+    if (!save(temp)) {
+        std::remove(temp.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temp.c_str(), path.c_str())) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
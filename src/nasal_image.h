@@ -0,0 +1,72 @@
+#pragma once
+
+#include "nasal.h"
+#include "nasal_opcode.h"
+#include "nasal_codegen.h"
+#include "nasal_import.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nasal {
+
+// precompiled bytecode image (.nasc), all integers are little-endian:
+//   header  "NASC" u32:version u32:operand_size u64:build_id
+//   files   u32:count {string:path u64:source_hash}
+//   strings u32:count {string}
+//   numbers u32:count {f64}
+//   natives u32:count {string:name}
+//   globals u32:count {string:name u32:index}
+//   codes   u32:count {u8:op u32:num} {u16:fidx u32:line}
+// string is stored as u32:length bytes.
+// native functions are stored by name and found again when loading,
+// so an image does not depend on the address of native functions.
+// images of scripts run by `nasal -e` are cached in cache_dir(),
+// named by hash of the absolute path of the script
+class bytecode_image {
+private:
+    std::vector<std::string> files;
+    std::vector<u64> hashes;
+    std::vector<std::string> const_string;
+    std::vector<f64> const_number;
+    std::vector<nasal_builtin_table> native_function;
+    std::unordered_map<std::string, i32> global;
+    std::vector<opcode> code;
+    std::vector<opcode_location> code_location;
+
+    bool deserialize(const char*, usize);
+    bool check_function(usize, std::vector<u32>&) const;
+    bool verify() const;
+
+public:
+    static u64 source_hash(const std::string&);
+    static u64 build_id();
+    static std::string cache_dir();
+    // image path of a source file in cache directory, empty if unknown
+    static std::string image_path(const std::string&);
+
+public:
+    // build image from codegen result and linked file list
+    bool build(const codegen&, const linker&);
+    bool save(const std::string&) const;
+    bool load(const std::string&);
+    // every linked source file is not changed since the image is built
+    bool up_to_date() const;
+    // load image of this source file if it is up to date
+    bool load_cache(const std::string&);
+    // save image of this source file into cache directory
+    bool save_cache(const std::string&) const;
+
+public:
+    const auto& strs() const {return const_string;}
+    const auto& nums() const {return const_number;}
+    const auto& natives() const {return native_function;}
+    const auto& codes() const {return code;}
+    auto& codes() {return code;}
+    const auto& locations() const {return code_location;}
+    const auto& globals() const {return global;}
+    const auto& get_file_list() const {return files;}
+};
+
+}
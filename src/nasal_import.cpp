@@ -1,13 +1,26 @@
 #include "nasal_import.h"
 #include "symbol_finder.h"
-
+#include "ast_serializer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
 #include <memory>
+#include <sstream>
+#include <thread>
 
 namespace nasal {
 
+// stop predicting modules to parse ahead after this,
+// the rest will be parsed when linking
+const usize MAX_PREDICTED_MODULES = 4096;
+
 linker::linker():
-    show_path(false), lib_loaded(false),
-    this_file(""), lib_path("") {
+    show_path(false), lib_loaded(false), parallel(true),
+    this_file(""), lib_path(""), out(&std::cout) {
     char sep = is_windows()? ';':':';
     std::string PATH = getenv("PATH");
     usize last = 0, pos = PATH.find(sep, 0);
@@ -36,21 +49,90 @@ std::string linker::get_path(call_expr* node) {
     return fpath + ".nas";
 }
 
-std::string linker::find_file(
-    const std::string& filename, const span& location) {
-    // first add file name itself into the file path
-    std::vector<std::string> fpath = {filename};
+void linker::check_search_key() {
+    // relative paths in the cache are invalid if working directory changed,
+    // and the search order is changed with the search paths
+    char cwd[1024] = {0};
+    std::string key = getcwd(cwd, sizeof(cwd))? cwd:"";
+    for(const auto& p : envpath) {
+        key += "\n" + p;
+    }
+    auto cache = module_cache::instance();
+    if (cache->search_key!=key) {
+        cache->search_key = key;
+        cache->resolved.clear();
+        directory_mtime.clear();
+    }
+}
+
+// mtime of directory, -1 if it does not exist
+i64 linker::directory_state(const std::string& path) {
+    if (directory_mtime.count(path)) {
+        return directory_mtime.at(path);
+    }
+    struct stat buffer;
+    i64 mtime = -1;
+    if (stat(path.c_str(), &buffer)==0) {
+        mtime = static_cast<i64>(buffer.st_mtime);
+    }
+    directory_mtime[path] = mtime;
+    return mtime;
+}
+
+std::string linker::search_file(const std::string& filename) {
+    check_search_key();
+
+    // resolved before, check if the file still exists and no file is
+    // created in directories searched before it.
+    // failed search is not cached, the file may be created later
+    auto& resolved = module_cache::instance()->resolved;
+    if (resolved.count(filename)) {
+        const auto& cached = resolved.at(filename);
+        bool valid = access(cached.path.c_str(), F_OK)!=-1;
+        for(const auto& i : cached.missed) {
+            if (!valid) {
+                break;
+            }
+            valid = directory_state(i.first)==i.second;
+        }
+        if (valid) {
+            return cached.path;
+        }
+        resolved.erase(filename);
+    }
 
-    // generate search path from environ path
+    // first check file name itself, then search in environ path
+    std::vector<std::string> candidates = {filename};
     for(const auto& p : envpath) {
-        fpath.push_back(p + (is_windows()? "\\":"/") + filename);
+        candidates.push_back(p + (is_windows()? "\\":"/") + filename);
+    }
+    module_cache::resolution result;
+    const auto now = static_cast<i64>(std::time(nullptr));
+    for(const auto& path : candidates) {
+        if (access(path.c_str(), F_OK)!=-1) {
+            result.path = path;
+            resolved[filename] = result;
+            return path;
+        }
+        auto pos = path.find_last_of("/\\");
+        auto directory = pos==std::string::npos? ".":path.substr(0, pos);
+        auto mtime = directory_state(directory);
+        // mtime is in seconds, a file created in this second may not
+        // change it, so do not trust a directory changed just now
+        if (mtime>=now-1) {
+            mtime = -2;
+        }
+        result.missed.push_back({directory, mtime});
     }
+    return "";
+}
 
+std::string linker::find_file(
+    const std::string& filename, const span& location) {
     // search file
-    for(const auto& i : fpath) {
-        if (access(i.c_str(), F_OK)!=-1) {
-            return i;
-        }
+    auto result = search_file(filename);
+    if (result.length()) {
+        return result;
     }
 
     // we will find lib.nas in nasal std directory
@@ -66,9 +148,12 @@ std::string linker::find_file(
             "use <-d> to get detail search path");
         return "";
     }
-    std::string paths = "";
-    for(const auto& i : fpath) {
-        paths += "  -> " + i + "\n";
+
+    // first add file name itself into the file path
+    // then generate search path from environ path
+    std::string paths = "  -> " + filename + "\n";
+    for(const auto& p : envpath) {
+        paths += "  -> " + p + (is_windows()? "\\":"/") + filename + "\n";
     }
     err.err("link",
         "in <" + location.file + ">: " +
@@ -130,20 +215,17 @@ bool linker::import_check(expr* node) {
 
 bool linker::exist(const std::string& file) {
     // avoid importing the same file
-    for(const auto& fname : files) {
-        if (file==fname) {
-            return true;
-        }
+    if (file_index.count(file)) {
+        return true;
     }
+    file_index[file] = static_cast<u16>(files.size());
     files.push_back(file);
     return false;
 }
 
 u16 linker::find(const std::string& file) {
-    for(usize i = 0; i<files.size(); ++i) {
-        if (files[i]==file) {
-            return static_cast<u16>(i);
-        }
+    if (file_index.count(file)) {
+        return file_index.at(file);
     }
     std::cerr << "unreachable: using this method incorrectly\n";
     std::exit(-1);
@@ -176,9 +258,335 @@ void linker::link(code_block* new_tree_root, code_block* old_tree_root) {
     old_tree_root->get_expressions().clear();
 }
 
-code_block* linker::import_regular_file(call_expr* node) {
+std::vector<std::string> linker::scan_imports(const std::string& filename) {
+    // only scan import statements at the beginning of the file,
+    // just the same as load(), this is only used to predict modules,
+    // so stop scanning when meeting anything unusual
+    std::vector<std::string> result;
+    std::ifstream in(filename, std::ios::binary);
+    if (in.fail()) {
+        return result;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const auto src = ss.str();
+
+    usize ptr = 0;
+    auto skip = [&]() {
+        while(ptr<src.length()) {
+            if (src[ptr]=='#') {
+                while(ptr<src.length() && src[ptr]!='\n') {
+                    ++ptr;
+                }
+            } else if (src[ptr]==' ' || src[ptr]=='\t' ||
+                src[ptr]=='\n' || src[ptr]=='\r') {
+                ++ptr;
+            } else {
+                break;
+            }
+        }
+    };
+    auto is_id_head = [](char c) {
+        return std::isalpha((unsigned char)c) || c=='_';
+    };
+    auto get_id = [&]() {
+        usize begin = ptr;
+        if (ptr<src.length() && is_id_head(src[ptr])) {
+            ++ptr;
+            while(ptr<src.length() &&
+                (is_id_head(src[ptr]) || std::isdigit((unsigned char)src[ptr]))) {
+                ++ptr;
+            }
+        }
+        return src.substr(begin, ptr-begin);
+    };
+
+    while(true) {
+        skip();
+        if (get_id()!="import") {
+            break;
+        }
+        skip();
+        std::string path = "";
+        if (ptr<src.length() && src[ptr]=='.') {
+            // import.xxx.xxx;
+            path = ".";
+            while(ptr<src.length() && src[ptr]=='.') {
+                ++ptr;
+                skip();
+                auto field = get_id();
+                if (!field.length()) {
+                    return result;
+                }
+                path += (is_windows()? "\\":"/") + field;
+                skip();
+            }
+            path += ".nas";
+        } else if (ptr<src.length() && src[ptr]=='(') {
+            // import("xxx");
+            ++ptr;
+            skip();
+            if (ptr>=src.length() || (src[ptr]!='\"' && src[ptr]!='\'')) {
+                return result;
+            }
+            const char quote = src[ptr++];
+            while(ptr<src.length() && src[ptr]!=quote) {
+                // escape sequence is rarely used in file path,
+                // leave it to parser
+                if (src[ptr]=='\\') {
+                    return result;
+                }
+                path += src[ptr++];
+            }
+            if (ptr>=src.length()) {
+                return result;
+            }
+            ++ptr;
+            skip();
+            if (ptr>=src.length() || src[ptr]!=')') {
+                return result;
+            }
+            ++ptr;
+            skip();
+        } else {
+            break;
+        }
+        if (ptr<src.length() && src[ptr]!=';') {
+            break;
+        }
+        ++ptr;
+        result.push_back(path);
+    }
+    return result;
+}
+
+void linker::predict_module(
+    const std::string& filename, bool is_lib,
+    std::vector<std::string>& stack, std::vector<std::string>& predicted) {
+    // self-referenced module will not be parsed
+    for(const auto& i : stack) {
+        if (i==filename) {
+            return;
+        }
+    }
+    if (predicted.size()>=MAX_PREDICTED_MODULES) {
+        return;
+    }
+    // lexer exits when opening a non-regular file,
+    // so leave it to load() to report the error in main thread
+    struct stat buffer;
+    if (stat(filename.c_str(), &buffer)!=0 || !S_ISREG(buffer.st_mode)) {
+        return;
+    }
+    predicted.push_back(filename);
+    // library is not in module load stack, see import_nasal_lib
+    if (!is_lib) {
+        stack.push_back(filename);
+    }
+    for(const auto& i : scan_imports(filename)) {
+        auto path = search_file(i);
+        if (path.length()) {
+            predict_module(path, false, stack, predicted);
+        }
+    }
+    if (!is_lib) {
+        stack.pop_back();
+    }
+}
+
+void linker::parallel_load(code_block* root) {
+    // predict modules that will be parsed in load(), in the same order
+    std::vector<std::string> predicted;
+    std::vector<std::string> stack = module_load_stack;
+    if (!lib_loaded) {
+        auto path = search_file("lib.nas");
+        if (!path.length()) {
+            path = search_file(is_windows()? "std\\lib.nas":"std/lib.nas");
+        }
+        if (path.length() && path!=this_file) {
+            predict_module(path, true, stack, predicted);
+        }
+    }
+    for(auto i : root->get_expressions()) {
+        if (!import_check(i)) {
+            break;
+        }
+        auto path = search_file(get_path((call_expr*)i));
+        if (path.length()) {
+            predict_module(path, false, stack, predicted);
+        }
+    }
+    // cached modules are not parsed again
+    if (module_cache::instance()->keep_modules) {
+        std::vector<std::string> uncached;
+        for(const auto& i : predicted) {
+            if (!is_cached_module(i)) {
+                uncached.push_back(i);
+            }
+        }
+        predicted = uncached;
+    }
+    if (!predicted.size()) {
+        return;
+    }
+
+    tasks.resize(predicted.size());
+    for(usize i = 0; i<predicted.size(); ++i) {
+        tasks[i] = {predicted[i], nullptr, true, ""};
+    }
+    // the last one in the list will be used first
+    for(usize i = predicted.size(); i>0; --i) {
+        pending_tasks[predicted[i-1]].push_back(i-1);
+    }
+
+    // lexer and parser do not share any state,
+    // so each module could be parsed in its own worker thread.
+    // lsp events are buffered, and will be printed when the module
+    // is used in load(), keeping the serial output order.
+    // opening a file and printing an error may exit, so worker reads
+    // the source itself and only counts errors, a failed module is
+    // parsed again by main thread in parse_module to report them
+    std::atomic<usize> next(0);
+    auto worker = [&]() {
+        for(usize i = next++; i<tasks.size(); i = next++) {
+            auto& task = tasks[i];
+            std::ifstream in(task.path, std::ios::binary);
+            if (in.fail()) {
+                continue;
+            }
+            std::stringstream source, events;
+            source << in.rdbuf();
+            lexer lex;
+            parse par;
+            lex.set_error_quiet(true);
+            par.set_error_quiet(true);
+            par.set_output(events);
+            par.set_parallel(false);
+            task.failed = lex.sscan(source.str(), task.path).geterr() ||
+                par.compile(lex).geterr();
+            task.tree = task.failed? nullptr:par.swap(nullptr);
+            task.events = events.str();
+        }
+    };
+
+    usize thread_count = std::thread::hardware_concurrency();
+    thread_count = std::max<usize>(1, std::min(thread_count, tasks.size()));
+    std::vector<std::thread> workers;
+    for(usize i = 1; i<thread_count; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for(auto& i : workers) {
+        i.join();
+    }
+}
+
+// modules are cached by absolute path without links, relative path
+// refers to another file after working directory is changed
+std::string module_key(const std::string& filename) {
+#ifdef _WIN32
+    char* full = _fullpath(nullptr, filename.c_str(), 0);
+#else
+    char* full = realpath(filename.c_str(), nullptr);
+#endif
+    if (!full) {
+        return filename;
+    }
+    std::string result = full;
+    free(full);
+    return result;
+}
+
+bool linker::is_cached_module(const std::string& filename) {
+    const auto& modules = module_cache::instance()->modules;
+    const auto key = module_key(filename);
+    if (!modules.count(key)) {
+        return false;
+    }
+    struct stat buffer;
+    if (stat(filename.c_str(), &buffer)!=0) {
+        return false;
+    }
+    const auto& cached = modules.at(key);
+    return cached.mtime==static_cast<i64>(buffer.st_mtime) &&
+        cached.size==static_cast<i64>(buffer.st_size);
+}
+
+void linker::cache_module(
+    const std::string& filename, code_block* tree, const std::string& events) {
+    auto cache = module_cache::instance();
+    if (!cache->keep_modules) {
+        return;
+    }
+    struct stat buffer;
+    if (stat(filename.c_str(), &buffer)!=0) {
+        return;
+    }
+    // mtime is in seconds, a file written again in this second may keep
+    // the same mtime and size, so do not cache a file changed just now
+    const auto now = static_cast<i64>(std::time(nullptr));
+    if (static_cast<i64>(buffer.st_mtime)>=now-1) {
+        cache->modules.erase(module_key(filename));
+        return;
+    }
+    cache->modules[module_key(filename)] = {
+        static_cast<i64>(buffer.st_mtime),
+        static_cast<i64>(buffer.st_size),
+        ast_serializer().serialize(tree),
+        events
+    };
+}
+
+bool linker::parse_module(const std::string& filename, code_block*& tree) {
+    tree = nullptr;
+    // module is not changed since last parsed, rebuild it from cache.
+    // if cache is broken, just parse it again
+    if (module_cache::instance()->keep_modules && is_cached_module(filename)) {
+        const auto key = module_key(filename);
+        const auto& cached = module_cache::instance()->modules.at(key);
+        tree = ast_deserializer().deserialize(cached.ast);
+        if (tree) {
+            *out << cached.events;
+            return true;
+        }
+        module_cache::instance()->modules.erase(key);
+    }
+
+    // use the module parsed ahead if there is one
+    if (pending_tasks.count(filename) && pending_tasks.at(filename).size()) {
+        auto& task = tasks[pending_tasks.at(filename).back()];
+        pending_tasks.at(filename).pop_back();
+        if (!task.failed) {
+            *out << task.events;
+            std::swap(tree, task.tree);
+            cache_module(filename, tree, task.events);
+            return true;
+        }
+    }
+
+    // failed to predict or parse this module ahead, parse it now
     lexer lex;
     parse par;
+    std::stringstream events;
+    if (module_cache::instance()->keep_modules) {
+        par.set_output(events);
+    } else {
+        par.set_output(*out);
+    }
+    if (lex.scan(filename).geterr()) {
+        return false;
+    }
+    auto failed = par.compile(lex).geterr();
+    *out << events.str();
+    if (failed) {
+        return false;
+    }
+    tree = par.swap(nullptr);
+    cache_module(filename, tree, events.str());
+    return true;
+}
+
+code_block* linker::import_regular_file(call_expr* node) {
     // get filename
     auto filename = get_path(node);
     // clear this node
@@ -206,18 +614,14 @@ code_block* linker::import_regular_file(call_expr* node) {
     }
     exist(filename);
     
-    module_load_stack.push_back(filename);
     // start importing...
-    if (lex.scan(filename).geterr()) {
-        err.err("link", "error occurred when analysing <" + filename + ">");
-        return new code_block({0, 0, 0, 0, filename});
-    }
-    if (par.compile(lex).geterr())  {
+    code_block* parse_result = nullptr;
+    if (!parse_module(filename, parse_result)) {
         err.err("link", "error occurred when analysing <" + filename + ">");
         return new code_block({0, 0, 0, 0, filename});
     }
 
-    auto parse_result = par.swap(nullptr);
+    module_load_stack.push_back(filename);
 
     // check if parse result has 'import'
     auto result = load(parse_result, find(filename));
@@ -226,8 +630,6 @@ code_block* linker::import_regular_file(call_expr* node) {
 }
 
 code_block* linker::import_nasal_lib() {
-    lexer lex;
-    parse par;
     auto filename = find_file("lib.nas", {0, 0, 0, 0, files[0]});
     if (!filename.length()) {
         return new code_block({0, 0, 0, 0, filename});
@@ -240,20 +642,13 @@ code_block* linker::import_nasal_lib() {
     }
     
     // start importing...
-    if (lex.scan(filename).geterr()) {
+    code_block* parse_result = nullptr;
+    if (!parse_module(filename, parse_result)) {
         err.err("link",
             "error occurred when analysing library <" + filename + ">"
         );
         return new code_block({0, 0, 0, 0, filename});
     }
-    if (par.compile(lex).geterr())  {
-        err.err("link",
-            "error occurred when analysing library <" + filename + ">"
-        );
-        return new code_block({0, 0, 0, 0, filename});
-    }
-
-    auto parse_result = par.swap(nullptr);
     // check if library has 'import' (in fact it should not)
     return load(parse_result, find(filename));
 }
@@ -393,13 +788,26 @@ const error& linker::link(
     // initializing file map
     this_file = self;
     files = {self};
+    file_index = {{self, 0}};
     module_load_stack = {self};
+    // files may be created since last link
+    directory_mtime.clear();
+    // lex and parse imported modules in worker threads first
+    if (parallel) {
+        parallel_load(parse.tree());
+    }
     // scan root and import files
     // then generate a new ast and return to import_ast
     // the main file's index is 0
     auto new_tree_root = load(parse.tree(), 0);
     auto old_tree_root = parse.swap(new_tree_root);
     delete old_tree_root;
+    // clear modules that are predicted but not used
+    for(auto& i : tasks) {
+        delete i.tree;
+    }
+    tasks.clear();
+    pending_tasks.clear();
     return err;
 }
 
@@ -6,6 +6,7 @@
 #define _CRT_SECURE_NO_DEPRECATE 1
 #define _CRT_NONSTDC_NO_DEPRECATE 1
 #include <io.h>
+#include <direct.h>
 #endif
 
 #ifdef _MSC_VER
@@ -18,20 +19,73 @@
 #include "nasal_parse.h"
 #include "symbol_finder.h"
 
+#include <unordered_map>
 #include <vector>
 
 namespace nasal {
 
+// resolved import paths and parsed modules shared by all linkers,
+// so they are kept across runs in repl or server mode
+struct module_cache {
+    struct module {
+        i64 mtime;
+        i64 size;
+        std::string ast;    // serialized by ast_serializer
+        std::string events; // lsp events generated by parser
+    };
+
+    struct resolution {
+        std::string path;
+        // directories searched before the file is found and their mtime,
+        // creating a file in one of them changes the mtime
+        std::vector<std::pair<std::string, i64>> missed;
+    };
+
+    // working directory and search paths when paths are resolved
+    std::string search_key = "";
+    // import path -> file path found in file system
+    std::unordered_map<std::string, resolution> resolved;
+    // parsed modules are only kept when this flag is set, by `nasal -r`
+    bool keep_modules = false;
+    // canonical file path -> parsed module,
+    // relative paths are resolved against working directory when cached
+    std::unordered_map<std::string, module> modules;
+
+    // singleton
+    static module_cache* instance() {
+        static module_cache cache;
+        return &cache;
+    }
+};
+
 class linker {
+private:
+    // module lexed and parsed ahead by worker threads
+    struct module_task {
+        std::string path;
+        code_block* tree;   // nullptr if failed or already used
+        bool failed;        // parsed again by main thread to report errors
+        std::string events; // lsp events generated by parser
+    };
+
 private:
     bool show_path;
     bool lib_loaded;
+    bool parallel; // lex and parse predicted modules in worker threads
     std::string this_file;
     std::string lib_path;
     error err;
+    std::ostream* out; // lsp events of modules, std::cout by default
     std::vector<std::string> files;
+    // file path -> index in files
+    std::unordered_map<std::string, u16> file_index;
     std::vector<std::string> module_load_stack;
     std::vector<std::string> envpath;
+    // directory -> mtime, each directory is checked once in a link
+    std::unordered_map<std::string, i64> directory_mtime;
+    std::vector<module_task> tasks;
+    // path -> tasks not used yet, the last one is used first
+    std::unordered_map<std::string, std::vector<usize>> pending_tasks;
 
 private:
     bool import_check(expr*);
@@ -41,7 +95,18 @@ private:
     std::string generate_self_import_path(const std::string&);
     void link(code_block*, code_block*);
     std::string get_path(call_expr*);
+    void check_search_key();
+    i64 directory_state(const std::string&);
+    std::string search_file(const std::string&);
     std::string find_file(const std::string&, const span&);
+    std::vector<std::string> scan_imports(const std::string&);
+    void predict_module(
+        const std::string&, bool,
+        std::vector<std::string>&, std::vector<std::string>&);
+    void parallel_load(code_block*);
+    bool is_cached_module(const std::string&);
+    void cache_module(const std::string&, code_block*, const std::string&);
+    bool parse_module(const std::string&, code_block*&);
     code_block* import_regular_file(call_expr*);
     code_block* import_nasal_lib();
     std::string generate_module_name(const std::string&);
@@ -52,6 +117,8 @@ private:
 public:
     linker();
     const error& link(parse&, const std::string&, bool);
+    void set_output(std::ostream& s) {out = &s;}
+    void set_parallel(bool flag) {parallel = flag;}
     const auto& get_file_list() const {return files;}
     const auto& get_this_file() const {return this_file;}
     const auto& get_lib_path() const {return lib_path;}
@@ -0,0 +1,698 @@
+#include "nasal_jit.h"
+
+#ifdef NASAL_JIT
+
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace nasal {
+
+// default layout: type tag at offset 0, 8-byte union at offset 8
+static_assert(sizeof(var)==16, "jit needs the 16 bytes var layout");
+const i32 var_size = 16;
+const i32 value_offset = 8;
+
+const i32 context_pc = offsetof(context, pc);
+const i32 context_localr = offsetof(context, localr);
+const i32 context_memr = offsetof(context, memr);
+const i32 context_canary = offsetof(context, canary);
+const i32 context_top = offsetof(context, top);
+
+// addsd, subsd, mulsd, divsd
+const u8 sse_arithmetic[] = {0x58, 0x5c, 0x59, 0x5e};
+
+void jit::emit32(u32 num) {
+    for(u32 i = 0; i<4; ++i) {
+        emit((num>>(i*8))&0xff);
+    }
+}
+
+void jit::emit64(u64 num) {
+    emit32(num&0xffffffff);
+    emit32(num>>32);
+}
+
+void jit::rex(bool wide, u8 field, u8 base) {
+    const u8 prefix = 0x40|(wide? 8:0)|(field&8? 4:0)|(base&8? 1:0);
+    if (prefix!=0x40) {
+        emit(prefix);
+    }
+}
+
+// [base+disp32], rsp and r12 as base need sib byte
+void jit::modrm_memory(u8 field, u8 base, i32 disp) {
+    emit(0x80|((field&7)<<3)|(base&7));
+    if ((base&7)==rsp) {
+        emit(0x24);
+    }
+    emit32(disp);
+}
+
+void jit::modrm_register(u8 field, u8 rm) {
+    emit(0xc0|((field&7)<<3)|(rm&7));
+}
+
+void jit::load(u8 dst, u8 base, i32 disp) {
+    rex(true, dst, base);
+    emit(0x8b);
+    modrm_memory(dst, base, disp);
+}
+
+void jit::load32(u8 dst, u8 base, i32 disp) {
+    rex(false, dst, base);
+    emit(0x8b);
+    modrm_memory(dst, base, disp);
+}
+
+void jit::store(u8 base, i32 disp, u8 src) {
+    rex(true, src, base);
+    emit(0x89);
+    modrm_memory(src, base, disp);
+}
+
+void jit::store_byte(u8 base, i32 disp, u8 imm) {
+    rex(false, 0, base);
+    emit(0xc6);
+    modrm_memory(0, base, disp);
+    emit(imm);
+}
+
+void jit::store_dword(u8 base, i32 disp, u32 imm) {
+    rex(false, 0, base);
+    emit(0xc7);
+    modrm_memory(0, base, disp);
+    emit32(imm);
+}
+
+void jit::store_qword(u8 base, i32 disp, i32 imm) {
+    rex(true, 0, base);
+    emit(0xc7);
+    modrm_memory(0, base, disp);
+    emit32(imm);
+}
+
+void jit::lea(u8 dst, u8 base, i32 disp) {
+    rex(true, dst, base);
+    emit(0x8d);
+    modrm_memory(dst, base, disp);
+}
+
+void jit::move(u8 dst, u8 src) {
+    rex(true, src, dst);
+    emit(0x89);
+    modrm_register(src, dst);
+}
+
+void jit::move_imm(u8 dst, u64 imm) {
+    rex(true, 0, dst);
+    emit(0xb8|(dst&7));
+    emit64(imm);
+}
+
+void jit::move_imm32(u8 dst, u32 imm) {
+    rex(false, 0, dst);
+    emit(0xb8|(dst&7));
+    emit32(imm);
+}
+
+void jit::add_imm(u8 dst, i32 imm) {
+    rex(true, 0, dst);
+    emit(0x81);
+    modrm_register(0, dst);
+    emit32(imm);
+}
+
+void jit::sub_imm(u8 dst, i32 imm) {
+    rex(true, 0, dst);
+    emit(0x81);
+    modrm_register(5, dst);
+    emit32(imm);
+}
+
+void jit::xor_register(u8 dst, u8 src) {
+    rex(true, src, dst);
+    emit(0x31);
+    modrm_register(src, dst);
+}
+
+void jit::compare(u8 field, u8 base, i32 disp) {
+    rex(true, field, base);
+    emit(0x3b);
+    modrm_memory(field, base, disp);
+}
+
+void jit::compare_byte(u8 base, i32 disp, u8 imm) {
+    rex(false, 0, base);
+    emit(0x80);
+    modrm_memory(7, base, disp);
+    emit(imm);
+}
+
+void jit::compare_eax(u32 imm) {
+    emit(0x3d);
+    emit32(imm);
+}
+
+void jit::push(u8 operand) {
+    rex(false, 0, operand);
+    emit(0x50|(operand&7));
+}
+
+void jit::pop(u8 operand) {
+    rex(false, 0, operand);
+    emit(0x58|(operand&7));
+}
+
+void jit::call(u8 operand) {
+    rex(false, 0, operand);
+    emit(0xff);
+    modrm_register(2, operand);
+}
+
+// sse instruction with xmm register and memory operand
+void jit::sse(u8 prefix, u8 opcode, u8 xmm, u8 base, i32 disp) {
+    emit(prefix);
+    rex(false, xmm, base);
+    emit(0x0f);
+    emit(opcode);
+    modrm_memory(xmm, base, disp);
+}
+
+void jit::sse_register(u8 prefix, u8 opcode, u8 dst, u8 src) {
+    emit(prefix);
+    emit(0x0f);
+    emit(opcode);
+    modrm_register(dst, src);
+}
+
+void jit::movq(u8 xmm, u8 src) {
+    emit(0x66);
+    rex(true, xmm, src);
+    emit(0x0f);
+    emit(0x6e);
+    modrm_register(xmm, src);
+}
+
+void jit::cmov(u8 cc, u8 dst, u8 src) {
+    rex(true, dst, src);
+    emit(0x0f);
+    emit(0x40|cc);
+    modrm_register(dst, src);
+}
+
+// rel32 is filled after all opcodes are emitted
+void jit::jump(u8 cc, u32 pc, target kind) {
+    if (cc==cc_always) {
+        emit(0xe9);
+    } else {
+        emit(0x0f);
+        emit(0x80|cc);
+    }
+    fixups.push_back({static_cast<u32>(buffer.size()), pc, kind});
+    if (kind==target::slow_path) {
+        has_slow_path[pc-begin] = true;
+    } else if (kind==target::overflow) {
+        has_overflow_check[pc-begin] = true;
+    }
+    emit32(0);
+}
+
+// epilogue is at the beginning of each chunk
+void jit::jump_epilogue(u8 cc) {
+    if (cc==cc_always) {
+        emit(0xe9);
+    } else {
+        emit(0x0f);
+        emit(0x80|cc);
+    }
+    emit32(-static_cast<i32>(buffer.size()+4));
+}
+
+void jit::guard_number(u8 base, i32 disp, u32 pc) {
+    compare_byte(base, disp, vm_num);
+    jump(cc_ne, pc, target::slow_path);
+}
+
+// interpreter checks stack top after each opcode
+void jit::check_stack(u32 pc) {
+    compare(r14, rbx, context_canary);
+    jump(cc_ae, pc, target::overflow);
+}
+
+void jit::load_constant(u8 xmm, u32 index) {
+    u64 bits;
+    std::memcpy(&bits, const_number+index, sizeof(bits));
+    move_imm(rax, bits);
+    movq(xmm, rax);
+}
+
+void jit::store_number(u8 base, i32 disp) {
+    store_byte(base, disp, vm_num);
+    sse(0xf2, 0x11, 0, base, disp+value_offset);
+}
+
+// compare xmm0 with xmm1 and return the condition of true result,
+// unordered sets CF so NaN is always false, like the interpreter
+u8 jit::compare_flags(u8 index) {
+    // ucomisd, less and leq are checked as right>left and right>=left
+    if (index<2) {
+        sse_register(0x66, 0x2e, 1, 0);
+    } else {
+        sse_register(0x66, 0x2e, 0, 1);
+    }
+    return index%2? cc_ae:cc_a;
+}
+
+void jit::compare_result(u8 index, u8 base, i32 disp) {
+    // xor changes flags, so do it before ucomisd
+    xor_register(rax, rax);
+    move_imm(rcx, 0x3ff0000000000000ull); // 1.0
+    cmov(compare_flags(index), rax, rcx);
+    store_byte(base, disp, vm_num);
+    store(base, disp+value_offset, rax);
+}
+
+void jit::compare_branch(u8 index, u32 true_pc, u32 false_pc) {
+    jump(compare_flags(index), true_pc);
+    jump(cc_always, false_pc);
+}
+
+// memr[0] = memr[0] op right, right is top[-1] or a constant in xmm1,
+// result is also written to the top of stack
+void jit::calculate_memory(u32 pc, u8 index, bool constant) {
+    load(rcx, rbx, context_memr);
+    guard_number(rcx, 0, pc);
+    sse(0xf2, 0x10, 0, rcx, value_offset);
+    if (constant) {
+        load_constant(1, code[pc].num);
+        sse_register(0xf2, sse_arithmetic[index], 0, 1);
+    } else {
+        guard_number(r14, -var_size, pc);
+        sse(0xf2, sse_arithmetic[index], 0, r14, value_offset-var_size);
+    }
+    store_number(rcx, 0);
+    store_number(r14, constant? 0:-var_size);
+    store_qword(rbx, context_memr, 0);
+}
+
+// possible pc after interpreter handler of this opcode
+std::vector<u32> jit::successors(u32 pc) {
+    const auto& op = code[pc];
+    switch(op.op) {
+        case op_jt: case op_jf:
+        case op_findex: case op_feach: return {pc+1, op.num};
+        case op_lcmpjf: case op_gcmpjf: return {pc+3, code[pc+2].num};
+        case op_lcalc: case op_gcalc: return {pc+2};
+        case op_lloop: case op_gloop: {
+            const auto check = code[pc+2].num;
+            return {check+3, code[check+2].num};
+        }
+        case op_callfv: case op_callfh:
+        case op_tcallfv: case op_ret: return {};
+        default: break;
+    }
+    return {pc+1};
+}
+
+// grow stack or report overflow after this opcode, like the interpreter,
+// then return to interpreter because stack may be moved
+void jit::report_overflow(u32 pc) {
+    store(rbx, context_top, r14);
+    store_dword(rbx, context_pc, pc);
+    move(rdi, r12);
+    move_imm(rax, reinterpret_cast<u64>(stack_overflow));
+    call(rax);
+    jump_epilogue(cc_always);
+}
+
+// return to interpreter, which will execute this opcode
+void jit::exit_before(u32 pc) {
+    store(rbx, context_top, r14);
+    store_dword(rbx, context_pc, pc-1);
+    jump_epilogue(cc_always);
+}
+
+// run this opcode in interpreter, then go on if pc is a known successor
+// and context is not changed by coroutine
+void jit::call_interpreter(u32 pc) {
+    store(rbx, context_top, r14);
+    store_dword(rbx, context_pc, pc);
+    move(rdi, r12);
+    move_imm32(rsi, code[pc].op);
+    move_imm(rax, reinterpret_cast<u64>(call_handler));
+    call(rax);
+    load(r14, rbx, context_top);
+    check_stack(pc);
+
+    const auto next = successors(pc);
+    if (next.empty()) {
+        jump_epilogue(cc_always);
+        return;
+    }
+    compare(r13, rbx, context_localr);
+    jump_epilogue(cc_ne);
+    load32(rax, rbx, context_pc);
+    if (next.size()==1 && next[0]==pc+1) {
+        compare_eax(pc);
+        jump_epilogue(cc_ne);
+        jump(cc_always, pc+1);
+        return;
+    }
+    for(auto i : next) {
+        if (begin<=i && i<end) {
+            compare_eax(i-1);
+            jump(cc_e, i);
+        }
+    }
+    jump_epilogue(cc_always);
+}
+
+void jit::compile_opcode(u32 pc) {
+    const auto& op = code[pc];
+    const u32 num = op.num;
+    switch(op.op) {
+        case op_exit:
+            has_entry[pc-begin] = false;
+            exit_before(pc);
+            return;
+        case op_pnum:
+            add_imm(r14, var_size);
+            store_byte(r14, 0, vm_num);
+            load_constant(0, num);
+            sse(0xf2, 0x11, 0, r14, value_offset);
+            check_stack(pc);
+            return;
+        case op_pnil:
+            add_imm(r14, var_size);
+            store_byte(r14, 0, vm_nil);
+            store_qword(r14, value_offset, 0);
+            check_stack(pc);
+            return;
+        case op_pop:
+            sub_imm(r14, var_size);
+            return;
+        case op_calll:
+        case op_callg:
+            sse(0xf3, 0x6f, 0, op.op==op_calll? r13:r15, num*var_size);
+            add_imm(r14, var_size);
+            sse(0xf3, 0x7f, 0, r14, 0);
+            check_stack(pc);
+            return;
+        case op_loadl:
+        case op_loadg:
+            sse(0xf3, 0x6f, 0, r14, 0);
+            sse(0xf3, 0x7f, 0, op.op==op_loadl? r13:r15, num*var_size);
+            sub_imm(r14, var_size);
+            return;
+        case op_mcalll:
+        case op_mcallg:
+            lea(rax, op.op==op_mcalll? r13:r15, num*var_size);
+            store(rbx, context_memr, rax);
+            sse(0xf3, 0x6f, 0, rax, 0);
+            add_imm(r14, var_size);
+            sse(0xf3, 0x7f, 0, r14, 0);
+            check_stack(pc);
+            return;
+        case op_meq:
+            load(rax, rbx, context_memr);
+            sse(0xf3, 0x6f, 0, r14, -var_size);
+            sse(0xf3, 0x7f, 0, rax, 0);
+            store_qword(rbx, context_memr, 0);
+            sub_imm(r14, (num+1)*var_size);
+            return;
+        // quickened opcodes use the same template, guards are still needed
+        // because native code outlives the quickening
+        case op_add: case op_sub: case op_mul: case op_div:
+        case op_addn: case op_subn: case op_muln: case op_divn: {
+            const u32 index = op.op>=op_addn? op.op-op_addn:op.op-op_add;
+            guard_number(r14, -var_size, pc);
+            guard_number(r14, 0, pc);
+            sse(0xf2, 0x10, 0, r14, value_offset-var_size);
+            sse(0xf2, sse_arithmetic[index], 0, r14, value_offset);
+            sse(0xf2, 0x11, 0, r14, value_offset-var_size);
+            sub_imm(r14, var_size);
+            return;
+        }
+        case op_addc: case op_subc: case op_mulc: case op_divc:
+            guard_number(r14, 0, pc);
+            sse(0xf2, 0x10, 0, r14, value_offset);
+            load_constant(1, num);
+            sse_register(0xf2, sse_arithmetic[op.op-op_addc], 0, 1);
+            sse(0xf2, 0x11, 0, r14, value_offset);
+            return;
+        case op_usub:
+            guard_number(r14, 0, pc);
+            load(rax, r14, value_offset);
+            move_imm(rcx, 1ull<<63);
+            xor_register(rax, rcx);
+            store(r14, value_offset, rax);
+            return;
+        case op_addeq: case op_subeq: case op_muleq: case op_diveq:
+            calculate_memory(pc, op.op-op_addeq, false);
+            sub_imm(r14, (num+1)*var_size);
+            return;
+        case op_addeqc: case op_subeqc: case op_muleqc: case op_diveqc:
+            calculate_memory(pc, op.op-op_addeqc, true);
+            return;
+        case op_addecp: case op_subecp: case op_mulecp: case op_divecp:
+            calculate_memory(pc, op.op-op_addecp, true);
+            sub_imm(r14, var_size);
+            return;
+        case op_less: case op_leq: case op_grt: case op_geq:
+        case op_lessn: case op_leqn: case op_grtn: case op_geqn: {
+            const u32 index = op.op>=op_lessn? op.op-op_lessn:op.op-op_less;
+            guard_number(r14, -var_size, pc);
+            guard_number(r14, 0, pc);
+            sse(0xf2, 0x10, 0, r14, value_offset-var_size);
+            sse(0xf2, 0x10, 1, r14, value_offset);
+            compare_result(index, r14, -var_size);
+            sub_imm(r14, var_size);
+            return;
+        }
+        case op_lessc: case op_leqc: case op_grtc: case op_geqc:
+            guard_number(r14, 0, pc);
+            sse(0xf2, 0x10, 0, r14, value_offset);
+            load_constant(1, num);
+            compare_result(op.op-op_lessc, r14, 0);
+            return;
+        case op_jmp:
+            jump(cc_always, num);
+            return;
+        case op_jt:
+        case op_jf:
+            guard_number(r14, 0, pc);
+            sse(0xf2, 0x10, 0, r14, value_offset);
+            if (op.op==op_jf) {
+                sub_imm(r14, var_size);
+            }
+            sse_register(0x66, 0x57, 1, 1); // xorpd
+            sse_register(0x66, 0x2e, 0, 1);
+            // NaN is true
+            if (op.op==op_jt) {
+                jump(cc_p, num);
+                jump(cc_ne, num);
+            } else {
+                emit(0x7a); // jp over je rel32
+                emit(6);
+                jump(cc_e, num);
+            }
+            return;
+        case op_lcmpjf:
+        case op_gcmpjf: {
+            const auto& cmp = code[pc+1];
+            const auto base = op.op==op_lcmpjf? r13:r15;
+            guard_number(base, num*var_size, pc);
+            sse(0xf2, 0x10, 0, base, num*var_size+value_offset);
+            load_constant(1, cmp.num);
+            compare_branch(cmp.op-op_lessc, pc+3, code[pc+2].num);
+            return;
+        }
+        case op_lcalc:
+        case op_gcalc: {
+            const auto& calc = code[pc+1];
+            const auto base = op.op==op_lcalc? r13:r15;
+            guard_number(base, num*var_size, pc);
+            sse(0xf2, 0x10, 0, base, num*var_size+value_offset);
+            load_constant(1, calc.num);
+            sse_register(0xf2, sse_arithmetic[calc.op-op_addecp], 0, 1);
+            sse(0xf2, 0x11, 0, base, num*var_size+value_offset);
+            jump(cc_always, pc+2);
+            return;
+        }
+        case op_lloop:
+        case op_gloop: {
+            const auto& step = code[pc+1];
+            const auto check = code[pc+2].num;
+            const auto& cmp = code[check+1];
+            const auto base = op.op==op_lloop? r13:r15;
+            guard_number(base, num*var_size, pc);
+            sse(0xf2, 0x10, 0, base, num*var_size+value_offset);
+            load_constant(1, step.num);
+            sse_register(0xf2, sse_arithmetic[step.op-op_addecp], 0, 1);
+            sse(0xf2, 0x11, 0, base, num*var_size+value_offset);
+            load_constant(1, cmp.num);
+            compare_branch(cmp.op-op_lessc, check+3, code[check+2].num);
+            return;
+        }
+        default: break;
+    }
+    call_interpreter(pc);
+}
+
+u8* jit::install() {
+    const usize page = sysconf(_SC_PAGESIZE);
+    const usize size = (buffer.size()+page-1)/page*page;
+    void* memory = mmap(nullptr, size, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (memory==MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(memory, buffer.data(), buffer.size());
+    if (mprotect(memory, size, PROT_READ|PROT_EXEC)) {
+        munmap(memory, size);
+        return nullptr;
+    }
+    chunks.push_back({static_cast<u8*>(memory), size});
+    return static_cast<u8*>(memory);
+}
+
+// rbx: context, r12: vm, r13: localr, r14: top, r15: global
+void jit::emit_prologue() {
+    push(rbp);
+    push(rbx);
+    push(r12);
+    push(r13);
+    push(r14);
+    push(r15);
+    // align stack to 16 bytes for calls
+    sub_imm(rsp, 8);
+    move(rbx, rdi);
+    move(r12, rsi);
+    load(r13, rbx, context_localr);
+    load(r14, rbx, context_top);
+    move_imm(r15, reinterpret_cast<u64>(global));
+    // jmp rdx
+    emit(0xff);
+    modrm_register(4, rdx);
+}
+
+void jit::emit_epilogue() {
+    add_imm(rsp, 8);
+    pop(r15);
+    pop(r14);
+    pop(r13);
+    pop(r12);
+    pop(rbx);
+    pop(rbp);
+    emit(0xc3);
+}
+
+void jit::init(const opcode* bytecode,
+               usize size,
+               const f64* number,
+               var* global_space,
+               handler function,
+               error_handler overflow) {
+    clear();
+    code = bytecode;
+    code_size = size;
+    const_number = number;
+    global = global_space;
+    call_handler = function;
+    stack_overflow = overflow;
+    entry.assign(size, nullptr);
+    hotness_count.assign(size, 0);
+
+    buffer.clear();
+    emit_prologue();
+    prologue = install();
+}
+
+void jit::clear() {
+    for(const auto& i : chunks) {
+        munmap(i.memory, i.size);
+    }
+    chunks.clear();
+    entry.clear();
+    hotness_count.clear();
+    prologue = nullptr;
+}
+
+void jit::compile(u32 range_begin, u32 range_end) {
+    if (!prologue || range_begin>=range_end || range_end>code_size) {
+        return;
+    }
+    begin = range_begin;
+    end = range_end;
+    buffer.clear();
+    fixups.clear();
+    label.assign(end-begin, 0);
+    slow_label.assign(end-begin, 0);
+    overflow_label.assign(end-begin, 0);
+    has_entry.assign(end-begin, true);
+    has_slow_path.assign(end-begin, false);
+    has_overflow_check.assign(end-begin, false);
+
+    emit_epilogue();
+    for(u32 pc = begin; pc<end; ++pc) {
+        label[pc-begin] = buffer.size();
+        compile_opcode(pc);
+    }
+    // fall through the end of range
+    jump(cc_always, end);
+
+    // failed guards run the opcode in interpreter
+    for(u32 pc = begin; pc<end; ++pc) {
+        if (has_slow_path[pc-begin]) {
+            slow_label[pc-begin] = buffer.size();
+            call_interpreter(pc);
+        }
+    }
+    for(u32 pc = begin; pc<end; ++pc) {
+        if (has_overflow_check[pc-begin]) {
+            overflow_label[pc-begin] = buffer.size();
+            report_overflow(pc);
+        }
+    }
+
+    // jump out of this range returns to interpreter
+    std::unordered_map<u32, u32> exit_stub;
+    for(usize i = 0; i<fixups.size(); ++i) {
+        const auto position = fixups[i].position;
+        const auto pc = fixups[i].pc;
+        u32 destination = 0;
+        if (fixups[i].kind==target::slow_path) {
+            destination = slow_label[pc-begin];
+        } else if (fixups[i].kind==target::overflow) {
+            destination = overflow_label[pc-begin];
+        } else if (begin<=pc && pc<end) {
+            destination = label[pc-begin];
+        } else {
+            if (!exit_stub.count(pc)) {
+                exit_stub[pc] = buffer.size();
+                exit_before(pc);
+            }
+            destination = exit_stub.at(pc);
+        }
+        const i32 offset = destination-(position+4);
+        std::memcpy(buffer.data()+position, &offset, sizeof(offset));
+    }
+
+    auto memory = install();
+    if (!memory) {
+        return;
+    }
+    for(u32 pc = begin; pc<end; ++pc) {
+        if (has_entry[pc-begin]) {
+            entry[pc] = memory+label[pc-begin];
+        }
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+
+#ifdef NASAL_JIT
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "NASAL_JIT only supports x86-64 linux"
+#endif
+#ifdef NASAL_NAN_BOXING
+#error "NASAL_JIT only supports the default var layout"
+#endif
+
+#include "nasal.h"
+#include "nasal_type.h"
+#include "nasal_opcode.h"
+
+#include <vector>
+
+namespace nasal {
+
+// baseline template jit, compiles a range of bytecode into x86-64 code by
+// emitting a machine code template for each opcode.
+// native code shares context, stack and local scopes with the interpreter.
+// numeric opcodes have an unboxed fast path guarded by the type of var,
+// other opcodes and failed guards call the interpreter handler.
+// native code returns to the interpreter when pc leaves compiled code,
+// calls and returns always do so, then vm enters native code of callee
+class jit {
+public:
+    // native code runs one opcode by calling handler(vm, op)
+    typedef void (*handler)(void*, u32);
+    // called when stack top reaches canary, grows the stack or reports error
+    typedef void (*error_handler)(void*);
+    // calls of a function or iterations of a loop before compiling
+    static const u32 hot_threshold = 128;
+    // shorter functions are compiled only if they have a hot loop,
+    // entering and leaving native code costs more than running them
+    static const u32 min_function_size = 32;
+
+private:
+    enum reg: u8 {
+        rax = 0, rcx = 1, rdx = 2, rbx = 3,
+        rsp = 4, rbp = 5, rsi = 6, rdi = 7,
+        r12 = 12, r13 = 13, r14 = 14, r15 = 15
+    };
+    enum condition: u8 {
+        cc_ae = 0x3, cc_e = 0x4, cc_ne = 0x5,
+        cc_a = 0x7, cc_p = 0xa, cc_always = 0xff
+    };
+    struct chunk {
+        u8* memory;
+        usize size;
+    };
+    enum class target {
+        opcode,     // native code of pc
+        slow_path,  // run pc in interpreter after a failed guard
+        overflow    // grow stack or report overflow after pc
+    };
+    // rel32 at position jumps to the target of pc
+    struct fixup {
+        u32 position;
+        u32 pc;
+        target kind;
+    };
+
+    const opcode* code = nullptr;
+    usize code_size = 0;
+    const f64* const_number = nullptr;
+    var* global = nullptr;
+    handler call_handler = nullptr;
+    error_handler stack_overflow = nullptr;
+
+    std::vector<chunk> chunks;
+    // shared entry stub, saves registers and jumps to native code
+    u8* prologue = nullptr;
+    // native code of each opcode, nullptr if not compiled
+    std::vector<const u8*> entry;
+    // calls counted at function entries, iterations at back edges,
+    // closures made from the same function literal share the count
+    std::vector<u32> hotness_count;
+
+    // state of the range being compiled
+    u32 begin = 0;
+    u32 end = 0;
+    std::vector<u8> buffer;
+    std::vector<u32> label;
+    std::vector<u32> slow_label;
+    std::vector<u32> overflow_label;
+    std::vector<bool> has_entry;
+    std::vector<bool> has_slow_path;
+    std::vector<bool> has_overflow_check;
+    std::vector<fixup> fixups;
+
+private:
+    void emit(u8 byte) {buffer.push_back(byte);}
+    void emit32(u32);
+    void emit64(u64);
+    void rex(bool, u8, u8);
+    void modrm_memory(u8, u8, i32);
+    void modrm_register(u8, u8);
+
+    void load(u8, u8, i32);
+    void load32(u8, u8, i32);
+    void store(u8, i32, u8);
+    void store_byte(u8, i32, u8);
+    void store_dword(u8, i32, u32);
+    void store_qword(u8, i32, i32);
+    void lea(u8, u8, i32);
+    void move(u8, u8);
+    void move_imm(u8, u64);
+    void move_imm32(u8, u32);
+    void add_imm(u8, i32);
+    void sub_imm(u8, i32);
+    void xor_register(u8, u8);
+    void compare(u8, u8, i32);
+    void compare_byte(u8, i32, u8);
+    void compare_eax(u32);
+    void push(u8);
+    void pop(u8);
+    void call(u8);
+    void sse(u8, u8, u8, u8, i32);
+    void sse_register(u8, u8, u8, u8);
+    void movq(u8, u8);
+    void cmov(u8, u8, u8);
+    void jump(u8, u32, target kind = target::opcode);
+    void jump_epilogue(u8);
+
+    void guard_number(u8, i32, u32);
+    void check_stack(u32);
+    void load_constant(u8, u32);
+    void store_number(u8, i32);
+    u8 compare_flags(u8);
+    void compare_result(u8, u8, i32);
+    void compare_branch(u8, u32, u32);
+    void calculate_memory(u32, u8, bool);
+
+    std::vector<u32> successors(u32);
+    void report_overflow(u32);
+    void exit_before(u32);
+    void call_interpreter(u32);
+    void compile_opcode(u32);
+    u8* install();
+    void emit_prologue();
+    void emit_epilogue();
+
+public:
+    ~jit() {clear();}
+    void init(const opcode*, usize, const f64*, var*,
+              handler, error_handler);
+    void clear();
+    void compile(u32, u32);
+    u32& hotness(u32 pc) {return hotness_count[pc];}
+    const u8* find(u32 pc) const {
+        return pc<entry.size()? entry[pc]:nullptr;
+    }
+    void run(context* ctx, void* vm, const u8* native) const {
+        typedef void (*entry_point)(context*, void*, const u8*);
+        reinterpret_cast<entry_point>(prologue)(ctx, vm, native);
+    }
+};
+
+}
+
+#endif
@@ -339,13 +339,7 @@ token lexer::calc_opr() {
       {begin_line, begin_column, line, column, filename}, get_type(str), str};
 }
 
-const error &lexer::scan(const std::string &file) {
-  line = 1;
-  column = 0;
-  ptr = 0;
-  toks = {};
-  open(file);
-
+void lexer::tokenize() {
   while (ptr < res.size()) {
     while (ptr < res.size() && skip(res[ptr])) {
       // these characters will be ignored, and '\n' will cause ++line
@@ -358,6 +352,8 @@ const error &lexer::scan(const std::string &file) {
     if (ptr >= res.size()) {
       break;
     }
+    const auto token_begin = ptr;
+    const auto token_count = toks.size();
     if (is_id(res[ptr])) {
       toks.push_back(id_gen());
     } else if (is_dec(res[ptr])) {
@@ -375,6 +371,10 @@ const error &lexer::scan(const std::string &file) {
     } else {
       err_char();
     }
+    // comments and invalid characters are left in the gaps as trivia
+    if (lossless && toks.size() != token_count) {
+      trivias.push_back({0, token_begin, ptr, 0});
+    }
     if (invalid_char > 10) {
       err.err("lexer", "too many invalid characters, stop");
       break;
@@ -387,7 +387,46 @@ const error &lexer::scan(const std::string &file) {
     // if token sequence is empty, generate a default location
     toks.push_back({{line, column, line, column, filename}, tok::eof, "<eof>"});
   }
-  res = "";
+  if (lossless) {
+    trivias.push_back({0, res.size(), res.size(), res.size()});
+    gen_trivia();
+  }
+}
+
+void lexer::gen_trivia() {
+  // split every gap between two tokens at the first line break:
+  // the former part is trailing trivia of the previous token,
+  // the latter part is leading trivia of the next token
+  usize prev_end = 0;
+  for (usize i = 0; i < trivias.size(); ++i) {
+    auto &t = trivias[i];
+    if (!i) {
+      t.leading_begin = 0;
+    } else {
+      auto split = prev_end;
+      while (split < t.begin && res[split] != '\n') {
+        ++split;
+      }
+      auto &prev = trivias[i - 1];
+      prev.trailing_end = split < t.begin ? split + 1 : t.begin;
+      t.leading_begin = prev.trailing_end;
+    }
+    t.trailing_end = t.end;
+    prev_end = t.end;
+  }
+}
+
+const error &lexer::scan(const std::string &file) {
+  line = 1;
+  column = 0;
+  ptr = 0;
+  toks = {};
+  trivias = {};
+  open(file);
+  tokenize();
+  if (!lossless) {
+    res = "";
+  }
   return err;
 }
 
@@ -397,53 +436,16 @@ const error &lexer::sscan(const std::string &file,
   column = 0;
   ptr = 0;
   toks = {};
+  trivias = {};
   res = file;
 
   // set lexer filename that would be set in open(file)
   filename = filesname;
 
-  while (ptr < res.size()) {
-    while (ptr < res.size() && skip(res[ptr])) {
-      // these characters will be ignored, and '\n' will cause ++line
-      ++column;
-      if (res[ptr++] == '\n') {
-        ++line;
-        column = 0;
-      }
-    }
-    if (ptr >= res.size()) {
-      break;
-    }
-    if (is_id(res[ptr])) {
-      toks.push_back(id_gen());
-    } else if (is_dec(res[ptr])) {
-      toks.push_back(num_gen());
-    } else if (is_str(res[ptr])) {
-      toks.push_back(str_gen());
-    } else if (is_single_opr(res[ptr])) {
-      toks.push_back(single_opr());
-    } else if (res[ptr] == '.') {
-      toks.push_back(dots());
-    } else if (is_calc_opr(res[ptr])) {
-      toks.push_back(calc_opr());
-    } else if (res[ptr] == '#') {
-      skip_note();
-    } else {
-      err_char();
-    }
-    if (invalid_char > 10) {
-      err.err("lexer", "too many invalid characters, stop");
-      break;
-    }
-  }
-  if (toks.size()) {
-    // eof token's location is the last token's location
-    toks.push_back({toks.back().loc, tok::eof, "<eof>"});
-  } else {
-    // if token sequence is empty, generate a default location
-    toks.push_back({{line, column, line, column, filename}, tok::eof, "<eof>"});
+  tokenize();
+  if (!lossless) {
+    res = "";
   }
-  res = "";
   return err;
 }
 } // namespace nasal
@@ -90,6 +90,18 @@ struct token {
   token(const token &) = default;
 };
 
+// byte ranges of one token and the trivia around it, only generated when the
+// lexer runs in lossless mode. leading trivia is [leading_begin, begin),
+// token text is [begin, end), trailing trivia is [end, trailing_end).
+// trailing trivia ends after the first line break, the rest of the gap to the
+// next token is the next token's leading trivia.
+struct token_trivia {
+  usize leading_begin;
+  usize begin;
+  usize end;
+  usize trailing_end;
+};
+
 class lexer {
 private:
   u32 line;
@@ -102,6 +114,10 @@ private:
   u64 invalid_char;
   std::vector<token> toks;
 
+  // lossless mode keeps the source buffer and whitespace/comment ranges
+  bool lossless;
+  std::vector<token_trivia> trivias;
+
   const std::unordered_map<std::string, tok> typetbl{
       {"true", tok::tktrue},
       {"false", tok::tkfalse},
@@ -171,6 +187,8 @@ private:
   void err_char();
 
   void open(const std::string &);
+  void tokenize();
+  void gen_trivia();
   std::string utf8_gen();
   token id_gen();
   token num_gen();
@@ -181,10 +199,21 @@ private:
 
 public:
   lexer()
-      : line(1), column(0), ptr(0), filename(""), res(""), invalid_char(0) {}
+      : line(1), column(0), ptr(0), filename(""), res(""), invalid_char(0),
+        lossless(false) {}
   const error &sscan(const std::string &, const std::string &);
   const error &scan(const std::string &);
   const std::vector<token> &result() const { return toks; }
+  void set_error_output(std::ostream &s) { err.set_output(s); }
+  void set_error_quiet(bool flag) { err.set_quiet(flag); }
+
+  // lossless mode, used by formatter/refactoring tools through nasal_cst.h
+  void set_lossless(bool flag) { lossless = flag; }
+  bool is_lossless() const { return lossless; }
+  // source buffer, empty if not in lossless mode
+  const std::string &source() const { return res; }
+  // one trivia range for each token in result(), including eof
+  const std::vector<token_trivia> &trivia() const { return trivias; }
 };
 
 } // namespace nasal
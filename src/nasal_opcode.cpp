@@ -24,18 +24,24 @@ const char* opname[] = {
     "callvi", "callh ", "callfv", "callfh",
     "callb ", "slcbeg", "slcend", "slice ",
     "slice2", "mcallg", "mcalll", "mupval",
-    "mcallv", "mcallh", "ret   "
+    "mcallv", "mcallh", "lcmpjf", "gcmpjf",
+    "lcalc ", "gcalc ", "callnb", "lloop ",
+    "gloop ", "addn  ", "subn  ", "muln  ",
+    "divn  ", "lessn ", "leqn  ", "grtn  ",
+    "geqn  ", "tcallf", "ret   "
 };
 
 void codestream::set(
     const f64* number_list,
     const std::string* string_list,
     const nasal_builtin_table* native_table,
-    const std::string* file_list) {
+    const std::string* file_list,
+    const opcode_location* location_list) {
     const_number = number_list;
     const_string = string_list;
     natives = native_table;
     files = file_list;
+    locations = location_list;
 }
 
 void codestream::dump(std::ostream& out) const {
@@ -81,19 +87,28 @@ void codestream::dump(std::ostream& out) const {
             out << hex << "0x" << num << dec
                 << " (" << const_number[num] << ")"; break;
         case op_callvi: case op_newv:
-        case op_callfv: case op_repl:
+        case op_callfv: case op_tcallfv:
+        case op_repl:
         case op_intl: case op_findex:
         case op_feach: case op_newf:
         case op_jmp: case op_jt:
         case op_jf: case op_callg:
         case op_mcallg: case op_loadg:
         case op_calll: case op_mcalll:
-        case op_loadl:
+        case op_loadl: case op_lcmpjf:
+        case op_gcmpjf: case op_lcalc:
+        case op_gcalc: case op_lloop:
+        case op_gloop:
             out << hex << "0x" << num << dec; break;
         case op_callb:
             out << hex << "0x" << num << " <" << natives[num].name
                 << "@0x" << reinterpret_cast<u64>(natives[num].func)
                 << dec << ">"; break;
+        case op_callnb:
+            out << hex << "0x" << (num&0xffff) << " <"
+                << natives[num&0xffff].name
+                << "@0x" << reinterpret_cast<u64>(natives[num&0xffff].func)
+                << dec << "> argc " << (num>>16); break;
         case op_upval: case op_mupval:
         case op_loadu:
             out << hex << "0x" << ((num>>16)&0xffff)
@@ -110,8 +125,9 @@ void codestream::dump(std::ostream& out) const {
             }
             break;
     }
-    if (files) {
-        out << "(" << files[code.fidx] << ":" << code.line << ")";
+    if (files && locations) {
+        const auto& loc = locations[index];
+        out << "(" << files[loc.fidx] << ":" << loc.line << ")";
     }
 }
 
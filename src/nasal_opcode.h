@@ -94,19 +94,41 @@ enum op_code_type:u8 {
     op_mupval, // get memory space of value in closure
     op_mcallv, // get memory space of vec[index]
     op_mcallh, // get memory space of hash.label
+    op_lcmpjf, // calll+lessc/leqc/grtc/geqc+jf, generated by peephole
+    op_gcmpjf, // callg+lessc/leqc/grtc/geqc+jf, generated by peephole
+    op_lcalc,  // mcalll+addecp/subecp/mulecp/divecp, generated by peephole
+    op_gcalc,  // mcallg+addecp/subecp/mulecp/divecp, generated by peephole
+    op_callnb, // call native function with arguments on stack, high 16 as argc
+    op_lloop,  // counted loop: local += const, then check and jump back
+    op_gloop,  // counted loop: global += const, then check and jump back
+    op_addn,   // add quickened at runtime, both operands were numbers
+    op_subn,   // sub quickened at runtime
+    op_muln,   // mult quickened at runtime
+    op_divn,   // div quickened at runtime
+    op_lessn,  // < quickened at runtime
+    op_leqn,   // <= quickened at runtime
+    op_grtn,   // > quickened at runtime
+    op_geqn,   // >= quickened at runtime
+    op_tcallfv,// tail call, drop current frame before callfv
     op_ret     // return
 };
 
+// hot part of an instruction, the only part used by vm dispatch loop
 struct opcode {
     u8  op;   // opcode
-    u16 fidx; // source code file index
     u32 num;  // immediate num
-    u32 line; // location line of source code
     opcode() = default;
     opcode(const opcode&) = default;
     opcode& operator=(const opcode&) = default;
 };
 
+// cold part of an instruction, stored in a side table with the same index,
+// only used by debugger and error report
+struct opcode_location {
+    u16 fidx; // source code file index
+    u32 line; // location line of source code
+};
+
 class codestream {
 private:
     opcode code;
@@ -115,13 +137,15 @@ private:
     inline static const std::string* const_string = nullptr;
     inline static const nasal_builtin_table* natives = nullptr;
     inline static const std::string* files = nullptr;
+    inline static const opcode_location* locations = nullptr;
     
 public:
     codestream(const opcode& c, const u32 i): code(c), index(i) {}
     static void set(
         const f64*, const std::string*,
         const nasal_builtin_table*,
-        const std::string* file_list = nullptr
+        const std::string* file_list = nullptr,
+        const opcode_location* location_list = nullptr
     );
     void dump(std::ostream&) const;
 };
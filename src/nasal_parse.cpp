@@ -1,6 +1,11 @@
 #include "nasal_parse.h"
 #include "nasal_ast.h"
 
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+
 namespace nasal {
 const char LSP_DEFINITION = 1;
 const char LSP_DEFINITION_END = 1 << 1;
@@ -73,14 +78,47 @@ std::string lsploc(const span &s) {
   return out;
 }
 
+// files with fewer tokens in top-level function definitions than this
+// are parsed in one thread, starting threads costs more than parsing them
+const u32 PARALLEL_PARSE_THRESHOLD = 8192;
+
 const error &parse::compile(const lexer &lexer) {
   toks = lexer.result().data();
   ptr = in_func = in_loop = 0;
 
   root = new code_block(toks[0].loc);
 
+  std::vector<parallel_task> tasks;
+  if (parallel) {
+    find_parallel_tasks(tasks);
+    parallel_parse(tasks);
+  }
+
+  usize next_task = 0;
   while (!lookahead(tok::eof)) {
-    root->add_expression(expression());
+    // tasks skipped by the main thread are not statements actually
+    while (next_task < tasks.size() && tasks[next_task].begin < ptr) {
+      delete tasks[next_task++].node;
+    }
+    if (next_task < tasks.size() && tasks[next_task].begin == ptr &&
+        tasks[next_task].parsed) {
+      // emit lsp events in the original order, then splice the subtree
+      auto &done = tasks[next_task++];
+      *out << done.events;
+      std::string().swap(done.events);
+      ptr = done.end;
+      if (!done.node) {
+        // stream mode, subtree is freed by worker after parsing,
+        // function definition needs no semi check
+        if (lookahead(tok::semi)) {
+          match(tok::semi);
+        }
+        continue;
+      }
+      root->add_expression(done.node);
+    } else {
+      root->add_expression(expression());
+    }
     if (lookahead(tok::semi)) {
       match(tok::semi);
     } else if (need_semi_check(root->get_expressions().back()) &&
@@ -88,12 +126,168 @@ const error &parse::compile(const lexer &lexer) {
       // the last expression can be recognized without semi
       die(prevspan, "expected \";\" after this token");
     }
+    if (stream) {
+      // lsp events of this statement are already emitted
+      delete root->get_expressions().back();
+      root->get_expressions().pop_back();
+    }
+  }
+  for (; next_task < tasks.size(); ++next_task) {
+    delete tasks[next_task].node;
   }
   update_location(root);
   return err;
 }
 
+u32 parse::skip_function(u32 begin) {
+  // begin is the index of token `func`,
+  // return the index of the token after function body, 0 if failed
+  u32 end = begin + 1;
+  u32 depth = 0;
+  if (toks[end].type == tok::lcurve) {
+    do {
+      switch (toks[end].type) {
+      case tok::lcurve:
+      case tok::lbracket:
+      case tok::lbrace:
+        ++depth;
+        break;
+      case tok::rcurve:
+      case tok::rbracket:
+      case tok::rbrace:
+        --depth;
+        break;
+      case tok::eof:
+        return 0;
+      default:
+        break;
+      }
+      ++end;
+    } while (depth);
+  }
+  if (toks[end].type != tok::lbrace) {
+    return 0;
+  }
+  do {
+    switch (toks[end].type) {
+    case tok::lcurve:
+    case tok::lbracket:
+    case tok::lbrace:
+      ++depth;
+      break;
+    case tok::rcurve:
+    case tok::rbracket:
+    case tok::rbrace:
+      --depth;
+      break;
+    case tok::eof:
+      return 0;
+    default:
+      break;
+    }
+    ++end;
+  } while (depth);
+  return end;
+}
+
+void parse::find_parallel_tasks(std::vector<parallel_task> &tasks) {
+  // pre-pass to find this pattern at the beginning of a top-level statement:
+  //   var id = func(...) {...}
+  // and the function must be followed by `;`, `var` or eof,
+  // otherwise it may be a part of a larger expression like `func {}()`
+  u32 depth = 0;
+  u32 task_tokens = 0;
+  auto last = tok::semi;
+  for (u32 i = 0; toks[i].type != tok::eof; ++i) {
+    const auto type = toks[i].type;
+    if (!depth && type == tok::var &&
+        (last == tok::semi || last == tok::rbrace) &&
+        toks[i + 1].type == tok::id && toks[i + 2].type == tok::eq &&
+        toks[i + 3].type == tok::func) {
+      const auto end = skip_function(i + 3);
+      if (end && (toks[end].type == tok::semi || toks[end].type == tok::var ||
+                  toks[end].type == tok::eof)) {
+        tasks.push_back({i, end, nullptr, false, false, ""});
+        task_tokens += end - i;
+        i = end - 1;
+        last = tok::rbrace;
+        continue;
+      }
+    }
+    switch (type) {
+    case tok::lcurve:
+    case tok::lbracket:
+    case tok::lbrace:
+      ++depth;
+      break;
+    case tok::rcurve:
+    case tok::rbracket:
+    case tok::rbrace:
+      depth -= depth ? 1 : 0;
+      break;
+    default:
+      break;
+    }
+    last = type;
+  }
+  if (tasks.size() < 2 || task_tokens < PARALLEL_PARSE_THRESHOLD) {
+    tasks.clear();
+  }
+}
+
+void parse::parallel_parse(std::vector<parallel_task> &tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  std::atomic<usize> next(0);
+  auto worker = [&]() {
+    parse par;
+    par.toks = toks;
+    for (auto i = next++; i < tasks.size(); i = next++) {
+      auto &job = tasks[i];
+      std::stringstream events;
+      par.out = &events;
+      par.ptr = job.begin;
+      par.in_func = par.in_loop = 0;
+      par.task = &job;
+      job.node = par.expression();
+      par.task = nullptr;
+      if (par.ptr != job.end || job.failed) {
+        delete job.node;
+        job.node = nullptr;
+        continue;
+      }
+      if (stream) {
+        // stream mode keeps only lsp events of this definition
+        delete job.node;
+        job.node = nullptr;
+      }
+      job.parsed = true;
+      job.events = events.str();
+    }
+  };
+
+  // main thread is also a worker
+  usize thread_count = std::thread::hardware_concurrency();
+  thread_count = std::max<usize>(1, std::min(thread_count, tasks.size()));
+  std::vector<std::thread> threads;
+  for (usize i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &i : threads) {
+    i.join();
+  }
+}
+
 void parse::die(const span &loc, std::string info) {
+  // error::err reads the source file and may exit if it fails,
+  // so worker only marks the task, which is parsed again and
+  // reported by the main thread in the order of the source
+  if (task) {
+    task->failed = true;
+    return;
+  }
   err.err("parse", loc, info);
 }
 
@@ -284,7 +478,7 @@ string_literal *parse::str() {
 identifier *parse::id() {
   auto node = new identifier(toks[ptr].loc, toks[ptr].str);
   match(tok::id);
-  std::cout << LSP_IDENT << nasal::lsploc(node->get_location())
+  *out << LSP_IDENT << nasal::lsploc(node->get_location())
             << node->get_name().length() << node->get_name() << "\n";
   return node;
 }
@@ -363,12 +557,12 @@ hash_pair *parse::pair() {
 function *parse::func() {
   ++in_func;
   auto node = new function(toks[ptr].loc);
-  std::cout << LSP_FUNC << lsploc(node->get_location());
+  *out << LSP_FUNC << lsploc(node->get_location());
   match(tok::func);
   if (lookahead(tok::lcurve)) {
     params(node);
   }
-  std::cout << "\n";
+  *out << "\n";
   node->set_code_block(expression_block());
   --in_func;
   update_location(node);
@@ -380,7 +574,7 @@ void parse::params(function *func_node) {
   while (!lookahead(tok::rcurve)) {
     auto param = new parameter(toks[ptr].loc);
     param->set_parameter_name(toks[ptr].str);
-    std::cout << param->get_parameter_name() << ";";
+    *out << param->get_parameter_name() << ";";
     match(tok::id);
     if (lookahead(tok::eq)) {
       match(tok::eq);
@@ -877,7 +1071,7 @@ call_function *parse::callf() {
       break;
   }
   update_location(node);
-  std::cout << LSP_FUNC_CALL << lsploc(node->get_location()) << "\n";
+  *out << LSP_FUNC_CALL << lsploc(node->get_location()) << "\n";
   match(tok::rcurve, "expected \")\" when calling function");
   return node;
 }
@@ -900,14 +1094,14 @@ expr *parse::definition() {
     match(tok::var);
     switch (toks[ptr].type) {
     case tok::id:
-      std::cout << LSP_DEFINITION << "\n";
+      *out << LSP_DEFINITION << "\n";
       node->set_identifier(id());
-      std::cout << LSP_DEFINITION << "\n";
+      *out << LSP_DEFINITION << "\n";
       break;
     case tok::lcurve:
-      std::cout << LSP_MULTI_DEFINITION << "\n";
+      *out << LSP_MULTI_DEFINITION << "\n";
       node->set_multi_define(outcurve_def());
-      std::cout << LSP_MULTI_DEFINITION_END << "\n";
+      *out << LSP_MULTI_DEFINITION_END << "\n";
       break;
     default:
       die(thisspan, "expected identifier");
@@ -955,7 +1149,7 @@ multi_identifier *parse::multi_id() {
     if (lookahead(tok::comma)) {
       match(tok::comma);
     } else if (lookahead(tok::id)) { // first set of identifier
-      std::cout << LSP_NASAL_ERROR << "\n";
+      *out << LSP_NASAL_ERROR << "\n";
       die(prevspan, "expected \",\" between identifiers");
     } else {
       break;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <iostream>
 #include <unordered_map>
 #include <vector>
 
@@ -16,6 +17,17 @@ class parse {
 #define thisspan (toks[ptr].loc)
 #define prevspan (ptr != 0 ? toks[ptr - 1].loc : toks[ptr].loc)
 
+private:
+  // top-level `var id = func(...) {...}` parsed by worker threads
+  struct parallel_task {
+    u32 begin;          // index of token `var`
+    u32 end;            // index of the token after function body
+    expr *node;         // subtree, already freed by worker in stream mode
+    bool parsed;        // false if failed, then parsed again in main thread
+    bool failed;        // syntax error found by worker, see die()
+    std::string events; // lsp events generated by this definition
+  };
+
 private:
   u32 ptr;
   u32 in_func; // count function block
@@ -23,6 +35,10 @@ private:
   const token *toks;
   code_block *root;
   error err;
+  std::ostream *out; // lsp events output, std::cout by default
+  bool parallel;     // parse top-level function definitions in parallel
+  bool stream;       // free top-level statements once lsp events are emitted
+  parallel_task *task; // task parsed by this worker, null in main thread
 
 private:
   const std::unordered_map<tok, std::string> tokname{
@@ -91,6 +107,9 @@ private:
   bool check_special_call();
   bool need_semi_check(expr *);
   void update_location(expr *);
+  u32 skip_function(u32);
+  void find_parallel_tasks(std::vector<parallel_task> &);
+  void parallel_parse(std::vector<parallel_task> &);
 
 private:
   null_expr *null();
@@ -150,8 +169,17 @@ public:
   }
 
 public:
-  parse() : ptr(0), in_func(0), in_loop(0), toks(nullptr), root(nullptr) {}
+  parse()
+      : ptr(0), in_func(0), in_loop(0), toks(nullptr), root(nullptr),
+        out(&std::cout), parallel(true), stream(false), task(nullptr) {}
   ~parse() { delete root; }
+  void set_output(std::ostream &s) { out = &s; }
+  void set_error_output(std::ostream &s) { err.set_output(s); }
+  void set_error_quiet(bool flag) { err.set_quiet(flag); }
+  void set_parallel(bool flag) { parallel = flag; }
+  // stream mode only emits lsp events, tree() is an empty code block
+  // after compile, so memory is bounded by the largest statement
+  void set_stream(bool flag) { stream = flag; }
   const error &compile(const lexer &);
 };
 
@@ -36,42 +36,121 @@ std::ostream& operator<<(std::ostream& out, nas_vec& vec) {
     return out;
 }
 
-var nas_hash::get_value(const std::string& key) {
-    if (elems.count(key)) {
-        return elems.at(key);
-    } else if (!elems.count("parents")) {
+void string_index::rehash(usize capacity) {
+    buckets.assign(capacity, bucket());
+    const usize mask = capacity-1;
+    for(u32 i = 0; i<keys.size(); ++i) {
+        auto index = hashes[i]&mask;
+        while(buckets[index].position) {
+            index = (index+1)&mask;
+        }
+        buckets[index].position = i+1;
+        buckets[index].hash = static_cast<u32>(hashes[i]>>32);
+    }
+}
+
+u32 string_index::insert(const std::string& key, u64 hash) {
+    hash = hash? hash:string_hash(key);
+    auto res = find(key, hash);
+    if (res>=0) {
+        return res;
+    }
+    keys.push_back(key);
+    hashes.push_back(hash);
+    if (keys.size()*2>buckets.size()) {
+        rehash(buckets.size()? buckets.size()*2:8);
+        return keys.size()-1;
+    }
+    const usize mask = buckets.size()-1;
+    auto index = hash&mask;
+    while(buckets[index].position) {
+        index = (index+1)&mask;
+    }
+    buckets[index].position = keys.size();
+    buckets[index].hash = static_cast<u32>(hash>>32);
+    return keys.size()-1;
+}
+
+// positions after the erased key are changed, so rebuild all buckets
+void string_index::erase(usize position) {
+    keys.erase(keys.begin()+position);
+    hashes.erase(hashes.begin()+position);
+    rehash(buckets.size());
+}
+
+void string_index::clear() {
+    keys.clear();
+    hashes.clear();
+    buckets.clear();
+}
+
+// shape id 0 is used by dictionary shape and empty inline cache
+static u32 shape_count = 0;
+
+nas_shape* nas_shape::root() {
+    static nas_shape* res = nullptr;
+    if (!res) {
+        res = new nas_shape;
+        res->id = ++shape_count;
+    }
+    return res;
+}
+
+nas_shape* nas_shape::add(const std::string& key, u64 hash) {
+    auto position = transition_key.find(key, hash);
+    if (position>=0) {
+        return transition[position];
+    }
+    auto res = new nas_shape;
+    res->id = ++shape_count;
+    res->parents = key=="parents"? keys.size():parents;
+    res->keys = keys;
+    res->keys.insert(key, hash);
+    transition_key.insert(key, hash);
+    transition.push_back(res);
+    return res;
+}
+
+var nas_hash::get_value(const std::string& key, u64 hash) {
+    hash = hash? hash:string_hash(key);
+    auto slot = shape->find(key, hash);
+    if (slot>=0) {
+        return slots[slot];
+    } else if (shape->parents<0) {
         return var::none();
     }
     var ret = var::none();
-    var val = elems.at("parents");
-    if (val.type!=vm_vec) {
+    var val = slots[shape->parents];
+    if (val.type()!=vm_vec) {
         return ret;
     }
     for(auto& i : val.vec().elems) {
-        if (i.type==vm_hash) {
-            ret = i.hash().get_value(key);
+        if (i.type()==vm_hash) {
+            ret = i.hash().get_value(key, hash);
         }
-        if (ret.type!=vm_none) {
+        if (ret.type()!=vm_none) {
             return ret;
         }
     }
     return ret;
 }
 
-var* nas_hash::get_memory(const std::string& key) {
-    if (elems.count(key)) {
-        return &elems.at(key);
-    } else if (!elems.count("parents")) {
+var* nas_hash::get_memory(const std::string& key, u64 hash) {
+    hash = hash? hash:string_hash(key);
+    auto slot = shape->find(key, hash);
+    if (slot>=0) {
+        return &slots[slot];
+    } else if (shape->parents<0) {
         return nullptr;
     }
     var* addr = nullptr;
-    var val = elems.at("parents");
-    if (val.type!=vm_vec) {
+    var val = slots[shape->parents];
+    if (val.type()!=vm_vec) {
         return addr;
     }
     for(auto& i : val.vec().elems) {
-        if (i.type==vm_hash) {
-            addr = i.hash().get_memory(key);
+        if (i.type()==vm_hash) {
+            addr = i.hash().get_memory(key, hash);
         }
         if (addr) {
             return addr;
@@ -80,16 +159,66 @@ var* nas_hash::get_memory(const std::string& key) {
     return addr;
 }
 
+var& nas_hash::at(const std::string& key, u64 hash) {
+    hash = hash? hash:string_hash(key);
+    auto slot = shape->find(key, hash);
+    if (slot>=0) {
+        return slots[slot];
+    }
+    if (shape->shared() && shape->keys.size()<nas_shape::shared_limit) {
+        shape = shape->add(key, hash);
+    } else {
+        // copy shared shape to dictionary shape, then change it in place
+        if (shape->shared()) {
+            shape = new nas_shape(*shape);
+            shape->id = 0;
+            shape->transition_key.clear();
+            shape->transition.clear();
+        }
+        if (key=="parents") {
+            shape->parents = shape->keys.size();
+        }
+        shape->keys.insert(key, hash);
+    }
+    slots.push_back(nil);
+    return slots.back();
+}
+
+void nas_hash::erase(const std::string& key) {
+    auto slot = shape->find(key);
+    if (slot<0) {
+        return;
+    }
+    if (shape->shared()) {
+        shape = new nas_shape(*shape);
+        shape->id = 0;
+        shape->transition_key.clear();
+        shape->transition.clear();
+    }
+    // keep insertion order of other keys
+    shape->keys.erase(slot);
+    slots.erase(slots.begin()+slot);
+    shape->parents = shape->find("parents");
+}
+
+void nas_hash::clear() {
+    if (!shape->shared()) {
+        delete shape;
+    }
+    shape = nas_shape::root();
+    slots.clear();
+}
+
 std::ostream& operator<<(std::ostream& out, nas_hash& hash) {
-    if (!hash.elems.size() || hash.printed) {
-        out << (hash.elems.size()? "{..}":"{}");
+    if (!hash.size() || hash.printed) {
+        out << (hash.size()? "{..}":"{}");
         return out;
     }
     hash.printed = true;
-    usize iter = 0, size = hash.elems.size();
+    usize size = hash.size();
     out << "{";
-    for(auto& i : hash.elems) {
-        out << i.first << ":" << i.second << ",}"[(++iter)==size];
+    for(usize i = 0; i<size; ++i) {
+        out << hash.key(i) << ":" << hash.slots[i] << ",}"[i+1==size];
     }
     hash.printed = false;
     return out;
@@ -97,6 +226,7 @@ std::ostream& operator<<(std::ostream& out, nas_hash& hash) {
 
 void nas_func::clear() {
     dynamic_parameter_index = -1;
+    fixed_frame = false;
     local.clear();
     upval.clear();
     keys.clear();
@@ -138,18 +268,78 @@ std::ostream& operator<<(std::ostream& out, const nas_ghost& ghost) {
     return out;
 }
 
+void context::resize(usize new_size) {
+    var* old_stack = stack;
+    var* old_end = stack+size();
+    var* new_stack = new var[new_size];
+    const usize used = top-stack+1;
+    for(usize i = 0; i<new_size; ++i) {
+        new_stack[i] = i<used? old_stack[i]:var::nil();
+    }
+
+    // pointers into old stack are moved by the same offset,
+    // others point to global, heap or nothing
+    auto relocate = [=](var* p) {
+        return old_stack<=p && p<old_end? new_stack+(p-old_stack):p;
+    };
+    auto relocate_upvalue = [&](var& upval) {
+        if (upval.type()==vm_upval && upval.upval().on_stack) {
+            upval.upval().stack_frame_offset =
+                relocate(upval.upval().stack_frame_offset);
+        }
+    };
+    // saved localr and upvalr of each frame are stored on stack,
+    // closures of a frame share the upvalue stored in upvalr
+    for(usize i = 0; i<used; ++i) {
+        if (new_stack[i].type()==vm_addr) {
+            new_stack[i] = var::addr(relocate(new_stack[i].addr()));
+        } else {
+            relocate_upvalue(new_stack[i]);
+        }
+    }
+    relocate_upvalue(upvalr);
+
+    localr = relocate(localr);
+    memr = relocate(memr);
+    top = new_stack+(top-old_stack);
+    canary = new_stack+new_size-1;
+    stack = new_stack;
+    delete[] old_stack;
+}
+
+// make sure top+n is below canary, false if stack could not be that large
+bool context::grow(usize n) {
+    const i64 need = top-stack+n+1;
+    usize new_size = size();
+    while(static_cast<i64>(new_size)<=need) {
+        new_size <<= 1;
+    }
+    if (new_size>STACK_MAX_SIZE) {
+        return false;
+    }
+    if (new_size!=size()) {
+        resize(new_size);
+    }
+    return true;
+}
+
 void nas_co::clear() {
     if (!ctx.stack) {
         return;
     }
-    for(u32 i = 0; i<STACK_DEPTH; ++i) {
+    // release stack grown by deep recursion
+    if (ctx.size()>STACK_INITIAL_SIZE) {
+        delete[] ctx.stack;
+        ctx.stack = new var[STACK_INITIAL_SIZE];
+    }
+    for(u32 i = 0; i<STACK_INITIAL_SIZE; ++i) {
         ctx.stack[i] = var::nil();
     }
 
     ctx.pc = 0;
     ctx.localr = nullptr;
     ctx.memr = nullptr;
-    ctx.canary = ctx.stack+STACK_DEPTH-1;
+    ctx.canary = ctx.stack+STACK_INITIAL_SIZE-1;
     ctx.top = ctx.stack;
     ctx.funcr = var::nil();
     ctx.upvalr = var::nil();
@@ -163,30 +353,35 @@ std::ostream& operator<<(std::ostream& out, const nas_co& co) {
     return out;
 }
 
-var nas_map::get_value(const std::string& key) {
-    if (mapper.count(key)) {
-        return *mapper.at(key);
-    }
-    return var::none();
+var nas_map::get_value(const std::string& key, u64 hash) {
+    auto position = keys.find(key, hash);
+    return position>=0? *values[position]:var::none();
+}
+
+var* nas_map::get_memory(const std::string& key, u64 hash) {
+    auto position = keys.find(key, hash);
+    return position>=0? values[position]:nullptr;
 }
 
-var* nas_map::get_memory(const std::string& key) {
-    if (mapper.count(key)) {
-        return mapper.at(key);
+void nas_map::set(const std::string& key, var* value) {
+    auto position = keys.insert(key);
+    if (position<values.size()) {
+        values[position] = value;
+    } else {
+        values.push_back(value);
     }
-    return nullptr;
 }
 
 std::ostream& operator<<(std::ostream& out, nas_map& mp) {
-    if (!mp.mapper.size() || mp.printed) {
-        out << (mp.mapper.size()? "{..}":"{}");
+    if (!mp.size() || mp.printed) {
+        out << (mp.size()? "{..}":"{}");
         return out;
     }
     mp.printed = true;
-    usize iter = 0, size = mp.mapper.size();
+    usize size = mp.size();
     out << "{";
-    for(auto& i : mp.mapper) {
-        out << i.first << ":" << *i.second << ",}"[(++iter)==size];
+    for(usize i = 0; i<size; ++i) {
+        out << mp.key(i) << ":" << *mp.values[i] << ",}"[i+1==size];
     }
     mp.printed = false;
     return out;
@@ -197,7 +392,7 @@ nas_val::nas_val(u8 val_type) {
     type = val_type;
     unmutable = 0;
     switch(val_type) {
-        case vm_str:   ptr.str = new std::string; break;
+        case vm_str:   ptr.str = new nas_str;     break;
         case vm_vec:   ptr.vec = new nas_vec;     break;
         case vm_hash:  ptr.hash = new nas_hash;   break;
         case vm_func:  ptr.func = new nas_func;   break;
@@ -224,9 +419,13 @@ nas_val::~nas_val() {
 
 void nas_val::clear() {
     switch(type) {
-        case vm_str:  ptr.str->clear();        break;
+        case vm_str:
+            ptr.str->value.clear();
+            ptr.str->hash = 0;
+            unmutable = 0;
+            break;
         case vm_vec:  ptr.vec->elems.clear();  break;
-        case vm_hash: ptr.hash->elems.clear(); break;
+        case vm_hash: ptr.hash->clear();       break;
         case vm_func: ptr.func->clear();       break;
         case vm_upval:ptr.upval->clear();      break;
         case vm_obj:  ptr.obj->clear();        break;
@@ -236,13 +435,26 @@ void nas_val::clear() {
 }
 
 f64 var::to_num() {
-    return type!=vm_str? val.num:str2num(str().c_str());
+#ifdef NASAL_NAN_BOXING
+    // other types use the payload like the union in default layout
+    switch(type()) {
+        case vm_num: return num();
+        case vm_str: return str2num(str().c_str());
+        default: break;
+    }
+    const auto p = payload();
+    f64 res;
+    std::memcpy(&res, &p, sizeof(res));
+    return res;
+#else
+    return value_type!=vm_str? val.num:str2num(str().c_str());
+#endif
 }
 
 std::string var::to_str() {
-    if (type==vm_str) {
+    if (type()==vm_str) {
         return str();
-    } else if (type==vm_num) {
+    } else if (type()==vm_num) {
         std::string tmp = std::to_string(num());
         tmp.erase(tmp.find_last_not_of('0')+1, std::string::npos);
         tmp.erase(tmp.find_last_not_of('.')+1, std::string::npos);
@@ -252,10 +464,10 @@ std::string var::to_str() {
 }
 
 std::ostream& operator<<(std::ostream& out, var& ref) {
-    switch(ref.type) {
+    switch(ref.type()) {
         case vm_none: out << "undefined";   break;
         case vm_nil:  out << "nil";         break;
-        case vm_num:  out << ref.val.num;   break;
+        case vm_num:  out << ref.num();     break;
         case vm_str:  out << ref.str();     break;
         case vm_vec:  out << ref.vec();     break;
         case vm_hash: out << ref.hash();    break;
@@ -268,83 +480,47 @@ std::ostream& operator<<(std::ostream& out, var& ref) {
 }
 
 bool var::object_check(const std::string& name) {
-    return type==vm_obj && ghost().type_name==name && ghost().pointer;
-}
-
-var var::none() {
-    return {vm_none, static_cast<u32>(0)};
-}
-
-var var::nil() {
-    return {vm_nil, static_cast<u32>(0)};
-}
-
-var var::ret(u32 pc) {
-    return {vm_ret, pc};
-}
-
-var var::cnt(i64 n) {
-    return {vm_cnt, n};
-}
-
-var var::num(f64 n) {
-    return {vm_num, n};
+    return type()==vm_obj && ghost().type_name==name && ghost().pointer;
 }
 
 var var::gcobj(nas_val* p) {
+#ifdef NASAL_NAN_BOXING
+    return {p->type, reinterpret_cast<u64>(p)};
+#else
     return {p->type, p};
-}
-
-var var::addr(var* p) {
-    return {vm_addr, p};
-}
-
-var* var::addr() {
-    return val.addr;
-}
-
-u32 var::ret() const {
-    return val.ret;
-}
-
-i64& var::cnt() {
-    return val.cnt;
-}
-
-f64 var::num() const {
-    return val.num;
+#endif
 }
 
 std::string& var::str() {
-    return *val.gcobj->ptr.str;
+    return gcobj()->ptr.str->value;
 }
 
 nas_vec& var::vec() {
-    return *val.gcobj->ptr.vec;
+    return *gcobj()->ptr.vec;
 }
 
 nas_hash& var::hash() {
-    return *val.gcobj->ptr.hash;
+    return *gcobj()->ptr.hash;
 }
 
 nas_func& var::func() {
-    return *val.gcobj->ptr.func;
+    return *gcobj()->ptr.func;
 }
 
 nas_upval& var::upval() {
-    return *val.gcobj->ptr.upval;
+    return *gcobj()->ptr.upval;
 }
 
 nas_ghost& var::ghost() {
-    return *val.gcobj->ptr.obj;
+    return *gcobj()->ptr.obj;
 }
 
 nas_co& var::co() {
-    return *val.gcobj->ptr.co;
+    return *gcobj()->ptr.co;
 }
 
 nas_map& var::map() {
-    return *val.gcobj->ptr.map;
+    return *gcobj()->ptr.map;
 }
 
 var nas_err(const std::string& error_function_name, const std::string& info) {
@@ -43,9 +43,37 @@ struct nas_map;   // mapper
 // union type
 struct nas_val;   // nas_val includes gc-managed types
 
+// default layout is a type tag and an 8-byte union, 16 bytes with padding.
+// NASAL_NAN_BOXING packs var into 8 bytes: numbers are stored as doubles,
+// other values are stored in negative NaN, high 16 bits are 0xfff0|(type+1)
+// and low 48 bits are the pointer, pc or counter.
+// NaN numbers are stored as positive quiet NaN, so they never look like
+// a tagged value
 struct var {
-public:
-    u8 type = vm_none;
+private:
+#ifdef NASAL_NAN_BOXING
+    static const u64 tag_shift = 48;
+    static const u64 tag_base = 0xfff0;
+    static const u64 payload_mask = (1ull<<48)-1;
+    static const u64 canonical_nan = 0x7ff8000000000000ull;
+
+    u64 bits = make(vm_none, 0);
+
+    static constexpr u64 make(u8 t, u64 payload) {
+        return ((tag_base|(t+1ull))<<tag_shift)|(payload&payload_mask);
+    }
+    u64 payload() const {return bits&payload_mask;}
+
+    var(u8 t, u64 payload): bits(make(t, payload)) {}
+    explicit var(f64 n) {
+        if (std::isnan(n)) {
+            bits = canonical_nan;
+        } else {
+            std::memcpy(&bits, &n, sizeof(bits));
+        }
+    }
+#else
+    u8 value_type = vm_none;
     union {
         u32 ret;
         i64 cnt;
@@ -54,22 +82,32 @@ public:
         nas_val* gcobj;
     } val;
 
-private:
-    var(u8 t, u32 pc) {type = t; val.ret = pc;}
-    var(u8 t, i64 ct) {type = t; val.cnt = ct;}
-    var(u8 t, f64 n) {type = t; val.num = n;}
-    var(u8 t, var* p) {type = t; val.addr = p;}
-    var(u8 t, nas_val* p) {type = t; val.gcobj = p;}
+    var(u8 t, u32 pc) {value_type = t; val.ret = pc;}
+    var(u8 t, i64 ct) {value_type = t; val.cnt = ct;}
+    var(u8 t, f64 n) {value_type = t; val.num = n;}
+    var(u8 t, var* p) {value_type = t; val.addr = p;}
+    var(u8 t, nas_val* p) {value_type = t; val.gcobj = p;}
+#endif
 
 public:
     var() = default;
     var(const var&) = default;
+#ifdef NASAL_NAN_BOXING
+    bool operator==(const var& nr) const {return bits==nr.bits;}
+    bool operator!=(const var& nr) const {return bits!=nr.bits;}
+    u8 type() const {
+        const auto tag = bits>>tag_shift;
+        return tag>tag_base? static_cast<u8>(tag-tag_base-1):vm_num;
+    }
+#else
     bool operator==(const var& nr) const {
-        return type==nr.type && val.gcobj==nr.val.gcobj;
+        return value_type==nr.value_type && val.gcobj==nr.val.gcobj;
     }
     bool operator!=(const var& nr) const {
-        return type!=nr.type || val.gcobj!=nr.val.gcobj;
+        return value_type!=nr.value_type || val.gcobj!=nr.val.gcobj;
     }
+    u8 type() const {return value_type;}
+#endif
 
     // number and string can be translated to each other
     f64 to_num();
@@ -77,19 +115,42 @@ public:
     bool object_check(const std::string&);
 
     // create new var object
-    static var none();
-    static var nil();
-    static var ret(u32);
-    static var cnt(i64);
-    static var num(f64);
+#ifdef NASAL_NAN_BOXING
+    static var none() {return {vm_none, 0ull};}
+    static var nil() {return {vm_nil, 0ull};}
+    static var ret(u32 pc) {return {vm_ret, static_cast<u64>(pc)};}
+    static var cnt(i64 n) {return {vm_cnt, static_cast<u64>(n)};}
+    static var num(f64 n) {return var(n);}
+    static var addr(var* p) {return {vm_addr, reinterpret_cast<u64>(p)};}
+#else
+    static var none() {return {vm_none, static_cast<u32>(0)};}
+    static var nil() {return {vm_nil, static_cast<u32>(0)};}
+    static var ret(u32 pc) {return {vm_ret, pc};}
+    static var cnt(i64 n) {return {vm_cnt, n};}
+    static var num(f64 n) {return {vm_num, n};}
+    static var addr(var* p) {return {vm_addr, p};}
+#endif
     static var gcobj(nas_val*);
-    static var addr(var*);
 
     // get value
-    var* addr();
-    u32 ret() const;
-    i64& cnt();
-    f64 num() const;
+#ifdef NASAL_NAN_BOXING
+    var* addr() const {return reinterpret_cast<var*>(payload());}
+    u32 ret() const {return static_cast<u32>(payload());}
+    // counter is stored as 48-bit signed integer
+    i64 cnt() const {return static_cast<i64>(bits<<16)>>16;}
+    f64 num() const {
+        f64 n;
+        std::memcpy(&n, &bits, sizeof(n));
+        return n;
+    }
+    nas_val* gcobj() const {return reinterpret_cast<nas_val*>(payload());}
+#else
+    var* addr() const {return val.addr;}
+    u32 ret() const {return val.ret;}
+    i64 cnt() const {return val.cnt;}
+    f64 num() const {return val.num;}
+    nas_val* gcobj() const {return val.gcobj;}
+#endif
     std::string& str();
     nas_vec& vec();
     nas_hash& hash();
@@ -100,6 +161,11 @@ public:
     nas_map& map();
 };
 
+#ifdef NASAL_NAN_BOXING
+static_assert(sizeof(var)==8, "nan boxing var should be 8 bytes");
+static_assert(sizeof(void*)==8, "nan boxing needs 64-bit pointers");
+#endif
+
 struct nas_vec {
     std::vector<var> elems;
 
@@ -111,15 +177,103 @@ struct nas_vec {
     var* get_memory(const i32);
 };
 
+// hash of string key, 0 is used as "not computed yet"
+inline u64 string_hash(const std::string& key) {
+    const u64 res = std::hash<std::string>()(key);
+    return res? res:1;
+}
+
+// strings in insertion order, position of a key is its index.
+// buckets use open addressing with linear probing, each bucket keeps the
+// position and high bits of the key hash, so most mismatches are found
+// without reading the key string. hashes of keys are cached for rehash
+class string_index {
+private:
+    struct bucket {
+        u32 position = 0; // position+1, 0 means empty bucket
+        u32 hash = 0;
+    };
+    std::vector<std::string> keys;
+    std::vector<u64> hashes;
+    // size is 0 or power of 2, at most half full
+    std::vector<bucket> buckets;
+
+    void rehash(usize);
+
+public:
+    usize size() const {return keys.size();}
+    const std::string& key(usize i) const {return keys[i];}
+    i32 find(const std::string& key, u64 hash = 0) const {
+        if (buckets.empty()) {
+            return -1;
+        }
+        hash = hash? hash:string_hash(key);
+        const usize mask = buckets.size()-1;
+        for(usize i = hash&mask;; i = (i+1)&mask) {
+            const auto& b = buckets[i];
+            if (!b.position) {
+                return -1;
+            }
+            if (b.hash==static_cast<u32>(hash>>32) && keys[b.position-1]==key) {
+                return b.position-1;
+            }
+        }
+        return -1;
+    }
+    // position of the key, append it if not exists
+    u32 insert(const std::string&, u64 = 0);
+    void erase(usize);
+    void clear();
+};
+
+// shape is the layout of hash: keys in insertion order and their slot index.
+// hashes built by adding the same keys in the same order share one shape,
+// so checking shape id is enough to know where a key is stored.
+// shared shapes are never freed, large or deleted-from hashes use their own
+// dictionary shape, which has id 0 and is never cached by vm
+struct nas_shape {
+    // max key count of shared shape, each shape has a copy of its key index
+    static const u32 shared_limit = 64;
+
+    u32 id = 0;
+    // slot of "parents", -1 if not exists
+    i32 parents = -1;
+    string_index keys;
+    // next shape after adding the key at the same position
+    string_index transition_key;
+    std::vector<nas_shape*> transition;
+
+    static nas_shape* root();
+    nas_shape* add(const std::string&, u64);
+    bool shared() const {return id!=0;}
+    i32 find(const std::string& key, u64 hash = 0) const {
+        return keys.find(key, hash);
+    }
+};
+
+// hash parameter of member functions is the cached key hash,
+// 0 means it is computed here
 struct nas_hash {
-    std::unordered_map<std::string, var> elems;
+    nas_shape* shape = nas_shape::root();
+    std::vector<var> slots;
 
     // mark if this is printed, avoid stack overflow
     bool printed = false;
 
-    usize size() const {return elems.size();}
-    var get_value(const std::string&);
-    var* get_memory(const std::string&);
+    nas_hash() = default;
+    nas_hash(const nas_hash&) = delete;
+    nas_hash& operator=(const nas_hash&) = delete;
+    ~nas_hash() {clear();}
+
+    usize size() const {return slots.size();}
+    const std::string& key(usize i) const {return shape->keys.key(i);}
+    bool contains(const std::string& key) const {return shape->find(key)>=0;}
+    var get_value(const std::string&, u64 = 0);
+    var* get_memory(const std::string&, u64 = 0);
+    // own slot of the key, create it with nil if not exists
+    var& at(const std::string&, u64 = 0);
+    void erase(const std::string&);
+    void clear();
 };
 
 struct nas_func {
@@ -127,6 +281,7 @@ struct nas_func {
     u32 entry; // pc will set to entry-1 to call this function
     u32 parameter_size; // used to load default parameters to a new function
     u32 local_size; // used to expand memory space for local values on stack
+    bool fixed_frame; // called with vm::fixed_frame_call
     std::vector<var> local; // local scope with default value(var)
     std::vector<var> upval; // closure
 
@@ -135,7 +290,7 @@ struct nas_func {
 
     nas_func():
         dynamic_parameter_index(-1), entry(0),
-        parameter_size(0), local_size(0) {}
+        parameter_size(0), local_size(0), fixed_frame(false) {}
     void clear();
 };
 
@@ -192,6 +347,11 @@ struct context {
     var* canary = nullptr;
     var* stack = nullptr;
     var* top = nullptr;
+
+    // capacity of value stack, canary is the last slot
+    usize size() const {return canary-stack+1;}
+    void resize(usize);
+    bool grow(usize);
 };
 
 struct nas_co {
@@ -205,7 +365,8 @@ struct nas_co {
     status status;
 
     nas_co() {
-        ctx.stack = new var[STACK_DEPTH];
+        ctx.stack = new var[STACK_INITIAL_SIZE];
+        ctx.canary = ctx.stack+STACK_INITIAL_SIZE-1;
         clear();
     }
     ~nas_co() {
@@ -216,14 +377,30 @@ struct nas_co {
 
 struct nas_map {
     bool printed = false;
-    std::unordered_map<std::string, var*> mapper;
+    string_index keys;
+    std::vector<var*> values;
 
+    usize size() const {return values.size();}
+    const std::string& key(usize i) const {return keys.key(i);}
     void clear() {
-        mapper.clear();
+        keys.clear();
+        values.clear();
     }
 
-    var get_value(const std::string&);
-    var* get_memory(const std::string&);
+    var get_value(const std::string&, u64 = 0);
+    var* get_memory(const std::string&, u64 = 0);
+    void set(const std::string&, var*);
+};
+
+// interned strings are unique by content and never changed,
+// so two different interned strings are not equal, and hash is cached.
+// strings allocated by gc::alloc directly are not interned and mutable
+struct nas_str {
+    std::string value;
+    // hash of interned string, 0 if not interned
+    u64 hash = 0;
+
+    bool interned() const {return hash!=0;}
 };
 
 struct nas_val {
@@ -237,7 +414,7 @@ struct nas_val {
     u8 type; // value type
     u8 unmutable; // used to mark if a string is unmutable
     union {
-        std::string* str;
+        nas_str*   str;
         nas_vec*   vec;
         nas_hash*  hash;
         nas_func*  func;
@@ -263,6 +440,24 @@ const var zero = var::num(0);
 const var one = var::num(1);
 const var nil = var::nil();
 
+// both values should be vm_str
+inline bool string_equal(const var& a, const var& b) {
+    const auto left = a.gcobj()->ptr.str;
+    const auto right = b.gcobj()->ptr.str;
+    if (left==right) {
+        return true;
+    } else if (left->interned() && right->interned()) {
+        return false;
+    }
+    return left->value==right->value;
+}
+
+// hash of vm_str used as hash key
+inline u64 string_key_hash(const var& key) {
+    const auto res = key.gcobj()->ptr.str;
+    return res->interned()? res->hash:string_hash(res->value);
+}
+
 // use to print error log and return error value
 var nas_err(const std::string&, const std::string&);
 
@@ -6,16 +6,29 @@ void vm::init(
     const std::vector<std::string>& strs,
     const std::vector<f64>& nums,
     const std::vector<nasal_builtin_table>& natives,
-    const std::vector<opcode>& code,
+    std::vector<opcode>& code,
+    const std::vector<opcode_location>& code_location,
     const std::unordered_map<std::string, i32>& global_symbol,
     const std::vector<std::string>& filenames,
     const std::vector<std::string>& argv
 ) {
     const_number = nums.data();
     const_string = strs.data();
+    const_string_hash.resize(strs.size());
+    for(usize i = 0; i<strs.size(); ++i) {
+        const_string_hash[i] = string_hash(strs[i]);
+    }
     bytecode = code.data();
+    bytecode_size = code.size();
+    inline_cache.assign(code.size(), hash_cache());
+    find_fixed_frame_function();
+    locations = code_location.data();
     files = filenames.data();
     global_size = global_symbol.size();
+#ifdef NASAL_JIT
+    native.init(bytecode, code.size(), const_number, global,
+                &vm::jit_handler, &vm::jit_stack_overflow);
+#endif
 
     /* set native functions */
     native_function = natives;
@@ -34,7 +47,7 @@ void vm::init(
     auto map_instance = ngc.alloc(vm_map);
     global[global_symbol.at("globals")] = map_instance;
     for(const auto& i : global_symbol) {
-        map_instance.map().mapper[i.first] = global+i.second;
+        map_instance.map().set(i.first, global+i.second);
     }
 
     /* init vm arg */
@@ -51,25 +64,54 @@ void vm::context_and_global_init() {
     ctx.funcr = nil;
     ctx.upvalr = nil;
 
-    /* set canary = stack[STACK_DEPTH-1] */
-    ctx.canary = ctx.stack+STACK_DEPTH-1;
+    /* set canary = stack[STACK_INITIAL_SIZE-1], stack grows later */
+    ctx.canary = ctx.stack+STACK_INITIAL_SIZE-1;
 
     /* nothing is on stack */
     ctx.top = ctx.stack - 1;
 
     /* clear main stack and global */
-    for(u32 i = 0; i<STACK_DEPTH; ++i) {
+    for(u32 i = 0; i<STACK_INITIAL_SIZE; ++i) {
         ctx.stack[i] = nil;
+    }
+    for(u32 i = 0; i<STACK_DEPTH; ++i) {
         global[i] = nil;
     }
 }
 
+void vm::find_fixed_frame_function() {
+    const auto size = bytecode_size;
+    fixed_frame_function.assign(size, false);
+    for(usize i = 0; i<size; ++i) {
+        if (bytecode[i].op!=op_newf) {
+            continue;
+        }
+        // parameters are between newf and the jmp over function body
+        const u32 entry = bytecode[i].num;
+        if (entry<=i+1 || entry>size || bytecode[entry-1].op!=op_jmp) {
+            continue;
+        }
+        bool fixed = true;
+        for(u32 j = i+1; j<entry-1 && fixed; ++j) {
+            fixed = bytecode[j].op!=op_deft && bytecode[j].op!=op_dyn;
+        }
+        // newf in function body creates closure, which needs upvalr
+        for(u32 j = entry; j<bytecode[entry-1].num && fixed; ++j) {
+            fixed = bytecode[j].op!=op_newf;
+        }
+        fixed_frame_function[i] = fixed;
+    }
+}
+
 void vm::value_info(var& val) {
-    const auto p = reinterpret_cast<u64>(val.val.gcobj);
-    switch(val.type) {
+    const auto p = reinterpret_cast<u64>(val.gcobj());
+    switch(val.type()) {
         case vm_none: std::clog << "| null |"; break;
         case vm_ret:  std::clog << "| pc   | 0x" << std::hex
-                                << val.ret() << std::dec; break;
+                                << (val.ret()&~frame_mark)
+                                << std::dec
+                                << (val.ret()&fixed_frame_mark? " fixed":"");
+                      break;
         case vm_addr: std::clog << "| addr | 0x" << std::hex
                                 << reinterpret_cast<u64>(val.addr())
                                 << std::dec; break;
@@ -99,7 +141,7 @@ void vm::value_info(var& val) {
                                 << std::dec << "> coroutine"; break;
         case vm_map:  std::clog << "| nmspc| <0x" << std::hex << p
                                 << std::dec << "> namespace ["
-                                << val.map().mapper.size() << " val]"; break;
+                                << val.map().size() << " val]"; break;
         default:      std::clog << "| err  | <0x" << std::hex << p
                                 << std::dec << "> unknown object"; break;
     }
@@ -135,12 +177,27 @@ void vm::function_call_trace() {
     var* bottom = ctx.stack;
     var* top = ctx.top;
 
-    // generate trace back
-    std::stack<const nas_func*> functions;
-    for(var* i = bottom; i<=top; ++i) {
-        if (i->type==vm_func && i-1>=bottom && (i-1)->type==vm_ret) {
-            functions.push(&i->func());
+    // generate trace back by walking the frame chain from current function,
+    // each frame ends with old upvalr (old funcr in fixed frame),
+    // old localr and old pc, the mark in old pc tells the frame layout
+    std::vector<const nas_func*> functions;
+    var* local = ctx.localr;
+    var function = ctx.funcr;
+    while(local && local>=bottom && function.type()==vm_func) {
+        const var* info = local+function.func().local_size;
+        if (info+2>top ||
+            info[1].type()!=vm_addr ||
+            info[2].type()!=vm_ret) {
+            break;
+        }
+        functions.push_back(&function.func());
+        // funcr of the top level is nil, which ends the walk
+        if (info[2].ret()&fixed_frame_mark) {
+            function = info[0];
+        } else {
+            function = local>bottom? local[-1]:nil;
         }
+        local = info[1].addr();
     }
     if (functions.empty()) {
         return;
@@ -149,8 +206,7 @@ void vm::function_call_trace() {
     std::clog << "\ncall trace " << (ngc.cort? "(coroutine)":"(main)") << "\n";
     const nas_func* last = nullptr;
     u32 same = 0;
-    for(auto func = last; !functions.empty(); functions.pop()) {
-        func = functions.top();
+    for(auto func : functions) {
         if (last==func) {
             ++same;
             continue;
@@ -176,14 +232,16 @@ void vm::trace_back() {
     // generate trace back
     std::stack<u32> ret;
     for(var* i = ctx.stack; i<=ctx.top; ++i) {
-        if (i->type==vm_ret && i->ret()!=0) {
-            ret.push(i->ret());
+        if (i->type()==vm_ret && (i->ret()&~frame_mark)!=0) {
+            ret.push(i->ret()&~frame_mark);
         }
     }
     ret.push(ctx.pc); // store the position program crashed
 
     std::clog << "\ntrace back " << (ngc.cort? "(coroutine)":"(main)") << "\n";
-    codestream::set(const_number, const_string, native_function.data(), files);
+    codestream::set(
+        const_number, const_string, native_function.data(), files, locations
+    );
     for(u32 p = 0, same = 0, prev = 0xffffffff; !ret.empty(); prev = p, ret.pop()) {
         if ((p = ret.top())==prev) {
             ++same;
@@ -236,7 +294,7 @@ void vm::register_info() {
 }
 
 void vm::global_state() {
-    if (!global_size || global[0].type==vm_none) {
+    if (!global_size || global[0].type()==vm_none) {
         return;
     }
     std::clog << "\nglobal (0x" << std::hex
@@ -266,7 +324,7 @@ void vm::local_state() {
 }
 
 void vm::upvalue_state() {
-    if (ctx.funcr.type==vm_nil || ctx.funcr.func().upval.empty()) {
+    if (ctx.funcr.type()==vm_nil || ctx.funcr.func().upval.empty()) {
         return;
     }
     std::clog << "\nupvalue\n";
@@ -326,7 +384,7 @@ std::string vm::report_special_call_lack_arguments(
         argument_list[i.second-1] = i.first;
     }
     for(const auto& key : argument_list) {
-        if (local[func.keys.at(key)].type==vm_none) {
+        if (local[func.keys.at(key)].type()==vm_none) {
             result += key + ", ";
         } else {
             result += key + "[get], ";
@@ -343,10 +401,10 @@ std::string vm::report_special_call_lack_arguments(
 std::string vm::report_key_not_found(
     const std::string& not_found, const nas_hash& hash) const {
     auto result = "member \"" + not_found + "\" doesn't exist in hash {";
-    for(const auto& i : hash.elems) {
-        result += i.first + ", ";
+    for(usize i = 0; i<hash.size(); ++i) {
+        result += hash.key(i) + ", ";
     }
-    if (hash.elems.size()) {
+    if (hash.size()) {
         result = result.substr(0, result.length()-2);
     }
     result += "}";
@@ -365,7 +423,7 @@ std::string vm::report_out_of_range(f64 index, usize real_size) const {
 }
 
 std::string vm::type_name_string(const var& value) const {
-    switch(value.type) {
+    switch(value.type()) {
         case vm_none: return "none";
         case vm_cnt: return "counter";
         case vm_addr: return "address";
@@ -384,6 +442,151 @@ std::string vm::type_name_string(const var& value) const {
     return "unknown";
 }
 
+#ifdef NASAL_JIT
+void vm::jit_handler(void* self, u32 op) {
+    typedef void (vm::*nafunc)();
+    static const nafunc oprs[] = {
+        nullptr,       &vm::o_repl,
+        &vm::o_intl,   &vm::o_loadg,
+        &vm::o_loadl,  &vm::o_loadu,
+        &vm::o_pnum,   &vm::o_pnil,
+        &vm::o_pstr,   &vm::o_newv,
+        &vm::o_newh,   &vm::o_newf,
+        &vm::o_happ,   &vm::o_para,
+        &vm::o_deft,   &vm::o_dyn,
+        &vm::o_lnot,   &vm::o_usub,
+        &vm::o_bnot,   &vm::o_btor,
+        &vm::o_btxor,  &vm::o_btand,
+        &vm::o_add,    &vm::o_sub,
+        &vm::o_mul,    &vm::o_div,
+        &vm::o_lnk,    &vm::o_addc,
+        &vm::o_subc,   &vm::o_mulc,
+        &vm::o_divc,   &vm::o_lnkc,
+        &vm::o_addeq,  &vm::o_subeq,
+        &vm::o_muleq,  &vm::o_diveq,
+        &vm::o_lnkeq,  &vm::o_bandeq,
+        &vm::o_boreq,  &vm::o_bxoreq,
+        &vm::o_addeqc, &vm::o_subeqc,
+        &vm::o_muleqc, &vm::o_diveqc,
+        &vm::o_lnkeqc, &vm::o_addecp,
+        &vm::o_subecp, &vm::o_mulecp,
+        &vm::o_divecp, &vm::o_lnkecp,
+        &vm::o_meq,    &vm::o_eq,
+        &vm::o_neq,    &vm::o_less,
+        &vm::o_leq,    &vm::o_grt,
+        &vm::o_geq,    &vm::o_lessc,
+        &vm::o_leqc,   &vm::o_grtc,
+        &vm::o_geqc,   &vm::o_pop,
+        &vm::o_jmp,    &vm::o_jt,
+        &vm::o_jf,     &vm::o_cnt,
+        &vm::o_findex, &vm::o_feach,
+        &vm::o_callg,  &vm::o_calll,
+        &vm::o_upval,  &vm::o_callv,
+        &vm::o_callvi, &vm::o_callh,
+        &vm::o_callfv, &vm::o_callfh,
+        &vm::o_callb,  &vm::o_slcbeg,
+        &vm::o_slcend, &vm::o_slc,
+        &vm::o_slc2,   &vm::o_mcallg,
+        &vm::o_mcalll, &vm::o_mupval,
+        &vm::o_mcallv, &vm::o_mcallh,
+        &vm::o_lcmpjf, &vm::o_gcmpjf,
+        &vm::o_lcalc,  &vm::o_gcalc,
+        &vm::o_callnb, &vm::o_lloop,
+        &vm::o_gloop,  &vm::o_addn,
+        &vm::o_subn,   &vm::o_muln,
+        &vm::o_divn,   &vm::o_lessn,
+        &vm::o_leqn,   &vm::o_grtn,
+        &vm::o_geqn,   &vm::o_tcallfv,
+        &vm::o_ret
+    };
+    auto machine = static_cast<vm*>(self);
+    (machine->*oprs[op])();
+}
+
+void vm::jit_stack_overflow(void* self) {
+    auto machine = static_cast<vm*>(self);
+    if (!machine->grow_stack(0)) {
+        machine->die("stack overflow");
+    }
+}
+
+void vm::jit_compile(nas_func& func, u32 min_size) {
+    // bytecode before entry jumps over the function body
+    const auto entry = func.entry;
+    if (!entry || bytecode[entry-1].op!=op_jmp) {
+        return;
+    }
+    const auto end = bytecode[entry-1].num;
+    // bodies of nested functions are not run by this function
+    u32 size = 0;
+    for(u32 i = entry; i<end && size<min_size; ++i, ++size) {
+        const auto nested = bytecode[i].num;
+        if (bytecode[i].op==op_newf && nested>i && nested<=end &&
+            bytecode[nested-1].op==op_jmp) {
+            i = bytecode[nested-1].num-1;
+        }
+    }
+    if (size<min_size) {
+        return;
+    }
+    native.compile(entry, end);
+}
+
+void vm::jit_loop(u32 back_edge) {
+    if (jit_running) {
+        return;
+    }
+    const auto head = ctx.pc+1;
+    if (!native.find(head)) {
+        // loop in function compiles the function,
+        // loop in global scope only compiles the loop itself
+        auto& hotness = native.hotness(back_edge);
+        if (hotness>=jit::hot_threshold || ++hotness<jit::hot_threshold) {
+            return;
+        }
+        if (ctx.funcr.type()==vm_func) {
+            jit_compile(ctx.funcr.func());
+        } else {
+            native.compile(head, back_edge+1);
+        }
+    }
+    jit_enter();
+}
+
+void vm::jit_enter() {
+    // native code returns when pc leaves compiled code,
+    // keep running if the next opcode is compiled too
+    if (jit_running) {
+        return;
+    }
+    jit_running = true;
+    for(auto code = native.find(ctx.pc+1); code; code = native.find(ctx.pc+1)) {
+        native.run(&ctx, this, code);
+    }
+    jit_running = false;
+}
+#endif
+
+// grow value stack to push n more values, false if it is too deep.
+// pointers into stack are moved, so native code should not keep them
+bool vm::grow_stack(u32 n) {
+    if (!ctx.grow(n)) {
+        return false;
+    }
+    // running coroutine keeps a copy of context scanned by gc
+    if (ngc.cort) {
+        ngc.cort->ctx = ctx;
+    }
+    return true;
+}
+
+void vm::shrink_stack() {
+    ctx.resize(ctx.size()/2);
+    if (ngc.cort) {
+        ngc.cort->ctx = ctx;
+    }
+}
+
 void vm::die(const std::string& str) {
     std::cerr << "[vm] error: " << str << "\n";
     function_call_trace();
@@ -407,12 +610,25 @@ void vm::die(const std::string& str) {
 }
 
 void vm::run(
-    const codegen& gen,
+    codegen& gen,
     const linker& linker,
     const std::vector<std::string>& argv
 ) {
-    init(gen.strs(), gen.nums(), gen.natives(),
-         gen.codes(), gen.globals(), linker.get_file_list(), argv);
+    init(gen.strs(), gen.nums(), gen.natives(), gen.codes(),
+         gen.locations(), gen.globals(), linker.get_file_list(), argv);
+    execute();
+}
+
+void vm::run(
+    bytecode_image& image,
+    const std::vector<std::string>& argv
+) {
+    init(image.strs(), image.nums(), image.natives(), image.codes(),
+         image.locations(), image.globals(), image.get_file_list(), argv);
+    execute();
+}
+
+void vm::execute() {
 #ifndef _MSC_VER
     // using labels as values/computed goto
     const void* oprs[] = {
@@ -437,15 +653,15 @@ void vm::run(
         &&callvi, &&callh,  &&callfv, &&callfh,
         &&callb,  &&slcbeg, &&slcend, &&slc,
         &&slc2,   &&mcallg, &&mcalll, &&mupval,
-        &&mcallv, &&mcallh, &&ret
+        &&mcallv, &&mcallh, &&lcmpjf, &&gcmpjf,
+        &&lcalc,  &&gcalc,  &&callnb, &&lloop,
+        &&gloop,  &&addn,   &&subn,   &&muln,
+        &&divn,   &&lessn,  &&leqn,   &&grtn,
+        &&geqn,   &&tcallfv, &&ret
     };
-    std::vector<const void*> code;
-    for(auto& i : gen.codes()) {
-        code.push_back(oprs[i.op]);
-        imm.push_back(i.num);
-    }
-    // goto the first operand
-    goto *code[ctx.pc];
+    // dispatch directly on the bytecode stream,
+    // so no per-run conversion is needed before execution
+    goto *oprs[bytecode[ctx.pc].op];
 #else
     typedef void (vm::*nafunc)();
     const nafunc oprs[] = {
@@ -492,16 +708,19 @@ void vm::run(
         &vm::o_slc2,   &vm::o_mcallg,
         &vm::o_mcalll, &vm::o_mupval,
         &vm::o_mcallv, &vm::o_mcallh,
+        &vm::o_lcmpjf, &vm::o_gcmpjf,
+        &vm::o_lcalc,  &vm::o_gcalc,
+        &vm::o_callnb, &vm::o_lloop,
+        &vm::o_gloop,  &vm::o_addn,
+        &vm::o_subn,   &vm::o_muln,
+        &vm::o_divn,   &vm::o_lessn,
+        &vm::o_leqn,   &vm::o_grtn,
+        &vm::o_geqn,   &vm::o_tcallfv,
         &vm::o_ret
     };
-    std::vector<nafunc> code;
-    for(auto& i : gen.codes()) {
-        code.push_back(oprs[i.op]);
-        imm.push_back(i.num);
-    }
-    while(code[ctx.pc]) {
-        (this->*code[ctx.pc])();
-        if (ctx.top>=ctx.canary) {
+    while(oprs[bytecode[ctx.pc].op]) {
+        (this->*oprs[bytecode[ctx.pc].op])();
+        if (ctx.top>=ctx.canary && !grow_stack(0)) {
             die("stack overflow");
         }
         ++ctx.pc;
@@ -512,7 +731,6 @@ vmexit:
     if (verbose) {
         ngc.info();
     }
-    imm.clear();
     if (!is_repl_mode) {
         ngc.clear();
     }
@@ -520,17 +738,17 @@ vmexit:
 
 #ifndef _MSC_VER
 // may cause stackoverflow
-#define exec_check(op) {\
-    op();\
-    if (ctx.top<ctx.canary)\
-        goto *code[++ctx.pc];\
+#define exec_check(operand) {\
+    operand();\
+    if (ctx.top<ctx.canary || grow_stack(0))\
+        goto *oprs[bytecode[++ctx.pc].op];\
     die("stack overflow");\
-    goto *code[++ctx.pc];\
+    goto *oprs[bytecode[++ctx.pc].op];\
 }
 // do not cause stackoverflow
-#define exec_nodie(op) {\
-    op();\
-    goto *code[++ctx.pc];\
+#define exec_nodie(operand) {\
+    operand();\
+    goto *oprs[bytecode[++ctx.pc].op];\
 }
 
 repl:   exec_nodie(o_repl  ); // 0
@@ -618,6 +836,22 @@ mcalll: exec_check(o_mcalll); // +1
 mupval: exec_check(o_mupval); // +1
 mcallv: exec_nodie(o_mcallv); // -0
 mcallh: exec_nodie(o_mcallh); // -0
+lcmpjf: exec_nodie(o_lcmpjf); // -0
+gcmpjf: exec_nodie(o_gcmpjf); // -0
+lcalc:  exec_nodie(o_lcalc ); // -0
+gcalc:  exec_nodie(o_gcalc ); // -0
+callnb: exec_check(o_callnb); // +1-argc
+lloop:  exec_nodie(o_lloop ); // -0
+gloop:  exec_nodie(o_gloop ); // -0
+addn:   exec_nodie(o_addn  ); // -1
+subn:   exec_nodie(o_subn  ); // -1
+muln:   exec_nodie(o_muln  ); // -1
+divn:   exec_nodie(o_divn  ); // -1
+lessn:  exec_nodie(o_lessn ); // -1
+leqn:   exec_nodie(o_leqn  ); // -1
+grtn:   exec_nodie(o_grtn  ); // -1
+geqn:   exec_nodie(o_geqn  ); // -1
+tcallfv: exec_nodie(o_tcallfv); // check in the function
 ret:    exec_nodie(o_ret   ); // -2
 #endif
 }
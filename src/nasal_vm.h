@@ -8,6 +8,8 @@
 #include "nasal_import.h"
 #include "nasal_gc.h"
 #include "nasal_codegen.h"
+#include "nasal_image.h"
+#include "nasal_jit.h"
 
 #ifdef _MSC_VER
 #pragma warning (disable:4244)
@@ -17,6 +19,20 @@
 
 namespace nasal {
 
+// inline cache of callh/mcallh, one for each opcode.
+// key is found in the last hash of a chain that begins from the receiver
+// and goes through parents[0] of each hash, shape ids of hashes in this
+// chain tell that the key is not in the hashes before the last one,
+// and where "parents" and the key are stored
+struct hash_cache {
+    static const u32 max_depth = 4;
+    u32 shape[max_depth] = {0};
+    u32 parents[max_depth-1] = {0};
+    u32 slot = 0;
+    // hash count of the chain, 0 means empty cache
+    u32 depth = 0;
+};
+
 class vm {
 protected:
 
@@ -26,7 +42,7 @@ protected:
     /* constants */
     const f64* const_number = nullptr; // constant numbers
     const std::string* const_string = nullptr; // constant symbols and strings
-    std::vector<u32> imm; // immediate number table
+    std::vector<u64> const_string_hash; // cached hash of constant strings
     std::vector<nasal_builtin_table> native_function;
     
     /* garbage collector */
@@ -36,9 +52,44 @@ protected:
     var* global = nullptr;
     usize global_size = 0;
 
+    /* bytecode buffer address, immediate number is read from here.
+     * quickening rewrites opcodes in place, in the buffer of codegen
+     * or bytecode image, so no per-run copy is needed */
+    opcode* bytecode = nullptr;
+    usize bytecode_size = 0;
+
+    /* inline cache of hash member access, indexed by pc */
+    std::vector<hash_cache> inline_cache;
+
+    /* newf at this pc creates a function using fixed call frame */
+    std::vector<bool> fixed_frame_function;
+
+    /* old pc of fixed call frame is marked by this bit, so ret and
+     * call trace know the frame layout without guessing from stack */
+    static const u32 fixed_frame_mark = 1u<<31;
+    /* old pc of frame called by native code is marked by this bit,
+     * only these returns check if native code of the caller resumes */
+    static const u32 native_frame_mark = 1u<<30;
+    static const u32 frame_mark = fixed_frame_mark|native_frame_mark;
+
     /* values used for debugger */
     const std::string* files = nullptr; // file name list
-    const opcode* bytecode = nullptr; // bytecode buffer address
+    const opcode_location* locations = nullptr; // file and line of bytecode
+
+    /* baseline jit, native code shares context with interpreter */
+    bool jit_enabled = true;
+#ifdef NASAL_JIT
+    jit native;
+    bool jit_running = false;
+    // old pc of the dropped frame is marked, see o_tcallfv
+    bool jit_tail_call = false;
+    static void jit_handler(void*, u32);
+    static void jit_stack_overflow(void*);
+    void jit_compile(nas_func&, u32 min_size = 0);
+    void jit_function_call();
+    void jit_loop(u32);
+    void jit_enter();
+#endif
 
     /* variables for repl mode */
     bool is_repl_mode = false;
@@ -50,12 +101,15 @@ protected:
         const std::vector<std::string>&,
         const std::vector<f64>&,
         const std::vector<nasal_builtin_table>&,
-        const std::vector<opcode>&,
+        std::vector<opcode>&,
+        const std::vector<opcode_location>&,
         const std::unordered_map<std::string, i32>&,
         const std::vector<std::string>&,
         const std::vector<std::string>&
     );
     void context_and_global_init();
+    void find_fixed_frame_function();
+    void execute();
 
     /* debug functions */
     bool verbose = false;
@@ -75,9 +129,20 @@ protected:
     std::string report_out_of_range(f64, usize) const;
     std::string type_name_string(const var&) const;
     void die(const std::string&);
+    bool grow_stack(u32);
+    void shrink_stack();
 
     /* vm calculation functions*/
     inline bool cond(var&);
+    inline void cmp_const_jf(var&);
+    inline void calc_const(var&);
+    inline void counted_loop(var&);
+    inline void fixed_frame_call(var*, u32);
+    inline void call_function(u32);
+    inline void close_upvalue(nas_upval&, var*, u32);
+    inline var* hash_cache_find(nas_hash*, const hash_cache&);
+    inline var* hash_cache_fill(nas_hash*, u32, hash_cache&);
+    inline var* hash_member(nas_hash&, u32);
 
     /* vm operands */
     inline void o_repl();
@@ -165,13 +230,29 @@ protected:
     inline void o_mupval();
     inline void o_mcallv();
     inline void o_mcallh();
+    inline void o_lcmpjf();
+    inline void o_gcmpjf();
+    inline void o_lcalc();
+    inline void o_gcalc();
+    inline void o_callnb();
+    inline void o_lloop();
+    inline void o_gloop();
+    inline void o_addn();
+    inline void o_subn();
+    inline void o_muln();
+    inline void o_divn();
+    inline void o_lessn();
+    inline void o_leqn();
+    inline void o_grtn();
+    inline void o_geqn();
+    inline void o_tcallfv();
     inline void o_ret();
 
 public:
 
     /* constructor of vm instance */
     vm() {
-        ctx.stack = new var[STACK_DEPTH];
+        ctx.stack = new var[STACK_INITIAL_SIZE];
         global = new var[STACK_DEPTH];
     }
     ~vm() {
@@ -181,23 +262,55 @@ public:
 
     /* execution entry */
     void run(
-        const codegen&,
+        codegen&,
         const linker&,
         const std::vector<std::string>&
     );
 
+    /* execution entry of precompiled bytecode image */
+    void run(
+        bytecode_image&,
+        const std::vector<std::string>&
+    );
+
     /* set detail report info flag */
     void set_detail_report_info(bool flag) {verbose = flag;}
     /* set repl mode flag */
     void set_repl_mode_flag(bool flag) {is_repl_mode = flag;}
     /* set repl output flag */
     void set_allow_repl_output_flag(bool flag) {allow_repl_output = flag;}
+    /* set jit flag, only works when built with NASAL_JIT */
+    void set_jit_flag(bool flag) {jit_enabled = flag;}
 };
 
+#ifdef NASAL_JIT
+// top is old pc of the new frame, checks stay inline so that
+// calls of cold callees cost no more than a few compares
+inline void vm::jit_function_call() {
+    auto& func = ctx.funcr.func();
+    auto& hotness = native.hotness(func.entry);
+    if (hotness<jit::hot_threshold &&
+        ++hotness==jit::hot_threshold &&
+        !native.find(func.entry)) {
+        jit_compile(func, jit::min_function_size);
+    }
+    if (jit_running || jit_tail_call) {
+        // native code enters the callee after leaving,
+        // and it is resumed when this frame returns
+        ctx.top[0] = var::ret(ctx.top[0].ret()|native_frame_mark);
+        jit_tail_call = false;
+        return;
+    }
+    if (native.find(ctx.pc+1)) {
+        jit_enter();
+    }
+}
+#endif
+
 inline bool vm::cond(var& val) {
-    if (val.type==vm_num) {
+    if (val.type()==vm_num) {
         return val.num();
-    } else if (val.type==vm_str) {
+    } else if (val.type()==vm_str) {
         const f64 num = str2num(val.str().c_str());
         return std::isnan(num)? !val.str().empty():num;
     }
@@ -212,25 +325,25 @@ inline void vm::o_repl() {
 }
 
 inline void vm::o_intl() {
-    ctx.top[0].func().local.resize(imm[ctx.pc], nil);
-    ctx.top[0].func().local_size = imm[ctx.pc];
+    ctx.top[0].func().local.resize(bytecode[ctx.pc].num, nil);
+    ctx.top[0].func().local_size = bytecode[ctx.pc].num;
 }
 
 inline void vm::o_loadg() {
-    global[imm[ctx.pc]] = (ctx.top--)[0];
+    global[bytecode[ctx.pc].num] = (ctx.top--)[0];
 }
 
 inline void vm::o_loadl() {
-    ctx.localr[imm[ctx.pc]] = (ctx.top--)[0];
+    ctx.localr[bytecode[ctx.pc].num] = (ctx.top--)[0];
 }
 
 inline void vm::o_loadu() {
-    ctx.funcr.func().upval[(imm[ctx.pc]>>16)&0xffff]
-                    .upval()[imm[ctx.pc]&0xffff] = (ctx.top--)[0];
+    ctx.funcr.func().upval[(bytecode[ctx.pc].num>>16)&0xffff]
+                    .upval()[bytecode[ctx.pc].num&0xffff] = (ctx.top--)[0];
 }
 
 inline void vm::o_pnum() {
-    (++ctx.top)[0] = var::num(const_number[imm[ctx.pc]]);
+    (++ctx.top)[0] = var::num(const_number[bytecode[ctx.pc].num]);
 }
 
 inline void vm::o_pnil() {
@@ -238,16 +351,16 @@ inline void vm::o_pnil() {
 }
 
 inline void vm::o_pstr() {
-    (++ctx.top)[0] = ngc.strs[imm[ctx.pc]];
+    (++ctx.top)[0] = ngc.strs[bytecode[ctx.pc].num];
 }
 
 inline void vm::o_newv() {
     var newv = ngc.alloc(vm_vec);
     auto& vec = newv.vec().elems;
-    vec.resize(imm[ctx.pc]);
+    vec.resize(bytecode[ctx.pc].num);
     // use top-=imm[pc]-1 here will cause error if imm[pc] is 0
-    ctx.top = ctx.top-imm[ctx.pc]+1;
-    for(u32 i = 0; i<imm[ctx.pc]; ++i) {
+    ctx.top = ctx.top-bytecode[ctx.pc].num+1;
+    for(u32 i = 0; i<bytecode[ctx.pc].num; ++i) {
         vec[i] = ctx.top[i];
     }
     ctx.top[0] = newv;
@@ -260,15 +373,16 @@ inline void vm::o_newh() {
 inline void vm::o_newf() {
     (++ctx.top)[0] = ngc.alloc(vm_func);
     auto& func = ctx.top[0].func();
-    func.entry = imm[ctx.pc];
+    func.entry = bytecode[ctx.pc].num;
     func.parameter_size = 1;
+    func.fixed_frame = fixed_frame_function[ctx.pc];
 
     /* this means you create a new function in local scope */
     if (ctx.localr) {
         func.upval = ctx.funcr.func().upval;
         // function created in the same local scope shares one closure
         // so this size & stk setting has no problem
-        var upval = (ctx.upvalr.type==vm_nil)? ngc.alloc(vm_upval):ctx.upvalr;
+        var upval = (ctx.upvalr.type()==vm_nil)? ngc.alloc(vm_upval):ctx.upvalr;
         upval.upval().size = ctx.funcr.func().local_size;
         upval.upval().stack_frame_offset = ctx.localr;
         func.upval.push_back(upval);
@@ -277,14 +391,16 @@ inline void vm::o_newf() {
 }
 
 inline void vm::o_happ() {
-    ctx.top[-1].hash().elems[const_string[imm[ctx.pc]]] = ctx.top[0];
+    const auto index = bytecode[ctx.pc].num;
+    ctx.top[-1].hash().at(const_string[index], const_string_hash[index]) =
+        ctx.top[0];
     --ctx.top;
 }
 
 inline void vm::o_para() {
     auto& func = ctx.top[0].func();
     // func->size has 1 place reserved for "me"
-    func.keys[const_string[imm[ctx.pc]]] = func.parameter_size;
+    func.keys[const_string[bytecode[ctx.pc].num]] = func.parameter_size;
     func.local[func.parameter_size++] = var::none();
 }
 
@@ -292,17 +408,17 @@ inline void vm::o_deft() {
     var val = ctx.top[0];
     auto& func = (--ctx.top)[0].func();
     // func->size has 1 place reserved for "me"
-    func.keys[const_string[imm[ctx.pc]]] = func.parameter_size;
+    func.keys[const_string[bytecode[ctx.pc].num]] = func.parameter_size;
     func.local[func.parameter_size++] = val;
 }
 
 inline void vm::o_dyn() {
-    ctx.top[0].func().dynamic_parameter_index = imm[ctx.pc];
+    ctx.top[0].func().dynamic_parameter_index = bytecode[ctx.pc].num;
 }
 
 inline void vm::o_lnot() {
     var val = ctx.top[0];
-    switch(val.type) {
+    switch(val.type()) {
         case vm_nil: ctx.top[0] = one; break;
         case vm_num: ctx.top[0] = val.num()? zero:one; break;
         case vm_str: {
@@ -351,17 +467,22 @@ inline void vm::o_btand() {
     --ctx.top;
 }
 
-#define op_calc(type)\
-    ctx.top[-1] = var::num(ctx.top[-1].to_num() type ctx.top[0].to_num());\
+// quicken: after running with two numbers, rewrite this instruction
+// to the num-num specialized one, which is used until its guard fails
+#define op_calc(sign, quickened)\
+    if (ctx.top[-1].type()==vm_num && ctx.top[0].type()==vm_num) {\
+        bytecode[ctx.pc].op = quickened;\
+    }\
+    ctx.top[-1] = var::num(ctx.top[-1].to_num() sign ctx.top[0].to_num());\
     --ctx.top;
 
-inline void vm::o_add() {op_calc(+);}
-inline void vm::o_sub() {op_calc(-);}
-inline void vm::o_mul() {op_calc(*);}
-inline void vm::o_div() {op_calc(/);}
+inline void vm::o_add() {op_calc(+, op_addn);}
+inline void vm::o_sub() {op_calc(-, op_subn);}
+inline void vm::o_mul() {op_calc(*, op_muln);}
+inline void vm::o_div() {op_calc(/, op_divn);}
 inline void vm::o_lnk() {
     // concat two vectors into one
-    if (ctx.top[-1].type==vm_vec && ctx.top[0].type==vm_vec) {
+    if (ctx.top[-1].type()==vm_vec && ctx.top[0].type()==vm_vec) {
         ngc.temp = ngc.alloc(vm_vec);
         for(auto i : ctx.top[-1].vec().elems) {
             ngc.temp.vec().elems.push_back(i);
@@ -380,14 +501,14 @@ inline void vm::o_lnk() {
 }
 
 #define op_calc_const(type)\
-    ctx.top[0] = var::num(ctx.top[0].to_num() type const_number[imm[ctx.pc]]);
+    ctx.top[0] = var::num(ctx.top[0].to_num() type const_number[bytecode[ctx.pc].num]);
 
 inline void vm::o_addc() {op_calc_const(+);}
 inline void vm::o_subc() {op_calc_const(-);}
 inline void vm::o_mulc() {op_calc_const(*);}
 inline void vm::o_divc() {op_calc_const(/);}
 inline void vm::o_lnkc() {
-    ctx.top[0] = ngc.newstr(ctx.top[0].to_str()+const_string[imm[ctx.pc]]);
+    ctx.top[0] = ngc.newstr(ctx.top[0].to_str()+const_string[bytecode[ctx.pc].num]);
 }
 
 // top[0] stores the value of memr[0], to avoid being garbage-collected
@@ -400,7 +521,7 @@ inline void vm::o_lnkc() {
         ctx.memr[0].to_num() type ctx.top[-1].to_num()\
     );\
     ctx.memr = nullptr;\
-    ctx.top -= imm[ctx.pc]+1;
+    ctx.top -= bytecode[ctx.pc].num+1;
 
 inline void vm::o_addeq() {op_calc_eq(+);}
 inline void vm::o_subeq() {op_calc_eq(-);}
@@ -411,7 +532,7 @@ inline void vm::o_lnkeq() {
         ctx.memr[0].to_str()+ctx.top[-1].to_str()
     );
     ctx.memr = nullptr;
-    ctx.top -= imm[ctx.pc]+1;
+    ctx.top -= bytecode[ctx.pc].num+1;
 }
 
 inline void vm::o_bandeq() {
@@ -420,7 +541,7 @@ inline void vm::o_bandeq() {
         static_cast<i32>(ctx.top[-1].to_num())
     );
     ctx.memr = nullptr;
-    ctx.top -= imm[ctx.pc]+1;
+    ctx.top -= bytecode[ctx.pc].num+1;
 }
 
 inline void vm::o_boreq() {
@@ -429,7 +550,7 @@ inline void vm::o_boreq() {
         static_cast<i32>(ctx.top[-1].to_num())
     );
     ctx.memr = nullptr;
-    ctx.top -= imm[ctx.pc]+1;
+    ctx.top -= bytecode[ctx.pc].num+1;
 }
 
 inline void vm::o_bxoreq() {
@@ -438,7 +559,7 @@ inline void vm::o_bxoreq() {
         static_cast<i32>(ctx.top[-1].to_num())
     );
     ctx.memr = nullptr;
-    ctx.top -= imm[ctx.pc]+1;
+    ctx.top -= bytecode[ctx.pc].num+1;
 }
 
 // top[0] stores the value of memr[0], to avoid being garbage-collected
@@ -448,7 +569,7 @@ inline void vm::o_bxoreq() {
 // but if b+=a+=1; the result of 'a+1' will be used later, imm[pc]>>31=0
 #define op_calc_eq_const(type)\
     ctx.top[0] = ctx.memr[0] = var::num(\
-        ctx.memr[0].to_num() type const_number[imm[ctx.pc]]\
+        ctx.memr[0].to_num() type const_number[bytecode[ctx.pc].num]\
     );\
     ctx.memr = nullptr;
 
@@ -458,14 +579,14 @@ inline void vm::o_muleqc() {op_calc_eq_const(*);}
 inline void vm::o_diveqc() {op_calc_eq_const(/);}
 inline void vm::o_lnkeqc() {
     ctx.top[0] = ctx.memr[0] = ngc.newstr(
-        ctx.memr[0].to_str()+const_string[imm[ctx.pc]]
+        ctx.memr[0].to_str()+const_string[bytecode[ctx.pc].num]
     );
     ctx.memr = nullptr;
 }
 
 #define op_calc_eq_const_and_pop(type)\
     ctx.top[0] = ctx.memr[0] = var::num(\
-        ctx.memr[0].to_num() type const_number[imm[ctx.pc]]\
+        ctx.memr[0].to_num() type const_number[bytecode[ctx.pc].num]\
     );\
     ctx.memr = nullptr;\
     --ctx.top;
@@ -476,7 +597,7 @@ inline void vm::o_mulecp() {op_calc_eq_const_and_pop(*);}
 inline void vm::o_divecp() {op_calc_eq_const_and_pop(/);}
 inline void vm::o_lnkecp() {
     ctx.top[0] = ctx.memr[0] = ngc.newstr(
-        ctx.memr[0].to_str()+const_string[imm[ctx.pc]]
+        ctx.memr[0].to_str()+const_string[bytecode[ctx.pc].num]
     );
     ctx.memr = nullptr;
     --ctx.top;
@@ -490,18 +611,18 @@ inline void vm::o_meq() {
     // this may cause gc, so we should temporarily put it on stack
     ctx.memr[0] = ctx.top[-1];
     ctx.memr = nullptr;
-    ctx.top -= imm[ctx.pc]+1;
+    ctx.top -= bytecode[ctx.pc].num+1;
 }
 
 inline void vm::o_eq() {
     var val2 = ctx.top[0];
     var val1 = (--ctx.top)[0];
-    if (val1.type==vm_nil && val2.type==vm_nil) {
+    if (val1.type()==vm_nil && val2.type()==vm_nil) {
         ctx.top[0] = one;
-    } else if (val1.type==vm_str && val2.type==vm_str) {
-        ctx.top[0] = (val1.str()==val2.str())? one:zero;
-    } else if ((val1.type==vm_num || val2.type==vm_num)
-        && val1.type!=vm_nil && val2.type!=vm_nil) {
+    } else if (val1.type()==vm_str && val2.type()==vm_str) {
+        ctx.top[0] = string_equal(val1, val2)? one:zero;
+    } else if ((val1.type()==vm_num || val2.type()==vm_num)
+        && val1.type()!=vm_nil && val2.type()!=vm_nil) {
         ctx.top[0] = (val1.to_num()==val2.to_num())? one:zero;
     } else {
         ctx.top[0] = (val1==val2)? one:zero;
@@ -511,29 +632,32 @@ inline void vm::o_eq() {
 inline void vm::o_neq() {
     var val2 = ctx.top[0];
     var val1 = (--ctx.top)[0];
-    if (val1.type==vm_nil && val2.type==vm_nil) {
+    if (val1.type()==vm_nil && val2.type()==vm_nil) {
         ctx.top[0] = zero;
-    } else if (val1.type==vm_str && val2.type==vm_str) {
-        ctx.top[0] = (val1.str()!=val2.str())? one:zero;
-    } else if ((val1.type==vm_num || val2.type==vm_num)
-        && val1.type!=vm_nil && val2.type!=vm_nil) {
+    } else if (val1.type()==vm_str && val2.type()==vm_str) {
+        ctx.top[0] = string_equal(val1, val2)? zero:one;
+    } else if ((val1.type()==vm_num || val2.type()==vm_num)
+        && val1.type()!=vm_nil && val2.type()!=vm_nil) {
         ctx.top[0] = (val1.to_num()!=val2.to_num())? one:zero;
     } else {
         ctx.top[0] = (val1!=val2)? one:zero;
     }
 }
 
-#define op_cmp(type)\
+#define op_cmp(sign, quickened)\
+    if (ctx.top[-1].type()==vm_num && ctx.top[0].type()==vm_num) {\
+        bytecode[ctx.pc].op = quickened;\
+    }\
     --ctx.top;\
-    ctx.top[0] = (ctx.top[0].to_num() type ctx.top[1].to_num())? one:zero;
+    ctx.top[0] = (ctx.top[0].to_num() sign ctx.top[1].to_num())? one:zero;
 
-inline void vm::o_less() {op_cmp(<);}
-inline void vm::o_leq() {op_cmp(<=);}
-inline void vm::o_grt() {op_cmp(>);}
-inline void vm::o_geq() {op_cmp(>=);}
+inline void vm::o_less() {op_cmp(<, op_lessn);}
+inline void vm::o_leq() {op_cmp(<=, op_leqn);}
+inline void vm::o_grt() {op_cmp(>, op_grtn);}
+inline void vm::o_geq() {op_cmp(>=, op_geqn);}
 
 #define op_cmp_const(type)\
-    ctx.top[0] = (ctx.top[0].to_num() type const_number[imm[ctx.pc]])? one:zero;
+    ctx.top[0] = (ctx.top[0].to_num() type const_number[bytecode[ctx.pc].num])? one:zero;
 
 inline void vm::o_lessc() {op_cmp_const(<);}
 inline void vm::o_leqc() {op_cmp_const(<=);}
@@ -545,27 +669,36 @@ inline void vm::o_pop() {
 }
 
 inline void vm::o_jmp() {
-    ctx.pc = imm[ctx.pc]-1;
+#ifdef NASAL_JIT
+    // backward jump is the back edge of a loop
+    if (jit_enabled && bytecode[ctx.pc].num<=ctx.pc) {
+        const auto back_edge = ctx.pc;
+        ctx.pc = bytecode[ctx.pc].num-1;
+        jit_loop(back_edge);
+        return;
+    }
+#endif
+    ctx.pc = bytecode[ctx.pc].num-1;
 }
 
 inline void vm::o_jt() {
     // jump true needs to reserve the result on stack
     // because conditional expression in nasal has return value
     if (cond(ctx.top[0])) {
-        ctx.pc = imm[ctx.pc]-1;
+        ctx.pc = bytecode[ctx.pc].num-1;
     }
 }
 
 inline void vm::o_jf() {
     // jump false doesn't need to reserve result
     if (!cond(ctx.top[0])) {
-        ctx.pc = imm[ctx.pc]-1;
+        ctx.pc = bytecode[ctx.pc].num-1;
     }
     --ctx.top;
 }
 
 inline void vm::o_cnt() {
-    if (ctx.top[0].type!=vm_vec) {
+    if (ctx.top[0].type()!=vm_vec) {
         die("must use vector in forindex/foreach but get "+
             type_name_string(ctx.top[0])
         );
@@ -575,8 +708,9 @@ inline void vm::o_cnt() {
 }
 
 inline void vm::o_findex() {
-    if ((usize)(++ctx.top[0].cnt())>=ctx.top[-1].vec().size()) {
-        ctx.pc = imm[ctx.pc]-1;
+    ctx.top[0] = var::cnt(ctx.top[0].cnt()+1);
+    if ((usize)(ctx.top[0].cnt())>=ctx.top[-1].vec().size()) {
+        ctx.pc = bytecode[ctx.pc].num-1;
         return;
     }
     ctx.top[1] = var::num(ctx.top[0].cnt());
@@ -585,8 +719,9 @@ inline void vm::o_findex() {
 
 inline void vm::o_feach() {
     auto& ref = ctx.top[-1].vec().elems;
-    if ((usize)(++ctx.top[0].cnt())>=ref.size()) {
-        ctx.pc = imm[ctx.pc]-1;
+    ctx.top[0] = var::cnt(ctx.top[0].cnt()+1);
+    if ((usize)(ctx.top[0].cnt())>=ref.size()) {
+        ctx.pc = bytecode[ctx.pc].num-1;
         return;
     }
     ctx.top[1] = ref[ctx.top[0].cnt()];
@@ -595,41 +730,41 @@ inline void vm::o_feach() {
 
 inline void vm::o_callg() {
     // get main stack directly
-    (++ctx.top)[0] = global[imm[ctx.pc]];
+    (++ctx.top)[0] = global[bytecode[ctx.pc].num];
 }
 
 inline void vm::o_calll() {
-    (++ctx.top)[0] = ctx.localr[imm[ctx.pc]];
+    (++ctx.top)[0] = ctx.localr[bytecode[ctx.pc].num];
 }
 
 inline void vm::o_upval() {
     (++ctx.top)[0] = ctx.funcr.func()
-        .upval[(imm[ctx.pc]>>16)&0xffff]
-        .upval()[imm[ctx.pc]&0xffff];
+        .upval[(bytecode[ctx.pc].num>>16)&0xffff]
+        .upval()[bytecode[ctx.pc].num&0xffff];
 }
 
 inline void vm::o_callv() {
     var val = ctx.top[0];
     var vec = (--ctx.top)[0];
-    if (vec.type==vm_vec) {
+    if (vec.type()==vm_vec) {
         ctx.top[0] = vec.vec().get_value(val.to_num());
-        if (ctx.top[0].type==vm_none) {
+        if (ctx.top[0].type()==vm_none) {
             die(report_out_of_range(val.to_num(), vec.vec().size()));
             return;
         }
-    } else if (vec.type==vm_hash) {
-        if (val.type!=vm_str) {
+    } else if (vec.type()==vm_hash) {
+        if (val.type()!=vm_str) {
             die("must use string as the key but get "+type_name_string(val));
             return;
         }
-        ctx.top[0] = vec.hash().get_value(val.str());
-        if (ctx.top[0].type==vm_none) {
+        ctx.top[0] = vec.hash().get_value(val.str(), string_key_hash(val));
+        if (ctx.top[0].type()==vm_none) {
             die(report_key_not_found(val.str(), vec.hash()));
             return;
-        } else if (ctx.top[0].type==vm_func) {
+        } else if (ctx.top[0].type()==vm_func) {
             ctx.top[0].func().local[0] = val; // 'me'
         }
-    } else if (vec.type==vm_str) {
+    } else if (vec.type()==vm_str) {
         const auto& str = vec.str();
         i32 num = val.to_num();
         i32 len = str.length();
@@ -640,13 +775,13 @@ inline void vm::o_callv() {
         ctx.top[0] = var::num(
             static_cast<f64>(static_cast<u8>(str[num>=0? num:num+len]))
         );
-    } else if (vec.type==vm_map) {
-        if (val.type!=vm_str) {
+    } else if (vec.type()==vm_map) {
+        if (val.type()!=vm_str) {
             die("must use string as the key but get "+type_name_string(val));
             return;
         }
-        ctx.top[0] = vec.map().get_value(val.str());
-        if (ctx.top[0].type==vm_none) {
+        ctx.top[0] = vec.map().get_value(val.str(), string_key_hash(val));
+        if (ctx.top[0].type()==vm_none) {
             die("cannot find symbol \""+val.str()+"\"");
             return;
         }
@@ -658,53 +793,110 @@ inline void vm::o_callv() {
 
 inline void vm::o_callvi() {
     var val = ctx.top[0];
-    if (val.type!=vm_vec) {
+    if (val.type()!=vm_vec) {
         die("must use a vector but get "+type_name_string(val));
         return;
     }
     // cannot use operator[],because this may cause overflow
-    (++ctx.top)[0] = val.vec().get_value(imm[ctx.pc]);
-    if (ctx.top[0].type==vm_none) {
-        die(report_out_of_range(imm[ctx.pc], val.vec().size()));
+    (++ctx.top)[0] = val.vec().get_value(bytecode[ctx.pc].num);
+    if (ctx.top[0].type()==vm_none) {
+        die(report_out_of_range(bytecode[ctx.pc].num, val.vec().size()));
         return;
     }
 }
 
 inline void vm::o_callh() {
     var val = ctx.top[0];
-    if (val.type!=vm_hash && val.type!=vm_map) {
+    if (val.type()!=vm_hash && val.type()!=vm_map) {
         die("must call a hash but get "+type_name_string(val));
         return;
     }
-    const auto& str = const_string[imm[ctx.pc]];
-    if (val.type==vm_hash) {
-        ctx.top[0] = val.hash().get_value(str);
+    const auto& str = const_string[bytecode[ctx.pc].num];
+    if (val.type()==vm_hash) {
+        auto addr = hash_member(val.hash(), bytecode[ctx.pc].num);
+        ctx.top[0] = addr? *addr:var::none();
     } else {
-        ctx.top[0] = val.map().get_value(str);
+        ctx.top[0] = val.map().get_value(
+            str, const_string_hash[bytecode[ctx.pc].num]);
     }
-    if (ctx.top[0].type==vm_none) {
-        val.type==vm_hash? 
+    if (ctx.top[0].type()==vm_none) {
+        val.type()==vm_hash? 
             die(report_key_not_found(str, val.hash())):
             die("cannot find symbol \"" + str + "\"");
         return;
-    } else if (ctx.top[0].type==vm_func) {
+    } else if (ctx.top[0].type()==vm_func) {
         ctx.top[0].func().local[0] = val; // 'me'
     }
 }
 
+// function without default parameter, dynamic parameter and closure
+// reuses the slot of function as "me", so arguments are already in
+// their slots. old funcr takes the place of old upvalr, upvalr is not
+// changed because this function never creates a closure
+/*  +-------------+
+*   | old pc      |
+*   +-------------+
+*   | old localr  |
+*   +-------------+
+*   | old funcr   |
+*   +-------------+
+*   | local scope |
+*   +-------------+
+*   | arguments   |
+*   +-------------+
+*   | me          | <- local pointer, slot of function
+*   +-------------+
+*/
+inline void vm::fixed_frame_call(var* local, u32 argc) {
+    var function = local[0];
+    const auto& func = function.func();
+
+    // called with exactly parameter_size-1 arguments, "arg" is nil
+    ctx.top = local+func.local_size;
+    local[0] = func.local[0];
+    for(u32 i = argc+1; i<func.local_size; ++i) {
+        local[i] = nil;
+    }
+
+    ctx.top[0] = ctx.funcr;
+    (++ctx.top)[0] = var::addr(ctx.localr);
+    (++ctx.top)[0] = var::ret(ctx.pc|fixed_frame_mark);
+    ctx.pc = func.entry-1;
+    ctx.localr = local;
+    ctx.funcr = function;
+#ifdef NASAL_JIT
+    if (jit_enabled) {
+        jit_function_call();
+    }
+#endif
+}
+
 inline void vm::o_callfv() {
-    const u32 argc = imm[ctx.pc]; // arguments counter
+    call_function(bytecode[ctx.pc].num);
+}
+
+// call function with argc arguments on stack, used by callfv and tcallfv
+inline void vm::call_function(u32 argc) {
     var* local = ctx.top-argc+1; // arguments begin address
-    if (local[-1].type!=vm_func) {
+    if (local[-1].type()!=vm_func) {
         die("must call a function but get "+type_name_string(local[-1]));
         return;
     }
     const auto& func = local[-1].func();
-
-    // swap funcr with local[-1]
-    var tmp = local[-1];
-    local[-1] = ctx.funcr;
-    ctx.funcr = tmp;
+    // top-argc+lsize(local) +1(old pc) +1(old localr) +1(old upvalr),
+    // stack is moved after growing
+    if (ctx.top-argc+func.local_size+3>=ctx.canary &&
+        grow_stack(func.local_size+3-argc)) {
+        local = ctx.top-argc+1;
+    }
+    // only exact arity uses fixed frame, lack of arguments and
+    // stack overflow are reported by generic path, which also
+    // collects overflowed arguments into "arg"
+    if (func.fixed_frame && argc+1==func.parameter_size &&
+        ctx.top-argc+func.local_size+3<ctx.canary) {
+        fixed_frame_call(local-1, argc);
+        return;
+    }
 
     // top-argc+lsize(local) +1(old pc) +1(old localr) +1(old upvalr)
     if (ctx.top-argc+func.local_size+3>=ctx.canary) {
@@ -713,11 +905,17 @@ inline void vm::o_callfv() {
     }
     // parameter size is func->psize-1, 1 is reserved for "me"
     const u32 parameter_size = func.parameter_size-1;
-    if (argc<parameter_size && func.local[argc+1].type==vm_none) {
+    if (argc<parameter_size && func.local[argc+1].type()==vm_none) {
         die(report_lack_arguments(argc, func));
         return;
     }
 
+    // swap funcr with local[-1] after checking, so the frame chain
+    // is still complete when call trace is generated by die
+    var tmp = local[-1];
+    local[-1] = ctx.funcr;
+    ctx.funcr = tmp;
+
     // load dynamic argument, default nil, for better performance
     var dynamic = nil;
     if (func.dynamic_parameter_index>=0) {
@@ -760,21 +958,27 @@ inline void vm::o_callfv() {
     ctx.pc = func.entry-1;
     ctx.localr = local;
     ctx.upvalr = nil;
+#ifdef NASAL_JIT
+    if (jit_enabled) {
+        jit_function_call();
+    }
+#endif
 }
 
 inline void vm::o_callfh() {
-    const auto& hash = ctx.top[0].hash().elems;
-    if (ctx.top[-1].type!=vm_func) {
+    const auto& hash = ctx.top[0].hash();
+    if (ctx.top[-1].type()!=vm_func) {
         die("must call a function but get "+type_name_string(ctx.top[-1]));
         return;
     }
     const auto& func = ctx.top[-1].func();
+    // fixed frame begins at the slot of function, see fixed_frame_call
+    const bool fixed_frame = func.fixed_frame;
     var tmp = ctx.top[-1];
-    ctx.top[-1] = ctx.funcr;
-    ctx.funcr = tmp;
 
     // top -1(hash) +lsize(local) +1(old pc) +1(old localr) +1(old upvalr)
-    if (ctx.top+func.local_size+2>= ctx.canary) {
+    if (ctx.top+func.local_size+2>=ctx.canary &&
+        !grow_stack(func.local_size+2)) {
         die("stack overflow");
         return;
     }
@@ -786,8 +990,8 @@ inline void vm::o_callfh() {
         return;
     }
 
-    var* local = ctx.top;
-    ctx.top += func.local_size;
+    var* local = fixed_frame? ctx.top-1:ctx.top;
+    ctx.top = local+func.local_size;
     for(u32 i = 0; i<func.local_size; ++i) {
         local[i] = func.local[i];
     }
@@ -795,9 +999,10 @@ inline void vm::o_callfh() {
     bool lack_arguments_flag = false;
     for(const auto& i : func.keys) {
         const auto& key = i.first;
-        if (hash.count(key)) {
-            local[i.second] = hash.at(key);
-        } else if (local[i.second].type==vm_none) {
+        auto slot = hash.shape->find(key);
+        if (slot>=0) {
+            local[i.second] = hash.slots[slot];
+        } else if (local[i.second].type()==vm_none) {
             lack_arguments_flag = true;
         }
     }
@@ -806,12 +1011,25 @@ inline void vm::o_callfh() {
         return;
     }
 
-    ctx.top[0] = ctx.upvalr;
+    // switch funcr after checking, see call_function
+    if (!fixed_frame) {
+        local[-1] = ctx.funcr;
+    }
+    ctx.top[0] = fixed_frame? ctx.funcr:ctx.upvalr;
     (++ctx.top)[0] = var::addr(ctx.localr);
-    (++ctx.top)[0] = var::ret(ctx.pc); // rewrite top with vm_ret
+    // rewrite top with vm_ret
+    (++ctx.top)[0] = var::ret(fixed_frame? ctx.pc|fixed_frame_mark:ctx.pc);
     ctx.pc=func.entry-1;
     ctx.localr = local;
-    ctx.upvalr = nil;
+    ctx.funcr = tmp;
+    if (!fixed_frame) {
+        ctx.upvalr = nil;
+    }
+#ifdef NASAL_JIT
+    if (jit_enabled) {
+        jit_function_call();
+    }
+#endif
 }
 
 inline void vm::o_callb() {
@@ -821,7 +1039,7 @@ inline void vm::o_callb() {
 
     // if running a native function about coroutine
     // (top) will be set to another context.top, instead of main_context.top
-    auto function_pointer = native_function[imm[ctx.pc]].func;
+    auto function_pointer = native_function[bytecode[ctx.pc].num].func;
     var result = (*function_pointer)(&ctx, &ngc);
 
     // so we use tmp variable to store this return value
@@ -829,7 +1047,7 @@ inline void vm::o_callb() {
     ctx.top[0] = result;
 
     // if get none, this means errors occurred when calling this native function
-    if (ctx.top[0].type==vm_none) {
+    if (ctx.top[0].type()==vm_none) {
         die("error occurred in native function");
         return;
     }
@@ -842,7 +1060,7 @@ inline void vm::o_slcbeg() {
     // | resource_vec | <-- top[-1]
     // +--------------+
     (++ctx.top)[0] = ngc.alloc(vm_vec);
-    if (ctx.top[-1].type!=vm_vec) {
+    if (ctx.top[-1].type()!=vm_vec) {
         die("must slice a vector but get "+type_name_string(ctx.top[-1]));
         return;
     }
@@ -856,7 +1074,7 @@ inline void vm::o_slcend() {
 inline void vm::o_slc() {
     var val = (ctx.top--)[0];
     var res = ctx.top[-1].vec().get_value(val.to_num());
-    if (res.type==vm_none) {
+    if (res.type()==vm_none) {
         die(report_out_of_range(val.to_num(), ctx.top[-1].vec().size()));
         return;
     }
@@ -869,7 +1087,7 @@ inline void vm::o_slc2() {
     const auto& ref = ctx.top[-1].vec().elems;
     auto& aim = ctx.top[0].vec().elems;
 
-    u8 type1 = val1.type,type2=val2.type;
+    u8 type1 = val1.type(),type2=val2.type();
     i32 num1 = val1.to_num();
     i32 num2 = val2.to_num();
     i32 size = ref.size();
@@ -896,14 +1114,14 @@ inline void vm::o_slc2() {
 }
 
 inline void vm::o_mcallg() {
-    ctx.memr = global+imm[ctx.pc];
+    ctx.memr = global+bytecode[ctx.pc].num;
     (++ctx.top)[0] = ctx.memr[0];
     // push value in this memory space on stack
     // to avoid being garbage collected
 }
 
 inline void vm::o_mcalll() {
-    ctx.memr = ctx.localr+imm[ctx.pc];
+    ctx.memr = ctx.localr+bytecode[ctx.pc].num;
     (++ctx.top)[0] = ctx.memr[0];
     // push value in this memory space on stack
     // to avoid being garbage collected
@@ -912,8 +1130,8 @@ inline void vm::o_mcalll() {
 inline void vm::o_mupval() {
     ctx.memr = &(
         ctx.funcr.func()
-           .upval[(imm[ctx.pc]>>16)&0xffff]
-           .upval()[imm[ctx.pc]&0xffff]
+           .upval[(bytecode[ctx.pc].num>>16)&0xffff]
+           .upval()[bytecode[ctx.pc].num&0xffff]
     );
     (++ctx.top)[0] = ctx.memr[0];
     // push value in this memory space on stack
@@ -923,32 +1141,32 @@ inline void vm::o_mupval() {
 inline void vm::o_mcallv() {
     var val = ctx.top[0];     // index
     var vec = (--ctx.top)[0]; // mcall vector, reserved on stack to avoid gc
-    if (vec.type==vm_vec) {
+    if (vec.type()==vm_vec) {
         ctx.memr = vec.vec().get_memory(val.to_num());
         if (!ctx.memr) {
             die(report_out_of_range(val.to_num(), vec.vec().size()));
             return;
         }
-    } else if (vec.type==vm_hash) { // do mcallh but use the mcallv way
-        if (val.type!=vm_str) {
+    } else if (vec.type()==vm_hash) { // do mcallh but use the mcallv way
+        if (val.type()!=vm_str) {
             die("must use string as the key but get "+type_name_string(val));
             return;
         }
         auto& ref = vec.hash();
         const auto& str = val.str();
-        ctx.memr = ref.get_memory(str);
+        const auto hash = string_key_hash(val);
+        ctx.memr = ref.get_memory(str, hash);
         if (!ctx.memr) {
-            ref.elems[str] = nil;
-            ctx.memr = ref.get_memory(str);
+            ctx.memr = &ref.at(str, hash);
         }
-    } else if (vec.type==vm_map) {
-        if (val.type!=vm_str) {
+    } else if (vec.type()==vm_map) {
+        if (val.type()!=vm_str) {
             die("must use string as the key but get "+type_name_string(val));
             return;
         }
         auto& ref = vec.map();
         const auto& str = val.str();
-        ctx.memr = ref.get_memory(str);
+        ctx.memr = ref.get_memory(str, string_key_hash(val));
         if (!ctx.memr) {
             die("cannot find symbol \"" + str + "\"");
         }
@@ -960,27 +1178,318 @@ inline void vm::o_mcallv() {
 
 inline void vm::o_mcallh() {
     var hash = ctx.top[0]; // mcall hash, reserved on stack to avoid gc
-    if (hash.type!=vm_hash && hash.type!=vm_map) {
+    if (hash.type()!=vm_hash && hash.type()!=vm_map) {
         die("must call a hash/namespace but get "+type_name_string(hash));
         return;
     }
-    const auto& str = const_string[imm[ctx.pc]];
-    if (hash.type==vm_map) {
-        ctx.memr = hash.map().get_memory(str);
+    const auto& str = const_string[bytecode[ctx.pc].num];
+    if (hash.type()==vm_map) {
+        ctx.memr = hash.map().get_memory(
+            str, const_string_hash[bytecode[ctx.pc].num]);
         if (!ctx.memr) {
             die("cannot find symbol \"" + str + "\"");
         }
         return;
     }
     auto& ref = hash.hash();
-    ctx.memr = ref.get_memory(str);
+    ctx.memr = hash_member(ref, bytecode[ctx.pc].num);
     // create a new key
     if (!ctx.memr) {
-        ref.elems[str] = nil;
-        ctx.memr = ref.get_memory(str);
+        ctx.memr = &ref.at(str, const_string_hash[bytecode[ctx.pc].num]);
+    }
+}
+
+inline var* vm::hash_cache_find(nas_hash* hash, const hash_cache& cache) {
+    if (!cache.depth) {
+        return nullptr;
+    }
+    for(u32 i = 0; i+1<cache.depth; ++i) {
+        if (hash->shape->id!=cache.shape[i]) {
+            return nullptr;
+        }
+        auto& parents = hash->slots[cache.parents[i]];
+        if (parents.type()!=vm_vec || !parents.vec().size() ||
+            parents.vec().elems[0].type()!=vm_hash) {
+            return nullptr;
+        }
+        hash = &parents.vec().elems[0].hash();
+    }
+    if (hash->shape->id!=cache.shape[cache.depth-1]) {
+        return nullptr;
+    }
+    return &hash->slots[cache.slot];
+}
+
+// lookup through parents[0] is the same as the first path that
+// nas_hash::get_memory searches, so the found slot is the same
+inline var* vm::hash_cache_fill(
+    nas_hash* hash, u32 index, hash_cache& cache) {
+    const auto& key = const_string[index];
+    const auto key_hash = const_string_hash[index];
+    cache.depth = 0;
+    for(u32 i = 0; i<hash_cache::max_depth; ++i) {
+        // dictionary shape is changed in place, so it is not cached
+        if (!hash->shape->shared()) {
+            return nullptr;
+        }
+        cache.shape[i] = hash->shape->id;
+        auto slot = hash->shape->find(key, key_hash);
+        if (slot>=0) {
+            cache.slot = slot;
+            cache.depth = i+1;
+            return &hash->slots[slot];
+        }
+        if (hash->shape->parents<0 || i+1==hash_cache::max_depth) {
+            return nullptr;
+        }
+        auto& parents = hash->slots[hash->shape->parents];
+        if (parents.type()!=vm_vec || !parents.vec().size() ||
+            parents.vec().elems[0].type()!=vm_hash) {
+            return nullptr;
+        }
+        cache.parents[i] = hash->shape->parents;
+        hash = &parents.vec().elems[0].hash();
+    }
+    return nullptr;
+}
+
+// index is the index of key in constant strings
+inline var* vm::hash_member(nas_hash& hash, u32 index) {
+    auto& cache = inline_cache[ctx.pc];
+    auto res = hash_cache_find(&hash, cache);
+    if (res) {
+        return res;
+    }
+    res = hash_cache_fill(&hash, index, cache);
+    return res? res:
+        hash.get_memory(const_string[index], const_string_hash[index]);
+}
+
+// superinstructions generated by peephole optimizer,
+// the following opcodes in the same group are only used as operands
+inline void vm::cmp_const_jf(var& val) {
+    const auto& cmp = bytecode[ctx.pc+1];
+    const f64 left = val.to_num();
+    const f64 right = const_number[cmp.num];
+    bool res = false;
+    switch(cmp.op) {
+        case op_lessc: res = left<right; break;
+        case op_leqc: res = left<=right; break;
+        case op_grtc: res = left>right; break;
+        case op_geqc: res = left>=right; break;
+    }
+    // skip operands, or jump to the address stored in jf
+    ctx.pc = res? ctx.pc+2:bytecode[ctx.pc+2].num-1;
+}
+
+inline void vm::calc_const(var& val) {
+    const auto& calc = bytecode[ctx.pc+1];
+    const f64 right = const_number[calc.num];
+    switch(calc.op) {
+        case op_addecp: val = var::num(val.to_num()+right); break;
+        case op_subecp: val = var::num(val.to_num()-right); break;
+        case op_mulecp: val = var::num(val.to_num()*right); break;
+        case op_divecp: val = var::num(val.to_num()/right); break;
+    }
+    // skip operand
+    ++ctx.pc;
+}
+
+inline void vm::counted_loop(var& val) {
+    // +-----------------+
+    // | lloop/gloop     | <-- pc
+    // | addecp/subecp   |
+    // | jmp check       |
+    // +-----------------+
+    // | calll/callg     | <-- check, maybe fused into lcmpjf/gcmpjf
+    // | lessc/.../geqc  |
+    // | jf exit         |
+    // +-----------------+
+    // | loop body       |
+    // +-----------------+
+    const auto& step = bytecode[ctx.pc+1];
+    const auto check = bytecode[ctx.pc+2].num;
+    const auto& cmp = bytecode[check+1];
+    f64 counter = val.to_num();
+    counter += step.op==op_addecp? const_number[step.num]:-const_number[step.num];
+    val = var::num(counter);
+
+    const f64 limit = const_number[cmp.num];
+    bool res = false;
+    switch(cmp.op) {
+        case op_lessc: res = counter<limit; break;
+        case op_leqc: res = counter<=limit; break;
+        case op_grtc: res = counter>limit; break;
+        case op_geqc: res = counter>=limit; break;
+    }
+    // jump to the loop body, or to the address stored in jf
+#ifdef NASAL_JIT
+    // jump back to the loop body is the back edge of a loop
+    if (res && jit_enabled) {
+        const auto back_edge = ctx.pc;
+        ctx.pc = check+2;
+        jit_loop(back_edge);
+        return;
+    }
+#endif
+    ctx.pc = res? check+2:bytecode[check+2].num-1;
+}
+
+inline void vm::o_lcmpjf() {
+    cmp_const_jf(ctx.localr[bytecode[ctx.pc].num]);
+}
+
+inline void vm::o_gcmpjf() {
+    cmp_const_jf(global[bytecode[ctx.pc].num]);
+}
+
+inline void vm::o_lcalc() {
+    calc_const(ctx.localr[bytecode[ctx.pc].num]);
+}
+
+inline void vm::o_gcalc() {
+    calc_const(global[bytecode[ctx.pc].num]);
+}
+
+inline void vm::o_lloop() {
+    counted_loop(ctx.localr[bytecode[ctx.pc].num]);
+}
+
+inline void vm::o_gloop() {
+    counted_loop(global[bytecode[ctx.pc].num]);
+}
+
+// quickened instructions, de-quicken and run the generic one
+// if any operand is not a number
+#define op_calc_num(sign, generic)\
+    if (ctx.top[-1].type()!=vm_num || ctx.top[0].type()!=vm_num) {\
+        bytecode[ctx.pc].op = op_##generic;\
+        o_##generic();\
+        return;\
+    }\
+    ctx.top[-1] = var::num(ctx.top[-1].num() sign ctx.top[0].num());\
+    --ctx.top;
+
+inline void vm::o_addn() {op_calc_num(+, add);}
+inline void vm::o_subn() {op_calc_num(-, sub);}
+inline void vm::o_muln() {op_calc_num(*, mul);}
+inline void vm::o_divn() {op_calc_num(/, div);}
+
+#define op_cmp_num(sign, generic)\
+    if (ctx.top[-1].type()!=vm_num || ctx.top[0].type()!=vm_num) {\
+        bytecode[ctx.pc].op = op_##generic;\
+        o_##generic();\
+        return;\
+    }\
+    --ctx.top;\
+    ctx.top[0] = (ctx.top[0].num() sign ctx.top[1].num())? one:zero;
+
+inline void vm::o_lessn() {op_cmp_num(<, less);}
+inline void vm::o_leqn() {op_cmp_num(<=, leq);}
+inline void vm::o_grtn() {op_cmp_num(>, grt);}
+inline void vm::o_geqn() {op_cmp_num(>=, geq);}
+
+inline void vm::o_callnb() {
+    // +--------------+
+    // | nil (arg)    | <-- top[0]
+    // +--------------+
+    // | argument n   |
+    // +--------------+
+    // | ...          |
+    // +--------------+
+    // | argument 1   |
+    // +--------------+
+    // | nil (me)     | <-- localr, native function gets arguments by
+    // +--------------+     localr[1] ... localr[n], like in the wrapper
+    // | caller value | <-- frame
+    // +--------------+
+    // arguments are moved up one slot, so me and arg are nil like in
+    // the wrapper frame, and the caller value below is kept
+    const auto argc = bytecode[ctx.pc].num>>16;
+    // +1(me) +1(arg), stack is moved after growing
+    if (ctx.top+2>=ctx.canary && !grow_stack(2)) {
+        die("stack overflow");
+        return;
+    }
+    auto frame = ctx.top-argc;
+    for(u32 i = argc; i>0; --i) {
+        frame[i+1] = frame[i];
+    }
+    frame[1] = nil;
+    ctx.top += 2;
+    ctx.top[0] = nil;
+
+    auto local = ctx.localr;
+    ctx.localr = frame+1;
+    auto function_pointer = native_function[bytecode[ctx.pc].num&0xffff].func;
+    var result = (*function_pointer)(&ctx, &ngc);
+
+    // arguments are popped and replaced by the return value
+    ctx.localr = local;
+    ctx.top = frame+1;
+    ctx.top[0] = result;
+    if (ctx.top[0].type()==vm_none) {
+        die("error occurred in native function");
+        return;
+    }
+}
+
+// copy local scope into upvalue when the frame is going to be dropped,
+// then closures created in this frame use the copy
+inline void vm::close_upvalue(nas_upval& upval, var* local, u32 size) {
+    upval.on_stack = false;
+    upval.elems.resize(size);
+    for(u32 i = 0; i<size; ++i) {
+        upval.elems[i] = local[i];
     }
 }
 
+// tail call: drop the frame of current function like ret,
+// then call the function from the caller of current function,
+// so tail recursion does not make the stack grow
+inline void vm::o_tcallfv() {
+    const u32 argc = bytecode[ctx.pc].num;
+    var* callee = ctx.top-argc;
+    // errors are reported by normal call with current frame on stack
+    if (!ctx.localr || callee[0].type()!=vm_func) {
+        call_function(argc);
+        return;
+    }
+    const auto& func = callee[0].func();
+    if (argc+1<func.parameter_size && func.local[argc+1].type()==vm_none) {
+        call_function(argc);
+        return;
+    }
+
+    // old upvalr (old funcr in fixed frame), old localr and old pc
+    var* local = ctx.localr;
+    const auto& current = ctx.funcr.func();
+    const var* info = local+current.local_size;
+    var* base = local;
+    if (info[2].ret()&fixed_frame_mark) {
+        ctx.funcr = info[0];
+    } else {
+        if (ctx.upvalr.type()==vm_upval) {
+            close_upvalue(ctx.upvalr.upval(), local, current.local_size);
+        }
+        ctx.upvalr = info[0];
+        ctx.funcr = local[-1];
+        base = local-1;
+    }
+    ctx.localr = info[1].addr();
+    ctx.pc = info[2].ret()&~frame_mark;
+#ifdef NASAL_JIT
+    jit_tail_call = info[2].ret()&native_frame_mark;
+#endif
+
+    // move function and arguments to the place of dropped frame
+    for(u32 i = 0; i<=argc; ++i) {
+        base[i] = callee[i];
+    }
+    ctx.top = base+argc;
+    call_function(argc);
+}
+
 inline void vm::o_ret() {
 /*  +-------------+
 *   | return value| <- top[0]
@@ -999,33 +1508,49 @@ inline void vm::o_ret() {
     var  ret   = ctx.top[0];
     var* local = ctx.localr;
     var  func  = ctx.funcr;
-    var  up    = ctx.upvalr;
 
-    ctx.pc     = ctx.top[-1].ret();
+    const u32 old_pc = ctx.top[-1].ret();
+    ctx.pc     = old_pc&~frame_mark;
     ctx.localr = ctx.top[-2].addr();
-    ctx.upvalr = ctx.top[-3];
-
-    ctx.top = local-1;
-    ctx.funcr = ctx.top[0];
-    ctx.top[0] = ret; // rewrite func with returned value
-
-    // synchronize upvalue
-    if (up.type==vm_upval) {
-        auto& upval = up.upval();
-        auto size = func.func().local_size;
-        upval.on_stack = false;
-        upval.elems.resize(size);
-        for(u32 i = 0; i<size; ++i) {
-            upval.elems[i] = local[i];
+
+    // fixed frame stores old funcr instead of old upvalr,
+    // see fixed_frame_call
+    if (old_pc&fixed_frame_mark) {
+        ctx.funcr = ctx.top[-3];
+        ctx.top = local;
+        ctx.top[0] = ret;
+    } else {
+        var up = ctx.upvalr;
+        ctx.upvalr = ctx.top[-3];
+
+        ctx.top = local-1;
+        ctx.funcr = ctx.top[0];
+        ctx.top[0] = ret; // rewrite func with returned value
+
+        // synchronize upvalue
+        if (up.type()==vm_upval) {
+            close_upvalue(up.upval(), local, func.func().local_size);
         }
     }
 
+    // release stack memory after returning from deep recursion
+    if (ctx.canary-ctx.stack>=STACK_INITIAL_SIZE &&
+        ctx.top-ctx.stack<(ctx.canary-ctx.stack)/4) {
+        shrink_stack();
+    }
+
     // cannot use gc.cort to judge,
     // because there maybe another function call inside but return here
     // coroutine function ends with setting pc to 0
     if (!ctx.pc) {
         ngc.context_reserve();
     }
+#ifdef NASAL_JIT
+    // go on running native code of the caller
+    if (old_pc&native_frame_mark) {
+        jit_enter();
+    }
+#endif
 }
 
 }
@@ -1,7 +1,141 @@
 #include "optimizer.h"
+#include "symbol_finder.h"
+#include "nasal_type.h"
+
+#include <cstring>
 
 namespace nasal {
 
+void assignment_finder::enter_scope(code_block* node,
+                                    const std::vector<std::string>& implicit) {
+    scope.push_back(node);
+    auto& table = symbols[node];
+    // symbols are visible in the whole scope, even before definition
+    symbol_finder finder;
+    for(const auto& i : finder.do_find(node)) {
+        table[i.name];
+    }
+    // implicit symbols are set by vm, so they are not constant
+    for(const auto& i : implicit) {
+        table[i].assigned = true;
+    }
+}
+
+void assignment_finder::add_definition(const std::string& name,
+                                       const span& location) {
+    auto& info = symbols[scope.back()][name];
+    if (!info.definition_count) {
+        info.file = location.file;
+    }
+    ++info.definition_count;
+}
+
+void assignment_finder::add_assigned(expr* node) {
+    // a[0] = 1 or a.b = 1 only changes the content of a
+    if (node->get_type()!=expr_type::ast_id) {
+        return;
+    }
+    const auto& name = ((identifier*)node)->get_name();
+    auto body = resolve(scope, name);
+    if (body) {
+        symbols.at(body).at(name).assigned = true;
+    }
+}
+
+code_block* assignment_finder::resolve(const std::vector<code_block*>& stack,
+                                       const std::string& name) const {
+    for(auto i = stack.rbegin(); i!=stack.rend(); ++i) {
+        if (symbols.count(*i) && symbols.at(*i).count(name)) {
+            return *i;
+        }
+    }
+    return nullptr;
+}
+
+const assignment_finder::symbol_state& assignment_finder::state(
+    code_block* node, const std::string& name) const {
+    return symbols.at(node).at(name);
+}
+
+bool assignment_finder::visit_identifier(identifier* node) {
+    if (node->get_name()=="globals") {
+        use_globals = true;
+    }
+    return true;
+}
+
+bool assignment_finder::visit_function(function* node) {
+    enter_scope(node->get_code_block(), {"me", "arg"});
+    for(auto i : node->get_parameter_list()) {
+        visit(i);
+    }
+    visit(node->get_code_block());
+    scope.pop_back();
+    return true;
+}
+
+bool assignment_finder::visit_parameter(parameter* node) {
+    add_definition(node->get_parameter_name(), node->get_location());
+    if (node->get_default_value()) {
+        visit(node->get_default_value());
+    }
+    return true;
+}
+
+bool assignment_finder::visit_definition_expr(definition_expr* node) {
+    if (node->get_variable_name()) {
+        const auto name = node->get_variable_name();
+        add_definition(name->get_name(), name->get_location());
+    } else {
+        for(auto i : node->get_variables()->get_variables()) {
+            add_definition(i->get_name(), i->get_location());
+        }
+    }
+    if (node->get_tuple()) {
+        visit(node->get_tuple());
+    } else {
+        visit(node->get_value());
+    }
+    return true;
+}
+
+bool assignment_finder::visit_assignment_expr(assignment_expr* node) {
+    add_assigned(node->get_left());
+    visit(node->get_left());
+    visit(node->get_right());
+    return true;
+}
+
+bool assignment_finder::visit_multi_assign(multi_assign* node) {
+    for(auto i : node->get_tuple()->get_elements()) {
+        add_assigned(i);
+    }
+    visit(node->get_tuple());
+    visit(node->get_value());
+    return true;
+}
+
+bool assignment_finder::visit_iter_expr(iter_expr* node) {
+    if (node->get_name()) {
+        if (node->is_definition()) {
+            add_definition(node->get_name()->get_name(),
+                           node->get_name()->get_location());
+        } else {
+            add_assigned(node->get_name());
+        }
+        visit(node->get_name());
+    } else {
+        visit(node->get_call());
+    }
+    return true;
+}
+
+void assignment_finder::do_find(code_block* root) {
+    enter_scope(root, {"globals", "arg"});
+    visit(root);
+    scope.clear();
+}
+
 void optimizer::const_string(
     binary_operator* node,
     string_literal* left_node,
@@ -66,8 +200,8 @@ void optimizer::const_number(
 }
 
 bool optimizer::visit_binary_operator(binary_operator* node) {
-    node->get_left()->accept(this);
-    node->get_right()->accept(this);
+    node->set_left(fold(node->get_left()));
+    node->set_right(fold(node->get_right()));
     number_literal* left_num_node = nullptr;
     number_literal* right_num_node = nullptr;
     string_literal* left_str_node = nullptr;
@@ -115,7 +249,7 @@ bool optimizer::visit_binary_operator(binary_operator* node) {
 }
 
 bool optimizer::visit_unary_operator(unary_operator* node) {
-    node->get_value()->accept(this);
+    node->set_value(fold(node->get_value()));
     number_literal* value_node = nullptr;
     if (node->get_value()->get_type()==expr_type::ast_num) {
         value_node = (number_literal*)node->get_value();
@@ -132,8 +266,764 @@ bool optimizer::visit_unary_operator(unary_operator* node) {
     return true;
 }
 
+expr* optimizer::constant_of(expr* node) {
+    switch(node->get_type()) {
+        case expr_type::ast_num:
+        case expr_type::ast_str:
+            return node;
+        case expr_type::ast_binary:
+            if (((binary_operator*)node)->get_optimized_number()) {
+                return ((binary_operator*)node)->get_optimized_number();
+            }
+            return ((binary_operator*)node)->get_optimized_string();
+        case expr_type::ast_unary:
+            return ((unary_operator*)node)->get_optimized_number();
+        case expr_type::ast_id: {
+            const auto& name = ((identifier*)node)->get_name();
+            auto body = symbols.resolve(scope, name);
+            if (body && constant.count(body) && constant.at(body).count(name)) {
+                return constant.at(body).at(name);
+            }
+            return nullptr;
+        }
+        default: break;
+    }
+    return nullptr;
+}
+
+expr* optimizer::copy_constant(expr* node, const span& location) {
+    if (node->get_type()==expr_type::ast_num) {
+        return new number_literal(location,
+            ((number_literal*)node)->get_number());
+    }
+    return new string_literal(location,
+        ((string_literal*)node)->get_content());
+}
+
+// same as vm::cond, return false if the condition is not constant
+bool optimizer::constant_condition(expr* node, bool& result) {
+    if (node->get_type()==expr_type::ast_nil) {
+        result = false;
+        return true;
+    }
+    if (node->get_type()==expr_type::ast_bool) {
+        result = ((bool_literal*)node)->get_flag();
+        return true;
+    }
+    auto value = constant_of(node);
+    if (!value) {
+        return false;
+    }
+    if (value->get_type()==expr_type::ast_num) {
+        result = ((number_literal*)value)->get_number();
+        return true;
+    }
+    const auto str = ((string_literal*)value)->get_content();
+    const auto num = str2num(str.c_str());
+    result = std::isnan(num)? !str.empty():num;
+    return true;
+}
+
+bool optimizer::is_constant_variable(code_block* body,
+                                     const std::string& name) {
+    // global variables could be changed by globals.name = ...
+    if (body==scope.front() && symbols.use_globals) {
+        return false;
+    }
+    const auto& info = symbols.state(body, name);
+    return info.definition_count==1 && !info.assigned;
+}
+
+bool optimizer::is_pure_builtin(const std::string& name) {
+    static const std::unordered_set<std::string> pure_builtin = {
+        "size", "chr", "int", "floor", "ceil", "num", "str",
+        "streq", "cmp", "left", "right", "substr"
+    };
+    // native function names could not be used by other symbols
+    if (name.length()>2 && name.substr(0, 2)=="__") {
+        return pure_builtin.count(name.substr(2));
+    }
+    if (!pure_builtin.count(name)) {
+        return false;
+    }
+    // it should be the global wrapper function in lib.nas
+    auto body = symbols.resolve(scope, name);
+    if (body!=scope.front() || !is_constant_variable(body, name)) {
+        return false;
+    }
+    auto file = symbols.state(body, name).file;
+    const auto pos = file.find_last_of("/\\");
+    if (pos!=std::string::npos) {
+        file = file.substr(pos+1);
+    }
+    return file=="lib.nas";
+}
+
+expr* optimizer::fold_builtin(call_expr* node) {
+    if (node->get_first()->get_type()!=expr_type::ast_id ||
+        node->get_calls().size()!=1 ||
+        node->get_calls()[0]->get_type()!=expr_type::ast_callf) {
+        return nullptr;
+    }
+    auto name = ((identifier*)node->get_first())->get_name();
+    if (!is_pure_builtin(name)) {
+        return nullptr;
+    }
+    if (name.substr(0, 2)=="__") {
+        name = name.substr(2);
+    }
+
+    // all arguments should be constant number or string
+    std::vector<expr*> args;
+    for(auto i : ((call_function*)node->get_calls()[0])->get_argument()) {
+        auto value = constant_of(i);
+        if (!value) {
+            return nullptr;
+        }
+        args.push_back(value);
+    }
+    auto is_num = [&](usize i) {
+        return args[i]->get_type()==expr_type::ast_num;
+    };
+    auto is_str = [&](usize i) {
+        return args[i]->get_type()==expr_type::ast_str;
+    };
+    auto num = [&](usize i) {
+        return ((number_literal*)args[i])->get_number();
+    };
+    auto str = [&](usize i) {
+        return ((string_literal*)args[i])->get_content();
+    };
+    // avoid undefined behavior when converting to integer
+    auto in_i32 = [](f64 n) {
+        return -2147483648.0<=n && n<2147483648.0;
+    };
+
+    const auto& location = node->get_location();
+    // results should be the same as native functions in nasal_builtin.cpp,
+    // runtime errors are not folded, so they are still reported by vm
+    if (name=="size" && args.size()==1) {
+        if (is_num(0)) {
+            return new number_literal(location, num(0));
+        }
+        return new number_literal(location, str(0).length());
+    }
+    if (name=="chr" && args.size()==1 && is_num(0) &&
+        0<=num(0) && num(0)<128) {
+        return new string_literal(location,
+            std::string(1, (char)static_cast<i32>(num(0))));
+    }
+    if (name=="int" && args.size()==1) {
+        const auto value = is_num(0)? num(0):str2num(str(0).c_str());
+        if (!in_i32(value)) {
+            return nullptr;
+        }
+        return new number_literal(location,
+            static_cast<f64>(static_cast<i32>(value)));
+    }
+    if ((name=="floor" || name=="ceil") && args.size()==1 && is_num(0)) {
+        return new number_literal(location,
+            name=="floor"? std::floor(num(0)):std::ceil(num(0)));
+    }
+    if (name=="num" && args.size()==1) {
+        const auto value = is_num(0)? num(0):str2num(str(0).c_str());
+        if (std::isnan(value)) {
+            return nullptr;
+        }
+        return new number_literal(location, value);
+    }
+    if (name=="str" && args.size()==1) {
+        return new string_literal(location,
+            is_num(0)? var::num(num(0)).to_str():str(0));
+    }
+    if (name=="streq" && args.size()==2) {
+        return new number_literal(location,
+            (is_str(0) && is_str(1))? (str(0)==str(1)):0);
+    }
+    if (name=="cmp" && args.size()==2 && is_str(0) && is_str(1)) {
+        return new number_literal(location,
+            strcmp(str(0).c_str(), str(1).c_str()));
+    }
+    if (name=="left" && args.size()==2 && is_str(0) && is_num(1) &&
+        in_i32(num(1))) {
+        return new string_literal(location,
+            num(1)<0? "":str(0).substr(0, num(1)));
+    }
+    if (name=="right" && args.size()==2 && is_str(0) && is_num(1) &&
+        in_i32(num(1))) {
+        const auto source = str(0);
+        i32 length = static_cast<i32>(num(1));
+        i32 srclen = source.length();
+        length = length>srclen? srclen:(length<0? 0:length);
+        return new string_literal(location,
+            source.substr(srclen-length, srclen));
+    }
+    if (name=="substr" && args.size()==3 && is_str(0) &&
+        is_num(1) && is_num(2) && num(1)>=0 && num(2)>=0 &&
+        num(1)<str(0).length() && in_i32(num(2))) {
+        return new string_literal(location,
+            str(0).substr((usize)num(1), (usize)num(2)));
+    }
+    return nullptr;
+}
+
+expr* optimizer::fold(expr* node) {
+    if (!node) {
+        return node;
+    }
+    visit(node);
+    expr* result = nullptr;
+    if (node->get_type()==expr_type::ast_id) {
+        auto value = constant_of(node);
+        if (value) {
+            result = copy_constant(value, node->get_location());
+        }
+    } else if (node->get_type()==expr_type::ast_call) {
+        result = fold_builtin((call_expr*)node);
+        if (!result) {
+            result = inline_call((call_expr*)node);
+        }
+    }
+    if (!result) {
+        return node;
+    }
+    delete node;
+    return result;
+}
+
+// variables are in function scope, so code including definitions
+// should not be removed, or these symbols will be undefined
+bool optimizer::has_definition(expr* node) {
+    symbol_finder finder;
+    return finder.do_find(node).size();
+}
+
+void optimizer::add_constant(definition_expr* node) {
+    if (!node->get_variable_name() || !node->get_value()) {
+        return;
+    }
+    const auto& name = node->get_variable_name()->get_name();
+    if (!is_constant_variable(scope.back(), name)) {
+        return;
+    }
+    auto value = constant_of(node->get_value());
+    if (value) {
+        constant[scope.back()][name] = value;
+    }
+}
+
+// remove branches with constant false condition and branches after
+// a constant true condition. return true if no branch needs condition check,
+// then the whole statement is replaced by the taken block
+bool optimizer::fold_condition(condition_expr* node,
+                               std::vector<expr*>& taken) {
+    std::vector<if_expr*> branch = {node->get_if_statement()};
+    for(auto i : node->get_elsif_stataments()) {
+        branch.push_back(i);
+    }
+    auto else_branch = node->get_else_statement();
+
+    std::vector<if_expr*> kept;
+    for(usize i = 0; i<branch.size(); ++i) {
+        bool flag = false;
+        if (!constant_condition(branch[i]->get_condition(), flag)) {
+            kept.push_back(branch[i]);
+            continue;
+        }
+        if (!flag) {
+            if (has_definition(branch[i]->get_code_block())) {
+                kept.push_back(branch[i]);
+            } else {
+                delete branch[i];
+            }
+            continue;
+        }
+        // following branches are never executed
+        bool removable = !else_branch || !has_definition(else_branch);
+        for(usize j = i+1; j<branch.size() && removable; ++j) {
+            removable = !has_definition(branch[j]->get_code_block());
+        }
+        if (!removable) {
+            kept.push_back(branch[i]);
+            continue;
+        }
+        for(usize j = i+1; j<branch.size(); ++j) {
+            delete branch[j];
+        }
+        if (else_branch) {
+            delete else_branch;
+        }
+        // condition of else branch is not used
+        else_branch = branch[i];
+        break;
+    }
+
+    node->set_if_statement(kept.size()? kept[0]:nullptr);
+    node->get_elsif_stataments().clear();
+    for(usize i = 1; i<kept.size(); ++i) {
+        node->add_elsif_statement(kept[i]);
+    }
+    node->set_else_statement(else_branch);
+    if (kept.size()) {
+        return false;
+    }
+    if (else_branch) {
+        auto& block = else_branch->get_code_block()->get_expressions();
+        taken = block;
+        block.clear();
+    }
+    return true;
+}
+
+void optimizer::remove_unreachable(code_block* node) {
+    auto& exprs = node->get_expressions();
+    for(usize i = 0; i<exprs.size(); ++i) {
+        const auto type = exprs[i]->get_type();
+        if (type!=expr_type::ast_ret &&
+            type!=expr_type::ast_break &&
+            type!=expr_type::ast_continue) {
+            continue;
+        }
+        for(usize j = i+1; j<exprs.size(); ++j) {
+            if (has_definition(exprs[j])) {
+                return;
+            }
+        }
+        for(usize j = i+1; j<exprs.size(); ++j) {
+            delete exprs[j];
+        }
+        exprs.resize(i+1);
+        return;
+    }
+}
+
+// pure expression has no function call, assignment, definition or closure,
+// so evaluating it does not change any variable.
+// if info is not null, also collects size and symbols of inlined value
+bool optimizer::is_pure(expr* node, inline_function* info) {
+    if (!node) {
+        return true;
+    }
+    if (info) {
+        ++info->size;
+    }
+    switch(node->get_type()) {
+        case expr_type::ast_nil:
+        case expr_type::ast_num:
+        case expr_type::ast_str:
+        case expr_type::ast_bool: return true;
+        case expr_type::ast_id: {
+            if (!info) {
+                return true;
+            }
+            const auto& name = ((identifier*)node)->get_name();
+            // me and arg depend on the function call
+            if (name=="me" || name=="arg") {
+                return false;
+            }
+            for(usize i = 0; i<info->parameter.size(); ++i) {
+                if (info->parameter[i]==name) {
+                    ++info->use_count[i];
+                    return true;
+                }
+            }
+            info->global_symbol.push_back(name);
+            return true;
+        }
+        case expr_type::ast_binary: {
+            auto op = (binary_operator*)node;
+            if (op->get_optimized_number() || op->get_optimized_string()) {
+                return true;
+            }
+            return is_pure(op->get_left(), info) &&
+                is_pure(op->get_right(), info);
+        }
+        case expr_type::ast_unary: {
+            auto op = (unary_operator*)node;
+            return op->get_optimized_number() ||
+                is_pure(op->get_value(), info);
+        }
+        case expr_type::ast_ternary: {
+            auto op = (ternary_operator*)node;
+            return is_pure(op->get_condition(), info) &&
+                is_pure(op->get_left(), info) &&
+                is_pure(op->get_right(), info);
+        }
+        case expr_type::ast_vec:
+            for(auto i : ((vector_expr*)node)->get_elements()) {
+                if (!is_pure(i, info)) {
+                    return false;
+                }
+            }
+            return true;
+        case expr_type::ast_hash:
+            for(auto i : ((hash_expr*)node)->get_members()) {
+                if (!is_pure(i->get_value(), info)) {
+                    return false;
+                }
+            }
+            return true;
+        case expr_type::ast_call: {
+            auto call = (call_expr*)node;
+            if (!is_pure(call->get_first(), info)) {
+                return false;
+            }
+            for(auto i : call->get_calls()) {
+                if (i->get_type()==expr_type::ast_callh) {
+                    continue;
+                }
+                if (i->get_type()!=expr_type::ast_callv) {
+                    return false;
+                }
+                for(auto j : ((call_vector*)i)->get_slices()) {
+                    if (!is_pure(j->get_begin(), info) ||
+                        !is_pure(j->get_end(), info)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+        default: break;
+    }
+    return false;
+}
+
+void optimizer::add_inline_candidate(definition_expr* node) {
+    if (!node->get_variable_name() || !node->get_value() ||
+        node->get_value()->get_type()!=expr_type::ast_func) {
+        return;
+    }
+    const auto& name = node->get_variable_name()->get_name();
+    if (!is_constant_variable(scope.front(), name)) {
+        return;
+    }
+
+    auto function_node = (function*)node->get_value();
+    inline_function info;
+    for(auto i : function_node->get_parameter_list()) {
+        if (i->get_parameter_type()!=
+            parameter::param_type::normal_parameter) {
+            return;
+        }
+        info.parameter.push_back(i->get_parameter_name());
+    }
+    info.use_count.resize(info.parameter.size(), 0);
+
+    const auto& block = function_node->get_code_block()->get_expressions();
+    if (block.size()!=1 || block[0]->get_type()!=expr_type::ast_ret) {
+        return;
+    }
+    info.value = ((return_expr*)block[0])->get_value();
+    if (!info.value || !is_pure(info.value, &info) ||
+        info.size>inline_function_budget) {
+        return;
+    }
+    inline_candidate[name] = info;
+}
+
+// copy the return value, and replace parameters with arguments.
+// all nodes use location of the call, so debugger stops at the caller line
+expr* optimizer::clone_inline(expr* node,
+                              const inline_function* info,
+                              const std::vector<expr*>* args,
+                              const span& location) {
+    if (!node) {
+        return nullptr;
+    }
+    switch(node->get_type()) {
+        case expr_type::ast_nil: return new nil_expr(location);
+        case expr_type::ast_num:
+            return new number_literal(location,
+                ((number_literal*)node)->get_number());
+        case expr_type::ast_str:
+            return new string_literal(location,
+                ((string_literal*)node)->get_content());
+        case expr_type::ast_bool:
+            return new bool_literal(location,
+                ((bool_literal*)node)->get_flag());
+        case expr_type::ast_id: {
+            const auto& name = ((identifier*)node)->get_name();
+            for(usize i = 0; info && i<info->parameter.size(); ++i) {
+                // arguments are in the scope of caller, copy them directly
+                if (info->parameter[i]==name) {
+                    return clone_inline((*args)[i], nullptr, nullptr, location);
+                }
+            }
+            return new identifier(location, name);
+        }
+        case expr_type::ast_binary: {
+            auto op = (binary_operator*)node;
+            if (op->get_optimized_number()) {
+                return clone_inline(op->get_optimized_number(),
+                    info, args, location);
+            }
+            if (op->get_optimized_string()) {
+                return clone_inline(op->get_optimized_string(),
+                    info, args, location);
+            }
+            auto res = new binary_operator(location);
+            res->set_operator_type(op->get_operator_type());
+            res->set_left(clone_inline(op->get_left(), info, args, location));
+            res->set_right(clone_inline(op->get_right(), info, args, location));
+            return res;
+        }
+        case expr_type::ast_unary: {
+            auto op = (unary_operator*)node;
+            if (op->get_optimized_number()) {
+                return clone_inline(op->get_optimized_number(),
+                    info, args, location);
+            }
+            auto res = new unary_operator(location);
+            res->set_operator_type(op->get_operator_type());
+            res->set_value(clone_inline(op->get_value(), info, args, location));
+            return res;
+        }
+        case expr_type::ast_ternary: {
+            auto op = (ternary_operator*)node;
+            auto res = new ternary_operator(location);
+            res->set_condition(
+                clone_inline(op->get_condition(), info, args, location));
+            res->set_left(clone_inline(op->get_left(), info, args, location));
+            res->set_right(clone_inline(op->get_right(), info, args, location));
+            return res;
+        }
+        case expr_type::ast_vec: {
+            auto res = new vector_expr(location);
+            for(auto i : ((vector_expr*)node)->get_elements()) {
+                res->add_element(clone_inline(i, info, args, location));
+            }
+            return res;
+        }
+        case expr_type::ast_hash: {
+            auto res = new hash_expr(location);
+            for(auto i : ((hash_expr*)node)->get_members()) {
+                auto pair = new hash_pair(location);
+                pair->set_name(i->get_name());
+                pair->set_value(
+                    clone_inline(i->get_value(), info, args, location));
+                res->add_member(pair);
+            }
+            return res;
+        }
+        case expr_type::ast_call: {
+            auto call = (call_expr*)node;
+            auto res = new call_expr(location);
+            res->set_first(
+                clone_inline(call->get_first(), info, args, location));
+            for(auto i : call->get_calls()) {
+                if (i->get_type()==expr_type::ast_callh) {
+                    res->add_call(new call_hash(location,
+                        ((call_hash*)i)->get_field()));
+                    continue;
+                }
+                auto vec = new call_vector(location);
+                for(auto j : ((call_vector*)i)->get_slices()) {
+                    auto slice = new slice_vector(location);
+                    slice->set_begin(
+                        clone_inline(j->get_begin(), info, args, location));
+                    slice->set_end(
+                        clone_inline(j->get_end(), info, args, location));
+                    vec->add_slice(slice);
+                }
+                res->add_call(vec);
+            }
+            return res;
+        }
+        default: break;
+    }
+    return nullptr;
+}
+
+expr* optimizer::inline_call(call_expr* node) {
+    if (node->get_first()->get_type()!=expr_type::ast_id ||
+        node->get_calls().size()!=1 ||
+        node->get_calls()[0]->get_type()!=expr_type::ast_callf) {
+        return nullptr;
+    }
+    const auto& name = ((identifier*)node->get_first())->get_name();
+    if (!inline_candidate.count(name) ||
+        symbols.resolve(scope, name)!=scope.front()) {
+        return nullptr;
+    }
+    const auto& info = inline_candidate.at(name);
+    const auto& args = ((call_function*)node->get_calls()[0])->get_argument();
+    if (args.size()!=info.parameter.size() ||
+        inline_growth+info.size>inline_total_budget) {
+        return nullptr;
+    }
+    // global symbols used by the function should not be hidden by
+    // local variables of the caller
+    for(const auto& i : info.global_symbol) {
+        if (symbols.resolve(scope, i)!=scope.front()) {
+            return nullptr;
+        }
+    }
+    // each argument is evaluated once before the call, so an argument used
+    // more than once or not used should be a literal or a variable
+    for(usize i = 0; i<args.size(); ++i) {
+        const auto type = args[i]->get_type();
+        if (type==expr_type::ast_pair) {
+            return nullptr;
+        }
+        if (type==expr_type::ast_nil || type==expr_type::ast_num ||
+            type==expr_type::ast_str || type==expr_type::ast_bool ||
+            type==expr_type::ast_id) {
+            continue;
+        }
+        if (info.use_count[i]!=1 || !is_pure(args[i], nullptr)) {
+            return nullptr;
+        }
+    }
+    inline_growth += info.size;
+    auto res = clone_inline(info.value, &info, &args, node->get_location());
+    // fold constant arguments in the inlined value
+    visit(res);
+    return res;
+}
+
+bool optimizer::visit_code_block(code_block* node) {
+    // only definitions directly in function body are always executed
+    const bool is_body = scope.back()==node;
+    std::vector<expr*> result;
+    for(auto i : node->get_expressions()) {
+        visit(i);
+        std::vector<expr*> taken = {i};
+        if (i->get_type()==expr_type::ast_cond) {
+            if (fold_condition((condition_expr*)i, taken)) {
+                delete i;
+            } else {
+                taken = {i};
+            }
+        } else if (i->get_type()==expr_type::ast_while) {
+            auto loop = (while_expr*)i;
+            bool flag = true;
+            if (constant_condition(loop->get_condition(), flag) && !flag &&
+                !has_definition(loop->get_code_block())) {
+                delete i;
+                taken.clear();
+            }
+        }
+        for(auto j : taken) {
+            result.push_back(j);
+            if (is_body && j->get_type()==expr_type::ast_def) {
+                add_constant((definition_expr*)j);
+            }
+            if (is_body && j->get_type()==expr_type::ast_def &&
+                scope.size()==1) {
+                add_inline_candidate((definition_expr*)j);
+            }
+        }
+    }
+    node->get_expressions() = result;
+    remove_unreachable(node);
+    return true;
+}
+
+bool optimizer::visit_function(function* node) {
+    scope.push_back(node->get_code_block());
+    for(auto i : node->get_parameter_list()) {
+        visit(i);
+    }
+    visit(node->get_code_block());
+    scope.pop_back();
+    return true;
+}
+
+bool optimizer::visit_ternary_operator(ternary_operator* node) {
+    node->set_condition(fold(node->get_condition()));
+    node->set_left(fold(node->get_left()));
+    node->set_right(fold(node->get_right()));
+    return true;
+}
+
+bool optimizer::visit_vector_expr(vector_expr* node) {
+    for(auto& i : node->get_elements()) {
+        i = fold(i);
+    }
+    return true;
+}
+
+bool optimizer::visit_hash_pair(hash_pair* node) {
+    node->set_value(fold(node->get_value()));
+    return true;
+}
+
+bool optimizer::visit_call_function(call_function* node) {
+    for(auto& i : node->get_argument()) {
+        i = fold(i);
+    }
+    return true;
+}
+
+bool optimizer::visit_slice_vector(slice_vector* node) {
+    node->set_begin(fold(node->get_begin()));
+    node->set_end(fold(node->get_end()));
+    return true;
+}
+
+bool optimizer::visit_definition_expr(definition_expr* node) {
+    if (node->get_tuple()) {
+        visit(node->get_tuple());
+    } else {
+        node->set_value(fold(node->get_value()));
+    }
+    return true;
+}
+
+bool optimizer::visit_assignment_expr(assignment_expr* node) {
+    visit(node->get_left());
+    node->set_right(fold(node->get_right()));
+    return true;
+}
+
+bool optimizer::visit_while_expr(while_expr* node) {
+    node->set_condition(fold(node->get_condition()));
+    visit(node->get_code_block());
+    return true;
+}
+
+bool optimizer::visit_if_expr(if_expr* node) {
+    node->set_condition(fold(node->get_condition()));
+    visit(node->get_code_block());
+    return true;
+}
+
+// return f(x) could drop current frame before calling f,
+// calls with hash arguments are not included.
+// code of the right branch of ternary operator is generated last,
+// so return c? x:f(x) also ends with this call
+bool optimizer::is_tail_call(expr* node) {
+    if (!node) {
+        return false;
+    }
+    if (node->get_type()==expr_type::ast_ternary) {
+        return is_tail_call(((ternary_operator*)node)->get_right());
+    }
+    if (node->get_type()!=expr_type::ast_call) {
+        return false;
+    }
+    const auto& calls = ((call_expr*)node)->get_calls();
+    if (!calls.size() || calls.back()->get_type()!=expr_type::ast_callf) {
+        return false;
+    }
+    const auto& args = ((call_function*)calls.back())->get_argument();
+    return !args.size() || args[0]->get_type()!=expr_type::ast_pair;
+}
+
+bool optimizer::visit_return_expr(return_expr* node) {
+    node->set_value(fold(node->get_value()));
+    node->set_tail_call(tail_call && is_tail_call(node->get_value()));
+    return true;
+}
+
 void optimizer::do_optimization(code_block* root) {
-    root->accept(this);
+    symbols.do_find(root);
+    scope.push_back(root);
+    visit(root);
+    scope.clear();
+    constant.clear();
+    inline_candidate.clear();
 }
 
 }
@@ -1,23 +1,132 @@
 #pragma once
 
 #include <cmath>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "nasal_ast.h"
-#include "ast_visitor.h"
+#include "ast_static_visitor.h"
 
 namespace nasal {
 
-class optimizer: public ast_visitor {
+// collects how symbols are defined and changed in each scope,
+// used by optimizer to find variables that are never reassigned.
+// scope is the body of a function, or the root block for global scope
+class assignment_finder: public ast_static_visitor<assignment_finder> {
+public:
+    struct symbol_state {
+        // parameters are counted too
+        usize definition_count = 0;
+        // used as left value of assignment or foreach iterator
+        bool assigned = false;
+        // file of the first definition, used to find functions in lib.nas
+        std::string file;
+    };
+    std::unordered_map<code_block*,
+        std::unordered_map<std::string, symbol_state>> symbols;
+    // "globals" could change any global variable by name
+    bool use_globals = false;
+
+private:
+    std::vector<code_block*> scope;
+
+    void enter_scope(code_block*, const std::vector<std::string>&);
+    void add_definition(const std::string&, const span&);
+    void add_assigned(expr*);
+
+public:
+    // find the scope that this symbol belongs to, nullptr if not found
+    code_block* resolve(const std::vector<code_block*>&,
+                        const std::string&) const;
+    const symbol_state& state(code_block*, const std::string&) const;
+
+public:
+    bool visit_identifier(identifier*);
+    bool visit_function(function*);
+    bool visit_parameter(parameter*);
+    bool visit_definition_expr(definition_expr*);
+    bool visit_assignment_expr(assignment_expr*);
+    bool visit_multi_assign(multi_assign*);
+    bool visit_iter_expr(iter_expr*);
+    void do_find(code_block*);
+};
+
+class optimizer: public ast_static_visitor<optimizer> {
+private:
+    assignment_finder symbols;
+
+    // function scopes from outside to inside, and constant variables of
+    // each scope, only definitions directly in the body are always executed
+    std::vector<code_block*> scope;
+    std::unordered_map<code_block*,
+        std::unordered_map<std::string, expr*>> constant;
+
+    // small leaf function defined in global scope: func(a, b) {return expr;}
+    // expr has no function call or closure, so it could be inlined
+    struct inline_function {
+        std::vector<std::string> parameter;
+        // use count of each parameter in the return value
+        std::vector<usize> use_count;
+        // global symbols used in the return value
+        std::vector<std::string> global_symbol;
+        expr* value = nullptr;
+        usize size = 0;
+    };
+    std::unordered_map<std::string, inline_function> inline_candidate;
+    // node count added by inlining
+    usize inline_growth = 0;
+    // max node count of an inlined return value
+    static const usize inline_function_budget = 16;
+    // max node count added by inlining in the whole tree
+    static const usize inline_total_budget = 1<<16;
+    // mark calls in return position as tail calls, on by default.
+    // dropped frames are not shown in call trace, so debugging may turn it off
+    bool tail_call = true;
+
 private:
     void const_string(binary_operator*, string_literal*, string_literal*);
     void const_number(binary_operator*, number_literal*, number_literal*);
     void const_number(unary_operator*, number_literal*);
 
+    expr* constant_of(expr*);
+    expr* copy_constant(expr*, const span&);
+    bool constant_condition(expr*, bool&);
+    bool is_constant_variable(code_block*, const std::string&);
+    bool is_pure_builtin(const std::string&);
+    expr* fold_builtin(call_expr*);
+    expr* fold(expr*);
+    bool has_definition(expr*);
+    void add_constant(definition_expr*);
+    bool fold_condition(condition_expr*, std::vector<expr*>&);
+    void remove_unreachable(code_block*);
+
+    bool is_pure(expr*, inline_function*);
+    void add_inline_candidate(definition_expr*);
+    expr* clone_inline(expr*, const inline_function*,
+                       const std::vector<expr*>*, const span&);
+    expr* inline_call(call_expr*);
+    bool is_tail_call(expr*);
+
 public:
-    bool visit_binary_operator(binary_operator*) override;
-    bool visit_unary_operator(unary_operator*) override;
+    bool visit_code_block(code_block*);
+    bool visit_function(function*);
+    bool visit_binary_operator(binary_operator*);
+    bool visit_unary_operator(unary_operator*);
+    bool visit_ternary_operator(ternary_operator*);
+    bool visit_vector_expr(vector_expr*);
+    bool visit_hash_pair(hash_pair*);
+    bool visit_call_function(call_function*);
+    bool visit_slice_vector(slice_vector*);
+    bool visit_definition_expr(definition_expr*);
+    bool visit_assignment_expr(assignment_expr*);
+    bool visit_while_expr(while_expr*);
+    bool visit_if_expr(if_expr*);
+    bool visit_return_expr(return_expr*);
 
 public:
+    void set_tail_call(bool flag) {tail_call = flag;}
     void do_optimization(code_block*);
 };
 
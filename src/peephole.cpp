@@ -0,0 +1,195 @@
+#include "peephole.h"
+
+#include <iomanip>
+
+namespace nasal {
+
+bool peephole::is_jump(u8 op) {
+    switch(op) {
+        case op_jmp: case op_jt: case op_jf:
+        case op_findex: case op_feach:
+        case op_newf: return true;
+        default: break;
+    }
+    return false;
+}
+
+void peephole::thread_jumps(std::vector<opcode>& code) {
+    // the jmp before entry of function jumps over the function body,
+    // the vm and bytecode image use it to find the end of function,
+    // so keep it. it is not always the first jmp after newf,
+    // default parameter could be a function too
+    std::vector<bool> function_skip(code.size(), false);
+    for(usize i = 0; i<code.size(); ++i) {
+        const auto entry = code[i].num;
+        if (code[i].op==op_newf && entry>i+1 && entry<=code.size() &&
+            code[entry-1].op==op_jmp) {
+            function_skip[entry-1] = true;
+        }
+    }
+
+    for(usize i = 0; i<code.size(); ++i) {
+        auto& op = code[i];
+        if (op.op==op_newf || !is_jump(op.op) || function_skip[i]) {
+            continue;
+        }
+        // follow jmp chain, step limit avoids endless loop like jmp to self
+        u32 target = op.num;
+        for(usize step = 0; step<code.size(); ++step) {
+            if (target>=code.size() || code[target].op!=op_jmp) {
+                break;
+            }
+            target = code[target].num;
+        }
+        if (target!=op.num) {
+            op.num = target;
+            ++hits[jump_threading];
+        }
+        if (op.op==op_jmp && target<code.size() && code[target].op==op_ret) {
+            op.op = op_ret;
+            op.num = 0;
+            ++hits[jump_to_ret];
+        }
+    }
+}
+
+void peephole::mark_targets(const std::vector<opcode>& code) {
+    is_target.assign(code.size()+1, false);
+    // entry of the program
+    is_target[0] = true;
+    for(const auto& i : code) {
+        if (is_jump(i.op) && i.num<=code.size()) {
+            is_target[i.num] = true;
+        }
+    }
+}
+
+void peephole::rewrite(std::vector<opcode>& code) {
+    removed.assign(code.size(), false);
+    bool reachable = true;
+    for(usize i = 0; i<code.size(); ++i) {
+        reachable |= is_target[i];
+        auto& op = code[i];
+        if (!reachable && op.op!=op_exit) {
+            removed[i] = true;
+            ++hits[unreachable];
+            continue;
+        }
+        const auto next = i+1<code.size()? code[i+1].op:op_exit;
+        const auto next_free = i+1<code.size() && !is_target[i+1];
+        switch(op.op) {
+            case op_pnum: case op_pnil: case op_pstr:
+            case op_callg: case op_calll: case op_upval:
+                if (next==op_pop && next_free) {
+                    removed[i] = removed[i+1] = true;
+                    ++hits[dead_push_pop];
+                    ++i;
+                    continue;
+                }
+                break;
+            case op_meq:
+                if (!op.num && next==op_pop && next_free) {
+                    op.num = 1;
+                    removed[i+1] = true;
+                    ++hits[meq_pop];
+                    ++i;
+                    continue;
+                }
+                break;
+            default: break;
+        }
+
+        // superinstructions
+        if ((op.op==op_calll || op.op==op_callg) &&
+            op_lessc<=next && next<=op_geqc && next_free &&
+            i+2<code.size() && code[i+2].op==op_jf && !is_target[i+2]) {
+            op.op = op.op==op_calll? op_lcmpjf:op_gcmpjf;
+            ++hits[cmp_const_jf];
+            i += 2;
+            continue;
+        }
+        if ((op.op==op_mcalll || op.op==op_mcallg) &&
+            op_addecp<=next && next<=op_divecp && next_free) {
+            op.op = op.op==op_mcalll? op_lcalc:op_gcalc;
+            ++hits[calc_const];
+            i += 1;
+            continue;
+        }
+
+        if (op.op==op_jmp || op.op==op_ret) {
+            reachable = false;
+        }
+    }
+
+    // remove jmp to the next alive opcode, from back to front
+    // so removing one jmp may expose another one before it
+    std::vector<usize> next_alive(code.size()+1, code.size());
+    for(usize i = code.size(); i>0; --i) {
+        const auto index = i-1;
+        if (!removed[index] && code[index].op==op_jmp &&
+            code[index].num>index &&
+            next_alive[index+1]==next_alive[code[index].num]) {
+            removed[index] = true;
+            ++hits[jump_to_next];
+        }
+        next_alive[index] = removed[index]? next_alive[index+1]:index;
+    }
+}
+
+void peephole::compact(
+    std::vector<opcode>& code, std::vector<opcode_location>& location) {
+    // removed opcode is mapped to the next alive one
+    std::vector<u32> new_index(code.size()+1, 0);
+    u32 count = 0;
+    for(usize i = 0; i<code.size(); ++i) {
+        new_index[i] = count;
+        count += removed[i]? 0:1;
+    }
+    new_index[code.size()] = count;
+
+    std::vector<opcode> new_code;
+    std::vector<opcode_location> new_location;
+    new_code.reserve(count);
+    new_location.reserve(count);
+    for(usize i = 0; i<code.size(); ++i) {
+        if (removed[i]) {
+            continue;
+        }
+        auto op = code[i];
+        if (is_jump(op.op) && op.num<=code.size()) {
+            op.num = new_index[op.num];
+        }
+        new_code.push_back(op);
+        new_location.push_back(location[i]);
+    }
+    code.swap(new_code);
+    location.swap(new_location);
+}
+
+void peephole::do_optimization(codegen& gen) {
+    auto& code = gen.code;
+    auto& location = gen.code_location;
+    thread_jumps(code);
+    mark_targets(code);
+    rewrite(code);
+    compact(code, location);
+}
+
+void peephole::print_statistics(std::ostream& out) const {
+    const char* name[pattern_count] = {
+        "jump threading",
+        "jmp to ret",
+        "jmp to next",
+        "dead push pop",
+        "meq pop",
+        "unreachable",
+        "cmp const jf",
+        "calc const"
+    };
+    for(u32 i = 0; i<pattern_count; ++i) {
+        out << "  " << std::left << std::setw(16) << name[i]
+            << std::right << hits[i] << "\n";
+    }
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "nasal.h"
+#include "nasal_opcode.h"
+#include "nasal_codegen.h"
+
+#include <iostream>
+#include <vector>
+
+namespace nasal {
+
+// bytecode peephole optimizer, runs after codegen::compile.
+// superinstructions keep the fused opcodes after the head opcode as
+// operands, so only removed opcodes change addresses of the bytecode
+class peephole {
+private:
+    enum pattern {
+        jump_threading, // jmp/jt/jf/findex/feach to jmp
+        jump_to_ret,    // jmp to ret
+        jump_to_next,   // jmp to the next opcode
+        dead_push_pop,  // push a value without side effect then pop
+        meq_pop,        // meq then pop
+        unreachable,    // opcodes after jmp/ret that no one jumps to
+        cmp_const_jf,   // calll/callg + lessc/leqc/grtc/geqc + jf
+        calc_const,     // mcalll/mcallg + addecp/subecp/mulecp/divecp
+        pattern_count
+    };
+    usize hits[pattern_count] = {0};
+
+    std::vector<bool> is_target;
+    std::vector<bool> removed;
+
+    bool is_jump(u8);
+    void thread_jumps(std::vector<opcode>&);
+    void mark_targets(const std::vector<opcode>&);
+    void rewrite(std::vector<opcode>&);
+    void compact(std::vector<opcode>&, std::vector<opcode_location>&);
+
+public:
+    void do_optimization(codegen&);
+    void print_statistics(std::ostream&) const;
+};
+
+}
@@ -4,8 +4,11 @@
 #include "nasal_import.h"
 #include "optimizer.h"
 #include "nasal_codegen.h"
+#include "peephole.h"
 #include "nasal_vm.h"
 
+#include <sstream>
+
 namespace nasal {
 namespace repl {
 
@@ -83,6 +86,11 @@ bool repl::run() {
     auto nasal_opt = std::unique_ptr<optimizer>(new optimizer);
     auto nasal_codegen = std::unique_ptr<codegen>(new codegen);
 
+    // lsp events are not shown in repl
+    std::stringstream events;
+    nasal_parser->set_output(events);
+    nasal_linker->set_output(events);
+
     update_temp_file();
     if (nasal_lexer->scan("<nasal-repl>").geterr()) {
         return false;
@@ -100,6 +108,7 @@ bool repl::run() {
     if (nasal_codegen->compile(*nasal_parser, *nasal_linker, true).geterr()) {
         return false;
     }
+    peephole().do_optimization(*nasal_codegen);
 
     runtime.run(*nasal_codegen, *nasal_linker, {});
     return true;
@@ -109,6 +118,8 @@ void repl::execute() {
     source = {};
     // mark we are in repl mode
     info::instance()->in_repl_mode = true;
+    // library and modules are parsed only once in each repl session
+    module_cache::instance()->keep_modules = true;
     std::cout << "[nasal-repl] Initializating enviroment...\n";
     // run on pass for initializing basic modules, without output
     if (!run()) {
@@ -17,9 +17,9 @@ bool symbol_finder::visit_definition_expr(definition_expr* node) {
         }
     }
     if (node->get_tuple()) {
-        node->get_tuple()->accept(this);
+        visit(node->get_tuple());
     } else {
-        node->get_value()->accept(this);
+        visit(node->get_value());
     }
     return true;
 }
@@ -38,9 +38,9 @@ bool symbol_finder::visit_iter_expr(iter_expr* node) {
     return true;
 }
 
-const std::vector<symbol_finder::symbol_info>& symbol_finder::do_find(code_block* root) {
+const std::vector<symbol_finder::symbol_info>& symbol_finder::do_find(expr* root) {
     symbols.clear();
-    root->accept(this);
+    visit(root);
     return symbols;
 }
 
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "nasal_ast.h"
-#include "ast_visitor.h"
+#include "ast_static_visitor.h"
 
 #include <cstring>
 #include <sstream>
@@ -9,7 +9,7 @@
 
 namespace nasal {
 
-class symbol_finder: public ast_visitor {
+class symbol_finder: public ast_static_visitor<symbol_finder> {
 public:
     struct symbol_info {
         std::string name;
@@ -20,10 +20,10 @@ private:
     std::vector<symbol_info> symbols;
 
 public:
-    bool visit_definition_expr(definition_expr*) override;
-    bool visit_function(function*) override;
-    bool visit_iter_expr(iter_expr*) override;
-    const std::vector<symbol_finder::symbol_info>& do_find(code_block*);
+    bool visit_definition_expr(definition_expr*);
+    bool visit_function(function*);
+    bool visit_iter_expr(iter_expr*);
+    const std::vector<symbol_finder::symbol_info>& do_find(expr*);
 };
 
 }
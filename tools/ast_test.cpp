@@ -0,0 +1,202 @@
+// ast serializer and parallel parse test, run by ctest and `make test`:
+//   ./ast_test test/*.nas
+// ast of every file must be rebuilt from its serialized form
+// with the same dump and the same bytes when serialized again.
+// truncated, too deep or oversized input must be rejected.
+// a generated file above the parallel parse threshold must give the same
+// ast, lsp events and errors with and without parallel parsing.
+#include "nasal.h"
+#include "nasal_ast.h"
+#include "nasal_lexer.h"
+#include "nasal_parse.h"
+#include "ast_dumper.h"
+#include "ast_serializer.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace nasal;
+
+i32 failed = 0;
+
+void check(bool result, const std::string& file, const std::string& info) {
+    if (!result) {
+        std::cerr << file << ": " << info << "\n";
+        ++failed;
+    }
+}
+
+std::string dump_of(code_block* root) {
+    std::stringstream out;
+    auto backup = std::cout.rdbuf(out.rdbuf());
+    ast_dumper().dump(root);
+    std::cout.rdbuf(backup);
+    return out.str();
+}
+
+// serialized ast of source, empty if source has syntax error
+std::string serialize_source(const std::string& source, const std::string& name) {
+    lexer lex;
+    parse parser;
+    std::stringstream events;
+    parser.set_output(events);
+    if (lex.sscan(source, name).geterr() ||
+        parser.compile(lex).geterr()) {
+        return "";
+    }
+    return ast_serializer().serialize(parser.tree());
+}
+
+void test_round_trip(const std::string& file) {
+    lexer lex;
+    parse parser;
+    std::stringstream events;
+    parser.set_output(events);
+    lex.scan(file).chkerr();
+    parser.compile(lex).chkerr();
+
+    const auto data = ast_serializer().serialize(parser.tree());
+    auto root = ast_deserializer().deserialize(data);
+    check(root, file, "deserialize() rejects serialized ast");
+    if (!root) {
+        return;
+    }
+    check(dump_of(root)==dump_of(parser.tree()), file, "dump is changed");
+    check(ast_serializer().serialize(root)==data, file,
+          "serialized again into other bytes");
+    delete root;
+}
+
+void test_malformed() {
+    const std::string name = "malformed";
+    const auto data = serialize_source("var a = [1, {b: \"c\"}, func(x) {}];", name);
+    check(data.size(), name, "failed to serialize");
+    for(usize i = 0; i<data.size(); ++i) {
+        auto root = ast_deserializer().deserialize(data.substr(0, i));
+        check(!root, name, "truncated input is accepted");
+        delete root;
+    }
+    // first string length is right after "NAST" u32:version u32:count
+    auto oversized = data;
+    oversized[12] = oversized[13] = oversized[14] = oversized[15] = (char)0xff;
+    auto root = ast_deserializer().deserialize(oversized);
+    check(!root, name, "oversized string length is accepted");
+    delete root;
+}
+
+void test_depth() {
+    const std::string name = "depth";
+    // nested vectors, other nodes of the tree are code_block and definition
+    const auto nested = [&](usize depth) {
+        return "var a = " + std::string(depth, '[') + std::string(depth, ']') + ";";
+    };
+    auto data = serialize_source(nested(4000), name);
+    check(data.size(), name, "failed to serialize 4000 nested vectors");
+    auto root = ast_deserializer().deserialize(data);
+    check(root, name, "4000 nested vectors are rejected");
+    delete root;
+
+    data = serialize_source(nested(5000), name);
+    check(data.size(), name, "failed to serialize 5000 nested vectors");
+    root = ast_deserializer().deserialize(data);
+    check(!root, name, "5000 nested vectors are accepted");
+    delete root;
+}
+
+// result of parsing a file, with or without parallel parsing
+struct parse_result {
+    std::string events;
+    std::string errors;
+    std::string dump;
+    u32 error_count;
+};
+
+parse_result parse_file(const std::string& file, bool parallel, bool stream) {
+    lexer lex;
+    parse parser;
+    std::stringstream events, errors;
+    parser.set_output(events);
+    parser.set_error_output(errors);
+    parser.set_parallel(parallel);
+    parser.set_stream(stream);
+    lex.scan(file).chkerr();
+    const auto error_count = parser.compile(lex).geterr();
+    return {events.str(), errors.str(), dump_of(parser.tree()), error_count};
+}
+
+// top-level function definitions with other statements between them,
+// about 60 tokens each. the one at index broken has a syntax error,
+// no one if broken is not less than count
+std::string generate_source(u32 count, u32 broken) {
+    std::stringstream ss;
+    for(u32 i = 0; i<count; ++i) {
+        ss << "var f" << i << " = func(a, b = " << i << ") {\n";
+        ss << "    var c = a + b * " << i << ";\n";
+        if (i==broken) {
+            ss << "    c = c + ;\n";
+        }
+        ss << "    if (c > 10) { return c; }\n";
+        ss << "    return [a, b, {x: c, y: func { return me; }}];\n";
+        ss << "}\n";
+        if (i%10==0) {
+            ss << "println(f" << i << "(1, 2));\n";
+        }
+    }
+    return ss.str();
+}
+
+void test_parallel(const std::string& file, bool with_error) {
+    const auto name = with_error? "parallel parse with error":"parallel parse";
+    {
+        std::ofstream out(file, std::ios::binary|std::ios::trunc);
+        out << generate_source(400, with_error? 233:400);
+    }
+    lexer lex;
+    lex.scan(file).chkerr();
+    // PARALLEL_PARSE_THRESHOLD in nasal_parse.cpp
+    check(lex.result().size()>8192*2, name, "generated file is too small");
+
+    for(auto stream : {false, true}) {
+        const auto serial = parse_file(file, false, stream);
+        const auto parallel = parse_file(file, true, stream);
+        check(serial.error_count==(with_error? 1:0), name, "wrong error count");
+        check(parallel.error_count==serial.error_count, name,
+              "error count differs from serial parse");
+        check(parallel.errors==serial.errors, name,
+              "error info differs from serial parse");
+        check(parallel.events==serial.events, name,
+              "lsp events differ from serial parse");
+        check(parallel.dump==serial.dump, name, "ast differs from serial parse");
+    }
+    std::remove(file.c_str());
+}
+
+i32 main(i32 argc, const char* argv[]) {
+    if (argc<2) {
+        std::cerr << "usage: ast_test [files...]\n";
+        return 1;
+    }
+    for(i32 i = 1; i<argc; ++i) {
+        test_round_trip(argv[i]);
+    }
+    test_malformed();
+    test_depth();
+    char temp[] = "/tmp/nasal_ast_test_XXXXXX.nas";
+    const auto fd = mkstemps(temp, 4);
+    if (fd<0) {
+        std::cerr << "failed to create temporary file\n";
+        return 1;
+    }
+    close(fd);
+    test_parallel(temp, false);
+    test_parallel(temp, true);
+    if (failed) {
+        std::cerr << failed << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "ast: " << argc-1 << " file(s) passed\n";
+    return 0;
+}
@@ -0,0 +1,101 @@
+// concrete syntax tree test, run by ctest and `make test`:
+//   ./cst_test test/fib.nas test/*.nas
+// every file must be printed back byte for byte in lossless mode,
+// and one replace() on test/fib.nas must only change the replaced node.
+#include "nasal.h"
+#include "nasal_ast.h"
+#include "nasal_cst.h"
+#include "nasal_lexer.h"
+#include "nasal_parse.h"
+
+#include <iostream>
+#include <sstream>
+
+using namespace nasal;
+
+i32 failed = 0;
+
+void check(bool result, const std::string& file, const std::string& info) {
+    if (!result) {
+        std::cerr << file << ": " << info << "\n";
+        ++failed;
+    }
+}
+
+void test_print(const std::string& file) {
+    lexer lex;
+    lex.set_lossless(true);
+    lex.scan(file).chkerr();
+    cst tree(lex);
+    check(tree.size()==lex.result().size(), file, "token is not mapped");
+    check(tree.print()==lex.source(), file, "print() changes the source");
+}
+
+// lexer in default mode has no trivia, so no index is valid
+void test_not_lossless(const std::string& file) {
+    lexer lex;
+    lex.scan(file).chkerr();
+    cst tree(lex);
+    check(tree.size()==0, file, "size() is not 0 without trivia");
+    const usize first = 0;
+    check(tree.text(first).empty() && tree.leading_trivia(first).empty() &&
+          tree.trailing_trivia(first).empty(), file, "text out of range");
+}
+
+// replace function literal of `var fib=func(x) {...}`
+void test_replace(const std::string& file) {
+    lexer lex;
+    parse parser;
+    std::stringstream events;
+    parser.set_output(events);
+    lex.set_lossless(true);
+    lex.scan(file).chkerr();
+    parser.compile(lex).chkerr();
+    cst tree(lex);
+
+    const auto& source = lex.source();
+    const auto begin = source.find("func(x)");
+    const auto end = source.find("\n}\n")+2;
+    check(begin!=std::string::npos && end>begin, file, "fib is not found");
+    if (failed) {
+        return;
+    }
+
+    auto def = (definition_expr*)parser.tree()->get_expressions()[0];
+    check(def->get_type()==expr_type::ast_def, file, "first is not definition");
+    if (failed) {
+        return;
+    }
+    auto value = def->get_value();
+    check(tree.text(value)==source.substr(begin, end-begin), file,
+          "text() of function is not its source");
+
+    const std::string replacement = "func(x) {return x;}";
+    check(tree.replace(value, replacement), file, "replace() failed");
+    // overlapping edit is rejected
+    check(!tree.replace(value, "nil"), file, "overlapped replace() succeeded");
+    const auto expect = source.substr(0, begin) + replacement +
+                        source.substr(end);
+    check(tree.print()==expect, file, "print() after replace() is wrong");
+
+    tree.clear_edits();
+    check(tree.print()==source, file, "print() after clear_edits() is wrong");
+}
+
+i32 main(i32 argc, const char* argv[]) {
+    if (argc<2) {
+        std::cerr << "usage: cst_test test/fib.nas [files...]\n";
+        return 1;
+    }
+    test_replace(argv[1]);
+    test_not_lossless(argv[1]);
+    for(i32 i = 1; i<argc; ++i) {
+        test_print(argv[i]);
+    }
+    if (failed) {
+        std::cerr << failed << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "cst: " << argc-1 << " file(s) passed\n";
+    return 0;
+}
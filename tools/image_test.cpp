@@ -0,0 +1,238 @@
+// bytecode image test, run by ctest and `make test`:
+//   ./image_test test/*.nas --run test/fib.nas [files...]
+// image of every file must decode to the same bytecode as a fresh compile,
+// files after --run are also executed from both and must print the same.
+// a cached image must be rejected after its source or build id is changed,
+// and a truncated or corrupted image must never be loaded.
+#include "nasal.h"
+#include "nasal_codegen.h"
+#include "nasal_image.h"
+#include "nasal_import.h"
+#include "nasal_lexer.h"
+#include "nasal_parse.h"
+#include "nasal_vm.h"
+#include "optimizer.h"
+#include "peephole.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace nasal;
+
+i32 failed = 0;
+
+void check(bool result, const std::string& file, const std::string& info) {
+    if (!result) {
+        std::cerr << file << ": " << info << "\n";
+        ++failed;
+    }
+}
+
+// same steps as `nasal -e`
+struct compiled {
+    lexer lex;
+    parse parser;
+    linker ld;
+    codegen gen;
+    std::stringstream events;
+
+    compiled(const std::string& file) {
+        parser.set_output(events);
+        ld.set_output(events);
+        lex.scan(file).chkerr();
+        parser.compile(lex).chkerr();
+        ld.link(parser, file, false).chkerr();
+        optimizer opt;
+        opt.do_optimization(parser.tree());
+        gen.compile(parser, ld, false).chkerr();
+        peephole hole;
+        hole.do_optimization(gen);
+    }
+};
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+void write_file(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary|std::ios::trunc);
+    out.write(data.data(), data.size());
+}
+
+bool same_code(const codegen& gen, const bytecode_image& image) {
+    const auto& codes = gen.codes();
+    const auto& locations = gen.locations();
+    if (codes.size()!=image.codes().size() ||
+        locations.size()!=image.locations().size()) {
+        return false;
+    }
+    for(usize i = 0; i<codes.size(); ++i) {
+        if (codes[i].op!=image.codes()[i].op ||
+            codes[i].num!=image.codes()[i].num ||
+            locations[i].fidx!=image.locations()[i].fidx ||
+            locations[i].line!=image.locations()[i].line) {
+            return false;
+        }
+    }
+    if (gen.natives().size()!=image.natives().size()) {
+        return false;
+    }
+    for(usize i = 0; i<gen.natives().size(); ++i) {
+        if (std::strcmp(gen.natives()[i].name, image.natives()[i].name)) {
+            return false;
+        }
+    }
+    // compare numbers by bits, nan is not equal to itself
+    const auto& nums = gen.nums();
+    return gen.strs()==image.strs() && gen.globals()==image.globals() &&
+        nums.size()==image.nums().size() &&
+        !std::memcmp(nums.data(), image.nums().data(), nums.size()*sizeof(f64));
+}
+
+template<typename F>
+std::string output_of(F run) {
+    std::stringstream out;
+    auto backup = std::cout.rdbuf(out.rdbuf());
+    run();
+    std::cout.rdbuf(backup);
+    return out.str();
+}
+
+void test_round_trip(const std::string& file, const std::string& path,
+                     bool run) {
+    compiled fresh(file);
+    bytecode_image image;
+    check(image.build(fresh.gen, fresh.ld), file, "build() failed");
+    check(image.save(path), file, "save() failed");
+    bytecode_image loaded;
+    check(loaded.load(path), file, "load() rejects a fresh image");
+    if (failed) {
+        return;
+    }
+    check(same_code(fresh.gen, loaded), file, "image differs from codegen");
+    if (!run) {
+        return;
+    }
+    // vm quickens bytecode in place, so compare before running
+    const std::vector<std::string> argv;
+    const auto expect = output_of([&] {vm().run(fresh.gen, fresh.ld, argv);});
+    const auto result = output_of([&] {vm().run(loaded, argv);});
+    check(expect==result, file, "output from image differs from compile");
+}
+
+// image at path must be rejected after data is changed by edit
+template<typename F>
+void expect_rejected(const std::string& path, const std::string& info,
+                     F edit) {
+    const auto data = read_file(path);
+    auto changed = data;
+    edit(changed);
+    write_file(path, changed);
+    bytecode_image image;
+    check(!image.load(path), path, info);
+    write_file(path, data);
+}
+
+void test_cache(const std::string& dir) {
+    setenv("XDG_CACHE_HOME", dir.c_str(), 1);
+    const auto file = dir + "/source.nas";
+    const std::string source = "var f = func(x) {return x+1;}\nprintln(f(1));\n";
+    write_file(file, source);
+    usize code_size = 0;
+    {
+        compiled fresh(file);
+        bytecode_image image;
+        check(image.build(fresh.gen, fresh.ld) && image.save_cache(file),
+              file, "save_cache() failed");
+        code_size = fresh.gen.codes().size();
+    }
+    bytecode_image image;
+    check(image.load_cache(file), file, "load_cache() rejects a fresh image");
+
+    // stale source, the cache is used again after the edit is undone
+    write_file(file, source + "println(2);\n");
+    check(!image.load_cache(file), file, "edited source is not detected");
+    write_file(file, source);
+    check(image.load_cache(file), file, "restored source is not accepted");
+
+    const auto path = bytecode_image::image_path(file);
+    check(!path.empty(), file, "image_path() is empty");
+    if (failed) {
+        return;
+    }
+    // header is "NASC" u32:version u32:operand_size u64:build_id
+    expect_rejected(path, "image of another build is loaded",
+        [](std::string& data) {data[12] ^= 1;});
+    expect_rejected(path, "image of another version is loaded",
+        [](std::string& data) {data[4] ^= 1;});
+    expect_rejected(path, "bad magic is loaded",
+        [](std::string& data) {data[0] = 'X';});
+    expect_rejected(path, "empty image is loaded",
+        [](std::string& data) {data.clear();});
+    for(usize size = 1; size<64; size += 7) {
+        expect_rejected(path, "truncated image is loaded",
+            [&](std::string& data) {data.resize(data.size()-size);});
+    }
+    expect_rejected(path, "trailing bytes are loaded",
+        [](std::string& data) {data += '\0';});
+    // codes are {u8:op u32:num}, followed by {u16:fidx u32:line}
+    const auto code_begin = read_file(path).size()-code_size*11;
+    expect_rejected(path, "unknown opcode is loaded",
+        [&](std::string& data) {data[code_begin] = (char)0xff;});
+    expect_rejected(path, "operand out of range is loaded",
+        [&](std::string& data) {
+            for(usize i = 0; i<code_size; ++i) {
+                std::memset(&data[code_begin+i*5+1], 0xff, 4);
+            }
+        });
+    expect_rejected(path, "file index out of range is loaded",
+        [&](std::string& data) {
+            std::memset(&data[code_begin+code_size*5], 0xff, 2);
+        });
+    check(image.load_cache(file), file, "restored image is not accepted");
+
+    std::remove(path.c_str());
+    std::remove(file.c_str());
+}
+
+i32 main(i32 argc, const char* argv[]) {
+    if (argc<2) {
+        std::cerr << "usage: image_test [files...] --run [files...]\n";
+        return 1;
+    }
+    char temp[] = "/tmp/nasal_image_test_XXXXXX";
+    if (!mkdtemp(temp)) {
+        std::cerr << "failed to create temporary directory\n";
+        return 1;
+    }
+    const std::string dir = temp;
+    const auto path = dir + "/round_trip.nasc";
+    bool run = false;
+    i32 count = 0;
+    for(i32 i = 1; i<argc; ++i) {
+        if (std::string(argv[i])=="--run") {
+            run = true;
+            continue;
+        }
+        test_round_trip(argv[i], path, run);
+        ++count;
+    }
+    std::remove(path.c_str());
+    test_cache(dir);
+    rmdir((dir + "/nasal").c_str());
+    rmdir(dir.c_str());
+    if (failed) {
+        std::cerr << failed << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "image: " << count << " file(s) passed\n";
+    return 0;
+}
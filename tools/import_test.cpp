@@ -0,0 +1,248 @@
+// module import test, run by ctest and `make test` from the source root:
+//   ./import_test
+// modules in a temporary directory are linked with and without parallel
+// parsing, link order, lsp events, ast and diagnostics must be the same.
+// with module_cache enabled, an edited module must be parsed again,
+// and the same relative path in another working directory is another file.
+#include "nasal.h"
+#include "nasal_ast.h"
+#include "nasal_import.h"
+#include "nasal_lexer.h"
+#include "nasal_parse.h"
+#include "ast_dumper.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+using namespace nasal;
+
+i32 failed = 0;
+
+void check(bool result, const std::string& file, const std::string& info) {
+    if (!result) {
+        std::cerr << file << ": " << info << "\n";
+        ++failed;
+    }
+}
+
+void write_file(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary|std::ios::trunc);
+    out << data;
+}
+
+// modules changed in the last second are not cached, see cache_module
+void set_mtime(const std::string& path, time_t mtime) {
+    struct utimbuf times = {mtime, mtime};
+    utime(path.c_str(), &times);
+}
+
+struct link_result {
+    std::vector<std::string> files;
+    std::string events;
+    std::string errors;
+    std::string dump;
+    u32 error_count;
+};
+
+link_result link_file(const std::string& dir, const std::string& file,
+                      bool parallel) {
+    lexer lex;
+    parse parser;
+    linker ld;
+    std::stringstream events, errors, dump;
+    parser.set_output(events);
+    ld.set_output(events);
+    ld.set_parallel(parallel);
+    lex.scan(file).chkerr();
+    parser.compile(lex).chkerr();
+
+    // lexer and parser of modules print errors to std::cerr
+    auto backup = std::cerr.rdbuf(errors.rdbuf());
+    const auto error_count = ld.link(parser, file, false).geterr();
+    std::cerr.rdbuf(backup);
+
+    backup = std::cout.rdbuf(dump.rdbuf());
+    ast_dumper().dump(parser.tree());
+    std::cout.rdbuf(backup);
+
+    // std/lib.nas and its modules are always linked,
+    // only modules of this test are kept
+    std::vector<std::string> files;
+    for(const auto& i : ld.get_file_list()) {
+        if (!i.compare(0, dir.length(), dir)) {
+            files.push_back(i);
+        }
+    }
+    return {files, events.str(), errors.str(), dump.str(), error_count};
+}
+
+void compare(const std::string& name, const link_result& serial,
+             const link_result& parallel) {
+    check(parallel.files==serial.files, name, "link order differs");
+    check(parallel.events==serial.events, name, "lsp events differ");
+    check(parallel.errors==serial.errors, name, "diagnostics differ");
+    check(parallel.error_count==serial.error_count, name,
+          "error count differs");
+    check(parallel.dump==serial.dump, name, "ast differs");
+}
+
+void test_modules(const std::string& dir) {
+    const auto name = "modules";
+    const auto main = dir + "/main.nas";
+    write_file(main,
+        "import(\"" + dir + "/a.nas\");\n"
+        "import(\"" + dir + "/b.nas\");\n"
+        "println(a.fa() + b.fb());\n");
+    write_file(dir + "/a.nas",
+        "import(\"" + dir + "/c.nas\");\n"
+        "var fa = func { return c.fc() + 1; }\n");
+    write_file(dir + "/b.nas",
+        "import(\"" + dir + "/c.nas\");\n"
+        "import(\"" + dir + "/d.nas\");\n"
+        "var fb = func { return d.fd() + 2; }\n");
+    write_file(dir + "/c.nas", "var fc = func { return 3; }\n");
+    write_file(dir + "/d.nas", "var fd = func { return 4; }\n");
+
+    const auto serial = link_file(dir, main, false);
+    const auto parallel = link_file(dir, main, true);
+    const std::vector<std::string> order = {
+        main, dir + "/a.nas", dir + "/c.nas", dir + "/b.nas", dir + "/d.nas"
+    };
+    check(serial.files==order, name, "wrong link order");
+    check(!serial.error_count && serial.errors.empty(), name,
+          "unexpected error:\n" + serial.errors);
+    compare(name, serial, parallel);
+}
+
+void test_diagnostics(const std::string& dir) {
+    const auto name = "diagnostics";
+    const auto main = dir + "/main.nas";
+    write_file(main,
+        "import(\"" + dir + "/a.nas\");\n"
+        "import(\"" + dir + "/syntax.nas\");\n"
+        "import(\"" + dir + "/b.nas\");\n"
+        "import(\"" + dir + "/missing.nas\");\n"
+        "println(a.fa());\n");
+    write_file(dir + "/a.nas",
+        "import(\"" + dir + "/lexer.nas\");\n"
+        "var fa = func { return 1; }\n");
+    write_file(dir + "/syntax.nas", "var f = func { return 1 +; }\n");
+    write_file(dir + "/lexer.nas", "var s = 1;\n\x01\n");
+    write_file(dir + "/b.nas", "var fb = func(a) { return a; }\n");
+
+    const auto serial = link_file(dir, main, false);
+    const auto parallel = link_file(dir, main, true);
+    // lexer and parser count their own errors, linker reports
+    // the two modules that failed and the missing one
+    check(serial.error_count==3, name, "errors are not reported");
+    check(serial.errors.find("syntax.nas")!=std::string::npos &&
+          serial.errors.find("lexer.nas")!=std::string::npos &&
+          serial.errors.find("missing.nas")!=std::string::npos,
+          name, "error of a module is missing:\n" + serial.errors);
+    compare(name, serial, parallel);
+}
+
+bool linked(const link_result& result, const std::string& value) {
+    return result.dump.find(value)!=std::string::npos;
+}
+
+void test_module_cache(const std::string& dir) {
+    const auto name = "module cache";
+    auto cache = module_cache::instance();
+    cache->keep_modules = true;
+    const auto main = dir + "/main.nas";
+    const auto module = dir + "/m.nas";
+    write_file(main, "import(\"" + module + "\");\nprintln(m.value);\n");
+    write_file(module, "var value = \"first\";\n");
+    const auto past = std::time(nullptr)-100;
+    set_mtime(module, past);
+    check(linked(link_file(dir, main, true), "first"), name,
+          "module is not linked");
+    char full[PATH_MAX];
+    check(realpath(module.c_str(), full) && cache->modules.count(full),
+          name, "module is not cached by its absolute path");
+
+    // edited just now, the cached one is dropped
+    write_file(module, "var value = \"second\";\n");
+    auto result = link_file(dir, main, true);
+    check(linked(result, "second") && !linked(result, "first"), name,
+          "edited module is not parsed again");
+
+    // same size, only mtime tells it is changed
+    set_mtime(module, past+10);
+    check(linked(link_file(dir, main, false), "second"), name,
+          "module is not linked");
+    write_file(module, "var value = \"change\";\n");
+    set_mtime(module, past+20);
+    result = link_file(dir, main, false);
+    check(linked(result, "change") && !linked(result, "second"), name,
+          "module with the same size is not parsed again");
+
+    // the same relative path, size and mtime in two directories
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        check(false, name, "failed to get working directory");
+        return;
+    }
+    // values are not in the paths, ast dump has file names
+    const std::pair<std::string, std::string> dirs[] = {
+        {"one", "apple"}, {"two", "lemon"}
+    };
+    for(const auto& i : dirs) {
+        const auto sub = dir + "/" + i.first;
+        mkdir(sub.c_str(), 0755);
+        // std/lib.nas is searched in working directory
+        check(!symlink((std::string(cwd) + "/std").c_str(),
+                       (sub + "/std").c_str()), name, "failed to link std");
+        write_file(sub + "/main.nas", "import(\"rel.nas\");\n");
+        write_file(sub + "/rel.nas", "var value = \"" + i.second + "\";\n");
+        set_mtime(sub + "/rel.nas", past);
+    }
+    check(!chdir((dir + "/one").c_str()) &&
+          linked(link_file(dir, dir + "/one/main.nas", true), "apple"),
+          name, "relative module is not linked");
+    check(!chdir((dir + "/two").c_str()) &&
+          linked(link_file(dir, dir + "/two/main.nas", true), "lemon"),
+          name, "module of another working directory is reused");
+    check(!chdir(cwd), name, "failed to restore working directory");
+    for(auto i : {"one", "two"}) {
+        const auto sub = dir + "/" + i;
+        for(auto file : {"/std", "/main.nas", "/rel.nas"}) {
+            std::remove((sub + file).c_str());
+        }
+        rmdir(sub.c_str());
+    }
+    std::remove(module.c_str());
+    cache->keep_modules = false;
+    cache->modules.clear();
+}
+
+i32 main() {
+    char temp[] = "/tmp/nasal_import_test_XXXXXX";
+    if (!mkdtemp(temp)) {
+        std::cerr << "failed to create temporary directory\n";
+        return 1;
+    }
+    const std::string dir = temp;
+    test_modules(dir);
+    test_diagnostics(dir);
+    test_module_cache(dir);
+    for(auto i : {"main", "a", "b", "c", "d", "syntax", "lexer"}) {
+        std::remove((dir + "/" + i + ".nas").c_str());
+    }
+    rmdir(dir.c_str());
+    if (failed) {
+        std::cerr << failed << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "import: passed\n";
+    return 0;
+}
@@ -0,0 +1,104 @@
+// optimizer and peephole test, run by ctest and `make test`:
+//   ./opt_test test/fib.nas [files...]
+// every file is run twice, once without optimizer and peephole,
+// once like `nasal -e --opt-stat`, and must print the same.
+// peephole statistics must name every pattern, some patterns must hit.
+#include "nasal.h"
+#include "nasal_codegen.h"
+#include "nasal_import.h"
+#include "nasal_lexer.h"
+#include "nasal_parse.h"
+#include "nasal_vm.h"
+#include "optimizer.h"
+#include "peephole.h"
+
+#include <iostream>
+#include <sstream>
+
+using namespace nasal;
+
+i32 failed = 0;
+
+void check(bool result, const std::string& file, const std::string& info) {
+    if (!result) {
+        std::cerr << file << ": " << info << "\n";
+        ++failed;
+    }
+}
+
+// output of running file, statistics is not written if not optimized
+std::string run(const std::string& file, bool optimize,
+                std::ostream& statistics) {
+    lexer lex;
+    parse parser;
+    linker ld;
+    codegen gen;
+    std::stringstream events;
+    parser.set_output(events);
+    ld.set_output(events);
+    lex.scan(file).chkerr();
+    parser.compile(lex).chkerr();
+    ld.link(parser, file, false).chkerr();
+    if (optimize) {
+        optimizer().do_optimization(parser.tree());
+    }
+    gen.compile(parser, ld, false).chkerr();
+    if (optimize) {
+        peephole hole;
+        hole.do_optimization(gen);
+        hole.print_statistics(statistics);
+    }
+
+    std::stringstream out;
+    auto backup = std::cout.rdbuf(out.rdbuf());
+    vm().run(gen, ld, {});
+    std::cout.rdbuf(backup);
+    return out.str();
+}
+
+// sum of hits, -1 if a pattern is missing, see peephole::print_statistics
+i64 total_hits(const std::string& statistics) {
+    const char* name[] = {
+        "jump threading", "jmp to ret", "jmp to next", "dead push pop",
+        "meq pop", "unreachable", "cmp const jf", "calc const"
+    };
+    i64 total = 0;
+    for(auto i : name) {
+        const auto pos = statistics.find(std::string("  ") + i);
+        if (pos==std::string::npos) {
+            return -1;
+        }
+        std::stringstream ss(statistics.substr(pos+2+std::string(i).length()));
+        i64 hits = -1;
+        ss >> hits;
+        if (hits<0) {
+            return -1;
+        }
+        total += hits;
+    }
+    return total;
+}
+
+i32 main(i32 argc, const char* argv[]) {
+    if (argc<2) {
+        std::cerr << "usage: opt_test [files...]\n";
+        return 1;
+    }
+    i64 total = 0;
+    for(i32 i = 1; i<argc; ++i) {
+        std::stringstream unused, statistics;
+        const auto expect = run(argv[i], false, unused);
+        const auto result = run(argv[i], true, statistics);
+        check(expect==result, argv[i], "optimized output differs");
+        const auto hits = total_hits(statistics.str());
+        check(hits>=0, argv[i], "wrong statistics:\n" + statistics.str());
+        total += hits;
+    }
+    check(total>0, "statistics", "no peephole pattern is found");
+    if (failed) {
+        std::cerr << failed << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "opt: " << argc-1 << " file(s) passed\n";
+    return 0;
+}
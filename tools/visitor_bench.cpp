@@ -0,0 +1,142 @@
+// ast visitor dispatch benchmark,
+// compares virtual ast_visitor with switch based ast_static_visitor.
+// built by `make visitor_bench` or the cmake target of the same name:
+//   ./visitor_bench test/bp.nas 5000
+#include "nasal.h"
+#include "nasal_lexer.h"
+#include "nasal_parse.h"
+#include "ast_visitor.h"
+#include "ast_static_visitor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+using namespace nasal;
+
+class virtual_counter: public ast_visitor {
+public:
+    u64 count = 0;
+    bool visit_identifier(identifier* node) override {
+        ++count;
+        return true;
+    }
+    bool visit_number_literal(number_literal* node) override {
+        ++count;
+        return true;
+    }
+};
+
+class static_counter: public ast_static_visitor<static_counter> {
+public:
+    u64 count = 0;
+    bool visit_identifier(identifier* node) {
+        ++count;
+        return true;
+    }
+    bool visit_number_literal(number_literal* node) {
+        ++count;
+        return true;
+    }
+};
+
+// count all nodes by wrapping each dispatch
+class all_nodes: public ast_visitor {
+public:
+    u64 count = 0;
+#define COUNT(type, name) bool visit_##name(type* node) override {\
+        ++count;\
+        return ast_visitor::visit_##name(node);\
+    }
+    COUNT(null_expr, null_expr)
+    COUNT(nil_expr, nil_expr)
+    COUNT(number_literal, number_literal)
+    COUNT(string_literal, string_literal)
+    COUNT(identifier, identifier)
+    COUNT(bool_literal, bool_literal)
+    COUNT(vector_expr, vector_expr)
+    COUNT(hash_expr, hash_expr)
+    COUNT(hash_pair, hash_pair)
+    COUNT(function, function)
+    COUNT(code_block, code_block)
+    COUNT(parameter, parameter)
+    COUNT(ternary_operator, ternary_operator)
+    COUNT(binary_operator, binary_operator)
+    COUNT(unary_operator, unary_operator)
+    COUNT(call_expr, call_expr)
+    COUNT(call_hash, call_hash)
+    COUNT(call_vector, call_vector)
+    COUNT(call_function, call_function)
+    COUNT(slice_vector, slice_vector)
+    COUNT(definition_expr, definition_expr)
+    COUNT(assignment_expr, assignment_expr)
+    COUNT(multi_identifier, multi_identifier)
+    COUNT(tuple_expr, tuple_expr)
+    COUNT(multi_assign, multi_assign)
+    COUNT(while_expr, while_expr)
+    COUNT(for_expr, for_expr)
+    COUNT(iter_expr, iter_expr)
+    COUNT(forei_expr, forei_expr)
+    COUNT(condition_expr, condition_expr)
+    COUNT(if_expr, if_expr)
+    COUNT(continue_expr, continue_expr)
+    COUNT(break_expr, break_expr)
+    COUNT(return_expr, return_expr)
+#undef COUNT
+};
+
+i32 main(i32 argc, const char* argv[]) {
+    if (argc<2) {
+        std::cerr << "usage: " << argv[0] << " <file> [repeat]\n";
+        return 1;
+    }
+    const u64 repeat = argc>2? std::stoull(argv[2]):100;
+
+    lexer lex;
+    lex.scan(argv[1]).chkerr();
+    parse par;
+    std::stringstream events;
+    par.set_output(events);
+    par.set_parallel(false);
+    par.compile(lex).chkerr();
+    auto root = par.tree();
+
+    all_nodes nodes;
+    root->accept(&nodes);
+
+    // run both visitors alternately and keep the best round,
+    // to reduce noise from other processes
+    using clk = std::chrono::steady_clock;
+    virtual_counter vc;
+    static_counter sc;
+    f64 virtual_ns = 0, static_ns = 0;
+    for(u32 round = 0; round<5; ++round) {
+        auto begin = clk::now();
+        for(u64 i = 0; i<repeat; ++i) {
+            root->accept(&vc);
+        }
+        const f64 v = std::chrono::duration<f64, std::nano>(
+            clk::now()-begin).count();
+
+        begin = clk::now();
+        for(u64 i = 0; i<repeat; ++i) {
+            sc.visit(root);
+        }
+        const f64 s = std::chrono::duration<f64, std::nano>(
+            clk::now()-begin).count();
+
+        virtual_ns = round? std::min(virtual_ns, v):v;
+        static_ns = round? std::min(static_ns, s):s;
+    }
+
+    if (vc.count!=sc.count) {
+        std::cerr << "result mismatch " << vc.count << " " << sc.count << "\n";
+        return 1;
+    }
+    const f64 total = (f64)nodes.count*repeat;
+    std::cout << "nodes        " << nodes.count << " x " << repeat << "\n";
+    std::cout << "ast_visitor  " << virtual_ns/total << " ns/node\n";
+    std::cout << "static       " << static_ns/total << " ns/node\n";
+    return 0;
+}